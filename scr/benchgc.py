@@ -0,0 +1,42 @@
+#!/usr/bin/env python
+
+# run a benchmark with each copy order (--gc-order) and number of threads
+# (--gc-threads) of collector, and print the best CPU time of some runs with
+# the last line the benchmark printed.
+
+from __future__ import print_function
+import sys, argparse, resource
+from subprocess import Popen, PIPE
+
+parser = argparse.ArgumentParser(
+        description="Run a rudel benchmark with each GC copy order")
+parser.add_argument('--runs', default=3, type=int,
+        help="runs of each order, the best is printed")
+parser.add_argument('--orders', default="breadth,cdr,depth",
+        help="comma separated copy orders")
+parser.add_argument('--threads', default="",
+        help="comma separated numbers of GC threads, default of rudel if empty")
+parser.add_argument('rudel_cmd', help="rudel executable")
+parser.add_argument('bench', help="benchmark file")
+args = parser.parse_args()
+
+def cpu_time():
+    r = resource.getrusage(resource.RUSAGE_CHILDREN)
+    return r.ru_utime + r.ru_stime
+
+for order in args.orders.split(','):
+    for threads in args.threads.split(','):
+        opts = ['--gc-order=' + order] + (['--gc-threads=' + threads] if threads else [])
+        best = None
+        last = ''
+        for i in range(args.runs):
+            t0 = cpu_time()
+            p = Popen([args.rudel_cmd] + opts + [args.bench], stdout=PIPE)
+            out = p.communicate()[0].decode('utf-8', 'replace').strip().splitlines()
+            t = cpu_time() - t0
+            if p.returncode != 0:
+                print("%s failed: %d" % (' '.join(opts), p.returncode))
+                sys.exit(1)
+            best = t if best is None or t < best else best
+            last = out[-1] if out else ''
+        print("%-8s %2s %8.3fs  %s" % (order, threads, best, last))
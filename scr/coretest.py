@@ -0,0 +1,133 @@
+#!/usr/bin/env python
+
+# save core images with rudel, load them back and check damaged ones are
+# refused: rudel exits 1 and tells why. prints each check and the number of
+# failed ones, and exits 1 if there is any.
+
+from __future__ import print_function
+import os, sys, struct, shutil, tempfile, argparse
+from subprocess import Popen, PIPE
+
+parser = argparse.ArgumentParser(
+        description="Run core image tests against rudel")
+parser.add_argument('rudel_cmd', help="rudel executable")
+args = parser.parse_args()
+
+rudel  = os.path.abspath(args.rudel_cmd)
+tmp    = tempfile.mkdtemp(prefix='rudel-core-')
+failed = 0
+
+def run(opts, stdin=''):
+    p = Popen([rudel] + opts, stdin=PIPE, stdout=PIPE, stderr=PIPE, cwd=os.path.dirname(rudel))
+    out, err = p.communicate(stdin.encode('utf-8'))
+    return p.returncode, out.decode('utf-8', 'replace'), err.decode('utf-8', 'replace')
+
+def check(name, ok, detail=''):
+    global failed
+    print("%-40s %s" % (name, "ok" if ok else "FAIL " + detail.strip()))
+    if not ok:
+        failed += 1
+
+def path(name):
+    return os.path.join(tmp, name)
+
+# forms are formatted with path of core image to save.
+def save(name, forms, opts=[]):
+    with open(path(name + '.rud'), 'w') as f:
+        f.write(forms % path(name + '.rudc'))
+    r, out, err = run(opts + [path(name + '.rud')])
+    check("save " + name, r == 0 and os.path.exists(path(name + '.rudc')), err)
+
+# results of forms in stdin, printed after REPL prompts, are expect.
+def load(name, stdin, expect, opts=[]):
+    r, out, err = run(opts + ['--core', path(name)], stdin)
+    res = [l[len('user> '):] for l in out.splitlines() if l.startswith('user> ')]
+    check("load " + name, r == 0 and res[:len(expect)] == expect, out + err)
+
+# image saved with entry clojure runs it with argv, and it prints expect.
+def entry(name, argv, expect):
+    r, out, err = run(['--core', path(name)] + argv)
+    check("entry " + name, r == 0 and out.splitlines() == expect, out + err)
+
+def refuse(name, expect):
+    r, out, err = run(['--core', path(name)])
+    check("refuse " + name, r == 1 and expect in err, "%d %s" % (r, err))
+
+def patch(src, dst, off, data):
+    with open(path(src), 'rb') as f:
+        img = bytearray(f.read())
+    img[off:off + len(data)] = data
+    with open(path(dst), 'wb') as f:
+        f.write(img)
+    return img
+
+# checksum of core_header_t: Fletcher style sum of 64-bit words before it.
+HEADER_SUM = 192
+
+def header_sum(img):
+    a, b = 1, 0
+    for i in range(0, HEADER_SUM, 8):
+        a = (a + struct.unpack_from('<Q', img, i)[0]) & 0xffffffffffffffff
+        b = (b + a) & 0xffffffffffffffff
+    return a ^ ((b << 32 | b >> 32) & 0xffffffffffffffff)
+
+def patch_header(src, dst, off, data):
+    img = patch(src, dst, off, data)
+    struct.pack_into('<Q', img, HEADER_SUM, header_sum(img))
+    with open(path(dst), 'wb') as f:
+        f.write(img)
+
+try:
+    save('core', '(defun twice (x) (* 2 x))\n(save-core "%s" nil)\n')
+    load('core.rudc', '(twice 21)\n', ['42'])
+
+    # damaged images
+    size = os.path.getsize(path('core.rudc'))
+    refuse('missing.rudc',                          'cannot open file.')
+    patch('core.rudc', 'magic.rudc', 0, b'X')
+    refuse('magic.rudc',                            'not a core image.')
+    patch('core.rudc', 'header.rudc', 16, b'\xff')
+    refuse('header.rudc',                           'core image header is damaged.')
+    patch_header('core.rudc', 'version.rudc', 8, struct.pack('<I', 0xffff))
+    refuse('version.rudc',                          'core image is of other version.')
+    patch_header('core.rudc', 'build.rudc', 12, struct.pack('<I', 3))
+    refuse('build.rudc',                            'core image is of other build.')
+    with open(path('core.rudc'), 'rb') as f:
+        img = f.read()
+    with open(path('truncated.rudc'), 'wb') as f:
+        f.write(img[:size // 2])
+    refuse('truncated.rudc',                        'core image is truncated.')
+    patch('core.rudc', 'damaged.rudc', size - 1, bytearray([img[size - 1] ^ 1]))
+    refuse('damaged.rudc',                          'core image is damaged.')
+
+    # precompile flag may be omitted
+    save('short', '(defun twice (x) (* 2 x))\n(save-core "%s")\n')
+    load('short.rudc', '(twice 21)\n', ['42'])
+
+    # packed image is smaller, and it is decoded on load
+    save('packed', '(defun twice (x) (* 2 x))\n(save-core "%s" nil)\n', ['--pack-core'])
+    check("packed is smaller", os.path.getsize(path('packed.rudc')) < size)
+    load('packed.rudc', '(twice 21)\n', ['42'])
+
+    # precompiled image has every clojure compiled, also ones made by
+    # code, and code compiled before a global it uses is defined runs.
+    save('pre', '(defun late () (later 1))\n(try (late) (\\ (x) nil))\n'
+                '(defun later (x) (+ x 1))\n(defun adder (n) (lambda (x) (+ x n)))\n'
+                '(save-core "%s" t)\n')
+    load('pre.rudc', '(compiledp late)\n(compiledp later)\n(compiledp (adder 1))\n(late)\n((adder 2) 3)\n',
+         ['t', 't', 't', '2', '5'])
+
+    # tree shaken image has only what entry clojure reaches, and it is run
+    # with arguments in *ARGV* instead of REPL.
+    save('shaken', '(setq greeting "hello")\n(defun unused () 1)\n'
+                   '(defun main () (progn (print greeting) (print *ARGV*) (print (mapcar (lambda (x) (* x x)) (list 1 2 3))) '
+                   '(print (try (eval (read-string "(unused)")) (\\ (x) (quote shaken))))))\n'
+                   '(save-core "%s" main)\n')
+    check("shaken is smaller", os.path.getsize(path('shaken.rudc')) < size)
+    entry('shaken.rudc', ['abc', '12'], ['"hello"', '(abc 12)', '(1 4 9)', 'shaken'])
+    entry('shaken.rudc', [],            ['"hello"', 'nil',      '(1 4 9)', 'shaken'])
+finally:
+    shutil.rmtree(tmp)
+
+print("%d: failed checks" % failed)
+sys.exit(1 if failed else 0)
@@ -0,0 +1,75 @@
+#!/usr/bin/env python
+
+# run rudel with allocation profiler on small programs and check the report:
+# each allocation site is listed with its source form, and counts of
+# allocations, which are scaled by sampling rate, are exact when every
+# allocation is sampled. prints each check and the number of failed ones, and
+# exits 1 if there is any.
+
+from __future__ import print_function
+import os, re, sys, shutil, tempfile, argparse
+from subprocess import Popen, PIPE
+
+parser = argparse.ArgumentParser(
+        description="Run allocation profiler tests against rudel")
+parser.add_argument('rudel_cmd', help="rudel executable")
+args = parser.parse_args()
+
+rudel  = os.path.abspath(args.rudel_cmd)
+tmp    = tempfile.mkdtemp(prefix='rudel-prof-')
+failed = 0
+
+def check(name, ok, detail=''):
+    global failed
+    print("%-40s %s" % (name, "ok" if ok else "FAIL " + detail.strip()))
+    if not ok:
+        failed += 1
+
+def path(name):
+    return os.path.join(tmp, name)
+
+# run forms with profiler, and return header of report and its sites:
+# (bytes, allocs, pc, site form) keyed by site form.
+def profile(name, forms, sample):
+    with open(path(name + '.rud'), 'w') as f:
+        f.write(forms)
+    p = Popen([rudel, '--alloc-profile=' + path(name + '.prof'), '--alloc-sample=%d' % sample, path(name + '.rud')],
+              stdin=PIPE, stdout=PIPE, stderr=PIPE, cwd=os.path.dirname(rudel))
+    out, err = p.communicate()
+    check("run " + name, p.returncode == 0 and os.path.exists(path(name + '.prof')), err.decode('utf-8', 'replace'))
+    if not os.path.exists(path(name + '.prof')):
+        return '', {}
+    with open(path(name + '.prof')) as f:
+        lines = f.read().splitlines()
+    sites = {}
+    for l in lines[2:]:
+        m = re.match(r'\s*(\d+)\s+[\d.]+%\s+(\d+)\s+(-?\d+)\s+(.*) / ', l)
+        if m:
+            sites.setdefault(m.group(4), []).append((int(m.group(1)), int(m.group(2)), int(m.group(3))))
+    return lines[0] if lines else '', sites
+
+def site(name, sites, form, allocs, detail):
+    s = sites.get(form, [])
+    check(name, len(s) == 1 and s[0][1] == allocs and s[0][0] > 0 and s[0][0] % allocs == 0, "%s %s" % (s, detail))
+
+try:
+    # conses and vectors made at their own sites: vector is its header and data
+    forms = ('(setq mk (lambda (n acc) (if (eq n 0) acc (mk (- n 1) (cons n acc)))))\n'
+             '(setq mv (lambda (n acc) (if (eq n 0) acc (mv (- n 1) (make-vector 3)))))\n'
+             '(count (mk 1000 nil))\n'
+             '(mv 300 nil)\n')
+    head, sites = profile('every', forms, 1)
+    check("header every", head.startswith('Allocation profile: 1 in 1 allocations'), head)
+    site("site of cons",   sites, '(cons n acc)',     1000, head)
+    site("site of vector", sites, '(make-vector 3)',  600,  head)
+
+    # one in 10 allocations is sampled
+    head, sites = profile('sampled', forms, 10)
+    check("header sampled", head.startswith('Allocation profile: 1 in 10 allocations'), head)
+    s = sites.get('(cons n acc)', [])
+    check("sampled site of cons", len(s) == 1 and 500 <= s[0][1] <= 1500 and s[0][1] % 10 == 0, str(s))
+finally:
+    shutil.rmtree(tmp)
+
+print("%d: failed checks" % failed)
+sys.exit(1 if failed else 0)
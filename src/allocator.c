@@ -1,276 +1,2626 @@
+#define _GNU_SOURCE		// mremap
 #include <assert.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <link.h>
+#ifdef CONSGC
+#include <sys/resource.h>
+#endif // CONSGC
 #include "builtin.h"
 #include "allocator.h"
+#include "gc.h"
+#include "profile.h"
 
 
 /////////////////////////////////////////////////////////////////////
 // private: GC root
 
 
+#ifdef THREADS
+static __thread mutator_t*	s_self		= 0;	// mutator of running thread
+mutator_t*			g_mutators	= 0;	// attached threads
+static pthread_mutex_t		s_world_lock	= PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t		s_world_parked	= PTHREAD_COND_INITIALIZER;
+static pthread_cond_t		s_world_resumed	= PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t		s_los_lock	= PTHREAD_MUTEX_INITIALIZER;
+static int			s_running	= 0;	// attached threads not parked
+static int			s_attached	= 0;
+#else  // THREADS
+static mutator_t		s_main		= { 0 };
+static mutator_t* const		s_self		= &s_main;
+mutator_t* const		g_mutators	= &s_main;
+#endif // THREADS
+
+/////////////////////////////////////////////////////////////////////
+// private: heap size (in words)
+
+size_t		g_pool_size		= 0;	// current to-space
+size_t		g_heap_size		= 0;	// next to-space
+static size_t	s_heap_init_size	= 0;
+size_t		g_heap_max_size		= 0;
+#ifndef NOGC
+size_t		g_from_size		= 0;
+#endif  // NOGC
+#ifdef HAVE_COMPACT
+bool		g_compact		= false;	// mark-compact instead of copying
+#endif // HAVE_COMPACT
+gc_order_t	g_gc_order		= GC_ORDER_BREADTH;
+#ifdef PARGC
+size_t		g_par_bound		= 0;	// words which may survive running GC
+#endif // PARGC
+
+#ifdef GENGC
+/////////////////////////////////////////////////////////////////////
+// private: remembered set (slots in old generation pointing to nursery)
+
+static value_t**	s_remset		= 0;
+static int		s_remset_ptr		= 0;
+static int		s_remset_size		= 0;
+bool			g_gc_minor		= false;
+#ifdef DEBUG_GC
+static int		s_gc_minor_cnt		= 0;
+#endif // DEBUG_GC
+#endif // GENGC
+
+#ifdef HAVE_IMMORTAL
+/////////////////////////////////////////////////////////////////////
+// private: immortal region
+//
+// freeze_heap moves live objects into one block which GC neither moves nor
+// scans. its slots pointing out of the block are remembered by write_barrier
+// and are roots of every GC, including data fields of frozen vectors grown
+// after freezing.
+
+value_t**		g_imm_rem		= 0;	// slots in immortal region which may refer out of it
+size_t			g_imm_rem_cnt		= 0;
+static size_t		s_imm_rem_size		= 0;
+static uint8_t*		s_imm_rem_bits		= 0;	// one bit per word, set when slot is remembered
+bool			g_thaw			= false;	// immortal objects are collected like from-space
+#ifdef THREADS
+static pthread_mutex_t	s_imm_lock		= PTHREAD_MUTEX_INITIALIZER;
+#endif // THREADS
+#endif // HAVE_IMMORTAL
+
+#ifndef NOGC
+/////////////////////////////////////////////////////////////////////
+// private: weak references
+//
+// full collections do not trace weak slots of vector data (VT_WEAK and keys
+// of VT_WEAK_KEY). such a slot is set to nil and registered here when its
+// vector is copied or marked, and its referent is put back after the scan if
+// something else reached it. value of a weak-key entry is traced only after
+// its key is reached (ephemeron). minor GC, incremental cycles and core image
+// writer trace weak slots as usual.
+
+weak_t*		g_weak			= 0;
+size_t		g_weak_cnt		= 0;
+static size_t	s_weak_size		= 0;
+bool		g_weak_on		= false;	// running collection clears weak slots
+#endif // NOGC
+
+/////////////////////////////////////////////////////////////////////
+// private: GC pause time
+
+static long	s_pause_hist[PAUSE_HIST_SIZE]	= { 0 };	// bucket i counts pauses < 2^i usec
+static long	s_pause_cnt			= 0;
+static long	s_pause_max			= 0;
+static long	s_pause_last			= 0;
+static long	s_pause_total			= 0;
+
+/////////////////////////////////////////////////////////////////////
+// private: statistics (in words)
+
+long		g_stat_gc_cnt		= 0;
+static long	s_stat_minor_cnt	= 0;
+static size_t	s_stat_cons_cnt		= 0;	// of detached threads
+static size_t	s_stat_vector_cnt	= 0;
+static size_t	s_stat_data		= 0;
+size_t		g_stat_copied		= 0;
+size_t		g_stat_survivor		= 0;
+static size_t	s_stat_peak		= 0;
+long		g_stat_weak_cleared	= 0;
+
+/////////////////////////////////////////////////////////////////////
+// private: semispace memory
+//
+// semispaces are mapped, not allocated by malloc: they are unmapped when the
+// heap is resized, and pages emptied by collection can be given back. such
+// pages are zero filled when touched again.
+
+static bool		s_huge_pages		= false;	// ask for transparent huge pages
+#ifndef NOGC
+static struct timespec	s_discard_last		= { 0 };	// end of last collection
+#endif  // NOGC
+
+#ifdef COMPRESSED_REFS
+// heap arena: address space reserved at start up, aligned to its size. every
+// mapping of heap memory is carved from it, so a heap address fits in 32 bits.
+// free ranges are kept sorted by address and taken first fit. pages of free
+// ranges are not accessible.
+
 typedef struct
 {
-	value_t*	data;
-	int*		size;
-} root_t;
+	size_t	start;		// offset from g_heap_base
+	size_t	size;		// bytes
+} arena_range_t;
+
+static arena_range_t*	s_arena_free		= 0;
+static size_t		s_arena_cnt		= 0;
+static size_t		s_arena_size		= 0;
+#ifdef THREADS
+static pthread_mutex_t	s_arena_lock		= PTHREAD_MUTEX_INITIALIZER;
+#endif // THREADS
+
+static void init_arena(void)
+{
+	char* p = (char*)mmap(0, ARENA_SIZE * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if(p == MAP_FAILED)
+	{
+		abort();
+	}
+
+	char* q = (char*)(((uintptr_t)p + ARENA_SIZE - 1) & ~(uintptr_t)(ARENA_SIZE - 1));
+	if(q > p)
+	{
+		munmap(p, q - p);
+	}
+	munmap(q + ARENA_SIZE, p + ARENA_SIZE - q);
+	g_heap_base = q;
+
+	// first page is never given: reference 0 is null
+	s_arena_size    = ARENA_RANGE_SIZE;
+	s_arena_free    = (arena_range_t*)malloc(sizeof(arena_range_t) * s_arena_size);
+	if(!s_arena_free)
+	{
+		abort();
+	}
+	s_arena_free[0] = (arena_range_t){ 4096, ARENA_SIZE - 4096 };
+	s_arena_cnt     = 1;
+}
+
+static bool arena_insert(size_t i, arena_range_t r)
+{
+	if(s_arena_cnt >= s_arena_size)
+	{
+		size_t         size = s_arena_size * 2;
+		arena_range_t* p    = (arena_range_t*)realloc(s_arena_free, sizeof(arena_range_t) * size);
+		if(!p)
+		{
+			return false;
+		}
+		s_arena_free = p;
+		s_arena_size = size;
+	}
+	memmove(s_arena_free + i + 1, s_arena_free + i, sizeof(arena_range_t) * (s_arena_cnt - i));
+	s_arena_free[i] = r;
+	s_arena_cnt++;
+	return true;
+}
+
+// take bytes at start out of free range i, which holds them. returns start, or 0 if it fails.
+static size_t arena_cut(size_t i, size_t start, size_t bytes)
+{
+	arena_range_t* r   = s_arena_free + i;
+	size_t         end = r->start + r->size;
+	if(start > r->start && start + bytes < end)
+	{
+		// split range: head is kept, tail is inserted
+		if(!arena_insert(i + 1, (arena_range_t){ start + bytes, end - start - bytes }))
+		{
+			return 0;
+		}
+		r = s_arena_free + i;
+	}
+	else if(start + bytes < end)
+	{
+		s_arena_free[i] = (arena_range_t){ start + bytes, end - start - bytes };
+		return start;
+	}
+	else if(start == r->start)
+	{
+		memmove(r, r + 1, sizeof(arena_range_t) * (s_arena_cnt - i - 1));
+		s_arena_cnt--;
+		return start;
+	}
+	r->size = start - r->start;
+	return start;
+}
+
+// reserve bytes aligned to align (power of 2, or 0). returns offset, or 0 if none is free.
+static size_t arena_take(size_t bytes, size_t align)
+{
+	for(size_t i = 0; i < s_arena_cnt; i++)
+	{
+		arena_range_t* r     = s_arena_free + i;
+		size_t         start = align ? (r->start + align - 1) & ~(align - 1) : r->start;
+		if(start + bytes <= r->start + r->size)
+		{
+			return arena_cut(i, start, bytes);
+		}
+	}
+	return 0;
+}
+
+// reserve bytes at offset start. returns start, or 0 if they are not free.
+static size_t arena_take_at(size_t start, size_t bytes)
+{
+	for(size_t i = 0; i < s_arena_cnt && s_arena_free[i].start <= start; i++)
+	{
+		if(start + bytes <= s_arena_free[i].start + s_arena_free[i].size)
+		{
+			return arena_cut(i, start, bytes);
+		}
+	}
+	return 0;
+}
+
+// make pages inaccessible and return them to free ranges, merged with neighbours.
+static void arena_give(size_t start, size_t bytes)
+{
+	mmap(g_heap_base + start, bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+
+	size_t i = 0;
+	while(i < s_arena_cnt && s_arena_free[i].start < start)
+	{
+		i++;
+	}
+
+	bool prev = i > 0 && s_arena_free[i - 1].start + s_arena_free[i - 1].size == start;
+	bool next = i < s_arena_cnt && start + bytes == s_arena_free[i].start;
+	if(prev && next)
+	{
+		s_arena_free[i - 1].size += bytes + s_arena_free[i].size;
+		memmove(s_arena_free + i, s_arena_free + i + 1, sizeof(arena_range_t) * (s_arena_cnt - i - 1));
+		s_arena_cnt--;
+	}
+	else if(prev)
+	{
+		s_arena_free[i - 1].size += bytes;
+	}
+	else if(next)
+	{
+		s_arena_free[i].start  = start;
+		s_arena_free[i].size  += bytes;
+	}
+	else
+	{
+		arena_insert(i, (arena_range_t){ start, bytes });	// pages are lost if it fails
+	}
+}
+#endif // COMPRESSED_REFS
+
+// bytes of zero filled memory aligned to align (power of 2, or 0). returns 0 if it fails.
+static void* map_pages(size_t bytes, size_t align)
+{
+#ifdef COMPRESSED_REFS
+#ifdef THREADS
+	pthread_mutex_lock(&s_arena_lock);
+#endif // THREADS
+	size_t start = arena_take(bytes, align);
+	char*  p     = start ? g_heap_base + start : 0;
+	if(p && mmap(p, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED)
+	{
+		arena_give(start, bytes);
+		p = 0;
+	}
+#ifdef THREADS
+	pthread_mutex_unlock(&s_arena_lock);
+#endif // THREADS
+	return p;
+#else  // COMPRESSED_REFS
+	char* p = (char*)mmap(0, bytes + align, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(p == MAP_FAILED)
+	{
+		return 0;
+	}
+	if(align)
+	{
+		// trim both ends of mapping
+		char* q = (char*)(((uintptr_t)p + align - 1) & ~(uintptr_t)(align - 1));
+		if(q > p)
+		{
+			munmap(p, q - p);
+		}
+		if(p + align > q)
+		{
+			munmap(q + bytes, p + align - q);
+		}
+		p = q;
+	}
+	return p;
+#endif // COMPRESSED_REFS
+}
+
+// bytes of zero filled memory at p. returns 0 if they are in use.
+static void* map_pages_at(void* p, size_t bytes)
+{
+#ifdef COMPRESSED_REFS
+#ifdef THREADS
+	pthread_mutex_lock(&s_arena_lock);
+#endif // THREADS
+	size_t start = arena_take_at((char*)p - g_heap_base, bytes);
+	if(!start || mmap(p, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED)
+	{
+		if(start)
+		{
+			arena_give(start, bytes);
+		}
+		p = 0;
+	}
+#ifdef THREADS
+	pthread_mutex_unlock(&s_arena_lock);
+#endif // THREADS
+	return p;
+#else  // COMPRESSED_REFS
+	// address is a hint: mapping elsewhere is not used
+	void* q = mmap(p, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(q != p && q != MAP_FAILED)
+	{
+		munmap(q, bytes);
+	}
+	return q == p ? p : 0;
+#endif // COMPRESSED_REFS
+}
+
+static void unmap_pages(void* p, size_t bytes)
+{
+#ifdef COMPRESSED_REFS
+#ifdef THREADS
+	pthread_mutex_lock(&s_arena_lock);
+#endif // THREADS
+	arena_give((char*)p - g_heap_base, bytes);
+#ifdef THREADS
+	pthread_mutex_unlock(&s_arena_lock);
+#endif // THREADS
+#else  // COMPRESSED_REFS
+	munmap(p, bytes);
+#endif // COMPRESSED_REFS
+}
+
+// grow mapping of old bytes at p to bytes. contents are kept, it may move.
+static void* remap_pages(void* p, size_t old, size_t bytes)
+{
+#ifdef COMPRESSED_REFS
+	// pages are moved to new range of arena, and old range is reserved again
+#ifdef THREADS
+	pthread_mutex_lock(&s_arena_lock);
+#endif // THREADS
+	size_t start = arena_take(bytes, 0);
+	void*  q     = start ? mremap(p, old, bytes, MREMAP_MAYMOVE | MREMAP_FIXED, g_heap_base + start) : MAP_FAILED;
+	if(q == MAP_FAILED)
+	{
+		if(start)
+		{
+			arena_give(start, bytes);
+		}
+	}
+	else
+	{
+		arena_give((char*)p - g_heap_base, old);
+	}
+#ifdef THREADS
+	pthread_mutex_unlock(&s_arena_lock);
+#endif // THREADS
+	return q == MAP_FAILED ? 0 : q;
+#else  // COMPRESSED_REFS
+	void* q = mremap(p, old, bytes, MREMAP_MAYMOVE);
+	return q == MAP_FAILED ? 0 : q;
+#endif // COMPRESSED_REFS
+}
+
+inline static size_t pool_bytes(size_t words)
+{
+	size_t page = 4096;
+	return (words * sizeof(value_t) + page - 1) & ~(page - 1);
+}
+
+value_t* pool_alloc(size_t words)
+{
+	size_t bytes = pool_bytes(words);
+#ifdef MADV_HUGEPAGE
+	value_t* p   = (value_t*)map_pages(bytes, s_huge_pages ? HUGE_PAGE_SIZE : 0);
+	if(p && s_huge_pages)
+	{
+		madvise(p, bytes, MADV_HUGEPAGE);
+	}
+	return p;
+#else  // MADV_HUGEPAGE
+	return (value_t*)map_pages(bytes, 0);
+#endif // MADV_HUGEPAGE
+}
+
+void pool_free(value_t* p, size_t words)
+{
+	if(p)
+	{
+		unmap_pages(p, pool_bytes(words));
+	}
+}
+
+#ifndef NOGC
+// give back pages from p to end of pool of words. contents are lost.
+void pool_discard(value_t* pool, size_t words, value_t* p)
+{
+	uintptr_t page  = 4096;
+	uintptr_t start = ((uintptr_t)p + page - 1) & ~(page - 1);
+	uintptr_t end   = (uintptr_t)pool + pool_bytes(words);
+	if(pool && start < end)
+	{
+		madvise((void*)start, end - start, MADV_DONTNEED);
+	}
+}
+#endif  // NOGC
+
+// resident set size of process in bytes, 0 if unknown.
+static size_t resident_bytes(void)
+{
+	FILE* fp  = fopen("/proc/self/statm", "r");
+	long  rss = 0;
+	if(fp)
+	{
+		if(fscanf(fp, "%*s %ld", &rss) != 1)
+		{
+			rss = 0;
+		}
+		fclose(fp);
+	}
+	return rss * sysconf(_SC_PAGESIZE);
+}
+
+/////////////////////////////////////////////////////////////////////
+// private: large object space (vector data, not moved by GC)
+
+los_t**		g_los			= 0;
+size_t		g_los_cnt		= 0;
+static size_t	s_los_size		= 0;
+los_t*		g_los_scan		= 0;
+#ifdef INCGC
+los_t*		g_los_scan_cur		= 0;	// block partially scanned by incremental GC
+size_t		g_los_scan_pos		= 0;
+#endif // INCGC
+size_t		g_los_words		= 0;	// live words after last GC
+static size_t	s_los_alloc		= 0;	// words allocated since last GC
+bool		g_los_inline		= false;	// copy large objects into heap (save_core)
+
+inline static size_t los_bytes(size_t words)
+{
+	size_t page = 4096;
+	return (sizeof(los_t) + words * sizeof(value_t) + page - 1) & ~(page - 1);
+}
+
+void los_mark(value_t* data)
+{
+	los_t* b = los_block(data);
+	if(!b->mark)
+	{
+		b->mark    = 1;
+		b->scan    = g_los_scan;
+		g_los_scan = b;
+	}
+}
+
+// release unmarked blocks after full GC.
+void los_sweep(void)
+{
+	size_t j    = 0;
+	g_los_words = 0;
+	for(size_t i = 0; i < g_los_cnt; i++)
+	{
+		los_t* b = g_los[i];
+		if(b->mark)
+		{
+			b->mark      = 0;
+			b->index     = j;
+			g_los[j++]   = b;
+			g_los_words += los_words(b);
+		}
+		else
+		{
+			unmap_pages(b, b->bytes);
+		}
+	}
+	g_los_cnt   = j;
+	s_los_alloc = 0;
+}
+
+static value_t* los_alloc(size_t words)
+{
+	if(g_los_cnt >= s_los_size)
+	{
+		size_t  size = s_los_size ? s_los_size * 2 : LOS_INITIAL_SIZE;
+		los_t** p    = (los_t**)realloc(g_los, sizeof(los_t*) * size);
+		if(!p)
+		{
+			return 0;
+		}
+		g_los      = p;
+		s_los_size = size;
+	}
+
+	size_t bytes = los_bytes(words);
+	los_t* b     = (los_t*)map_pages(bytes, 0);
+	if(!b)
+	{
+		return 0;
+	}
+
+	b->scan            = 0;
+	b->index           = g_los_cnt;
+	b->bytes           = bytes;
+	b->mark            = 0;
+	g_los[g_los_cnt++] = b;
+#ifdef INCGC
+	if(g_incgc_active)
+	{
+		los_mark(los_data(b));	// allocate grey while a cycle is running
+	}
+#endif // INCGC
+	s_los_alloc       += los_words(b);
+	return los_data(b);
+}
+
+// grow block in place if possible. contents are kept, new area is not initialized.
+static value_t* los_realloc(value_t* data, size_t words)
+{
+	los_t* b     = los_block(data);
+	size_t bytes = los_bytes(words);
+	if(bytes <= b->bytes)
+	{
+		return data;
+	}
+
+	size_t old   = los_words(b);
+	los_t* nb    = (los_t*)remap_pages(b, b->bytes, bytes);
+	if(!nb)
+	{
+		return 0;
+	}
+	nb->bytes        = bytes;
+	g_los[nb->index] = nb;
+	s_los_alloc     += los_words(nb) - old;
+
+#ifdef INCGC
+	// scan queue is linked through block headers
+	if(nb != b)
+	{
+		for(los_t** p = &g_los_scan; *p; p = &(*p)->scan)
+		{
+			if(*p == b)
+			{
+				*p = nb;
+				break;
+			}
+		}
+		if(g_los_scan_cur == b)
+		{
+			g_los_scan_cur = nb;
+		}
+	}
+#endif // INCGC
+
+#ifdef GENGC
+	// remembered slots moved with the block
+	if(nb != b)
+	{
+		for(int i = 0; i < s_remset_ptr; i++)
+		{
+			if(s_remset[i] >= data && s_remset[i] < data + old)
+			{
+				s_remset[i] = los_data(nb) + (s_remset[i] - data);
+			}
+		}
+	}
+#endif // GENGC
+	return los_data(nb);
+}
+
+/////////////////////////////////////////////////////////////////////
+// private: support functions
+
+#ifndef NDEBUG
+
+inline static bool is_to(value_t v)
+{
+	return (VPTROF(v) >= g_memory_pool && VPTROF(v) < g_memory_max);
+}
+#endif // NDEBUG
+
+inline static bool is_sanity_addr(value_t v)
+{
+#ifdef GENGC
+	if(VPTROF(v) >= g_nursery && VPTROF(v) < g_nursery_top)
+	{
+		return true;
+	}
+#endif // GENGC
+	if(VPTROF(v) >= g_memory_pool && VPTROF(v) < g_memory_top)
+	{
+		return true;
+	}
+#ifdef INCGC
+	if(is_incgc_from(v))
+	{
+		return true;	// not scanned yet
+	}
+#endif // INCGC
+#ifdef CONSGC
+	if(pin_block_of(VPTROF(v)))
+	{
+		return true;	// pinned object
+	}
+#endif // CONSGC
+#ifdef HAVE_IMMORTAL
+	if(is_immortal(v))
+	{
+		return true;
+	}
+#endif // HAVE_IMMORTAL
+
+	for(size_t i = 0; i < g_los_cnt; i++)
+	{
+		value_t* data = los_data(g_los[i]);
+		if(VPTROF(v) >= data && VPTROF(v) < data + los_words(g_los[i]))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+inline static bool is_sanity(value_t v)
+{
+	if(rtypeof(v) < OTH_T)
+	{
+		if(!(is_sanity_addr(AVALUE(v)) || nilp(v) || AVALUE(v).raw == 0))
+		{
+			abort();
+			return false;
+		}
+	}
+	return true;
+}
+
+#ifndef NOGC
+// set weak slot to nil and register it, with value slot of weak-key entry if any.
+// slots referring out of collected objects, or not registered for lack of memory, are traced.
+void defer_weak(value_t* slot, value_t* value, bool (*is_target)(value_t))
+{
+	value_t v = *slot;
+	if(rtypeof(v) == PTR_T || rtypeof(v) >= OTH_T || AVALUE(v).raw == 0 || !is_target(AVALUE(v)))
+	{
+		return;
+	}
+
+	if(g_weak_cnt >= s_weak_size)
+	{
+		size_t  size = s_weak_size ? s_weak_size * 2 : REMSET_INITIAL_SIZE;
+		weak_t* p    = (weak_t*)realloc(g_weak, sizeof(weak_t) * size);
+		if(!p)
+		{
+			return;
+		}
+		g_weak      = p;
+		s_weak_size = size;
+	}
+
+	weak_t* w = g_weak + g_weak_cnt++;
+	w->slot   = slot;
+	w->ref    = v;
+	w->value  = value;
+	w->val    = value ? *value : NIL;
+	*slot     = NIL;
+	if(value)
+	{
+		*value = NIL;
+	}
+}
+#endif  // NOGC
+
+// copy vector data to top, or mark it in large object space. returns data field of the copy.
+inline static value_t copy_data(value_t** top, vector_t* v)
+{
+	value_t* data = VPTROF(v->data);
+	if(data && is_copied_data(data))
+	{
+		assert(ptrp(v->data));
+		value_t r = RPTR(*top);
+		for(int i = 0; i < INTOF(v->alloc); i++)
+			*(*top)++ = data[i];
+		defer_weak_data(v, VPTROF(r), is_moved);
+		return r;
+	}
+	else if(data)
+	{
+		// large object is not moved, scanned later
+#ifdef GENGC
+		if(!g_gc_minor)
+#endif // GENGC
+		los_mark(data);
+		defer_weak_data(v, data, is_moved);
+		return v->data;
+	}
+	else
+	{
+		return RPTR(0);
+	}
+}
+
+#ifndef INCGC
+// copy conses of cdr chain from slot right after the cons copied last: spine of a list
+// is contiguous in to-space, and its cars are scanned in list order.
+inline static void copy_cdrs(value_t** top, value_t* slot)
+{
+	for(value_t cur = AVALUE(*slot); rtypeof(*slot) == CONS_T && cur.raw != 0; cur = AVALUE(*slot))
+	{
+		if(!is_moved(cur) || ptrp(CONSOF(cur)->car))
+		{
+			break;		// not collected, or already copied
+		}
+#ifdef CDRCODE
+		else if(CDR_COUNT(*slot))
+		{
+			break;		// run is copied by copy1
+		}
+#endif // CDRCODE
+
+		value_t* p = *top;
+		*top      += 2;
+		p[0]       = CONSOF(cur)->car;
+		p[1]       = CONSOF(cur)->cdr;
+
+		value_t alloc   = RPTR(p);
+		CONSOF(cur)->car   = alloc;
+		alloc.type.main = CONS_T;
+		*slot           = alloc;
+		slot            = p + 1;
+	}
+}
+#endif // INCGC
+
+#ifdef CDRCODE
+// copy cells of a run from cell *v to the end of the run, or to a cell which
+// is copied or moved to an ordinary cons already. copied cells are forwarded
+// one by one, and the last copied one has the cell it stopped at as its cdr.
+static void copy_run(value_t** top, value_t* v)
+{
+	rtype_t  type = rtypeof(*v);
+	value_t* p    = VPTROF(*v);
+	size_t   k    = CDR_COUNT(*v);
+
+	size_t m = 0;
+	while(m <= k && !ptrp(p[m]) && !is_indirect(p[m]))
+	{
+		m++;
+	}
+
+	value_t next;
+	if(m > k)
+	{
+		next = p[k + 1];
+	}
+	else if(ptrp(p[m]))
+	{
+		next           = p[m];
+		next.type.main = CONS_T;
+	}
+	else
+	{
+		next      = p[m];		// ordinary cons of the cell is copied by scan
+		next.raw &= ~CDR_INDIRECT;
+	}
+
+	value_t* d = *top;
+	*top      += (m + 2) & ~1;
+	memcpy(d, p, sizeof(value_t) * m);
+	d[m] = next;
+	if(m % 2 == 0)
+	{
+		d[m + 1] = NIL;
+	}
+
+	for(size_t j = 0; j < m; j++)
+	{
+		p[j]      = RPTR(d + j);
+		p[j].raw |= (m - 1 - j) * CDR_ONE;
+	}
+
+	value_t alloc   = p[0];
+	alloc.type.main = type;
+	*v              = alloc;
+}
+#endif // CDRCODE
+
+inline void copy1(value_t** top, value_t* v)
+{
+	rtype_t type = rtypeof(*v);
+	value_t cur  = AVALUE(*v);
+	value_t alloc;
+
+	switch(type)
+	{
+		case CONS_T:
+		case ERR_T:
+		case CLOJ_T:
+		case MACRO_T:
+		case SYM_T:
+			if(cur.raw == 0) break;	// null value
+#ifdef CDRCODE
+			if(CDR_COUNT(*v) && is_indirect(CONSOF(cur)->car))
+			{
+				// refer to ordinary cons of the cell instead
+				cur             = AVALUE(CONSOF(cur)->car);
+				alloc           = cur;
+				alloc.type.main = type;
+				*v              = alloc;
+			}
+#endif // CDRCODE
+#if defined(GENGC) || defined(INCGC) || defined(CONSGC)
+			if(!is_collected(cur))	// old object in minor GC, already copied by incremental GC, or pinned
+			{
+#ifdef CONSGC
+				if(g_pin_image) pin_copy(top, v);
+#endif // CONSGC
+				break;
+			}
+#elif defined(HAVE_IMMORTAL)
+			if(!is_from(cur))	// immortal object is not moved
+			{
+				break;
+			}
+#endif // GENGC || INCGC || CONSGC
+			if(ptrp(CONSOF(cur)->car))	// target cons is already copied
+			{
+				// replace value itself to copyed to-space address
+				alloc = CONSOF(cur)->car;
+				assert(is_to(alloc));
+				alloc.type.main = type;
+#ifdef CDRCODE
+				alloc.raw |= v->raw & CDR_INDIRECT;
+#endif // CDRCODE
+				*v = alloc;
+			}
+#ifdef CDRCODE
+			else if(CDR_COUNT(*v))
+			{
+				copy_run(top, v);
+			}
+#endif // CDRCODE
+			else
+			{
+#ifndef GENGC
+				assert(is_from(cur));
+#endif // GENGC
+				// allocate memory and copy car/cdr of current cons in from-space to to-space
+				alloc      = RPTR(*top);
+				*(*top)++ = CONSOF(cur)->car;
+				*(*top)++ = CONSOF(cur)->cdr;
+
+				// write to-space address to car of current cons in from-space
+				alloc.type.main = PTR_T;
+				CONSOF(cur)->car   = alloc;
+
+				// replace value itself to copyed to-space address
+				alloc.type.main = type;
+#ifdef CDRCODE
+				alloc.raw |= v->raw & CDR_INDIRECT;
+#endif // CDRCODE
+				*v = alloc;
+#ifndef INCGC
+				if(g_gc_order != GC_ORDER_BREADTH)
+				{
+					copy_cdrs(top, VPTROF(alloc) + 1);
+				}
+#endif // INCGC
+			}
+			break;
+
+		case VEC_T:
+#if defined(GENGC) || defined(INCGC) || defined(CONSGC)
+			if(!is_collected(cur))	// old object in minor GC, already copied by incremental GC, or pinned
+			{
+#ifdef CONSGC
+				if(g_pin_image) pin_copy(top, v);
+#endif // CONSGC
+				break;
+			}
+#elif defined(HAVE_IMMORTAL)
+			if(!is_from(cur))	// immortal object is not moved
+			{
+				break;
+			}
+#endif // GENGC || INCGC || CONSGC
+			if(ptrp(VECOF(cur)->type))	// target vector is already copied
+			{
+				// replace value itself to copyed to-space address
+				alloc = VECOF(cur)->type;
+				assert(is_to(alloc));
+				alloc.type.main = type;
+				*v = alloc;
+			}
+			else
+			{
+#ifndef GENGC
+				assert(is_from(cur));
+#endif // GENGC
+				assert(intp(VECOF(cur)->size));
+				assert(intp(VECOF(cur)->alloc));
+				assert(!ptrp(VECOF(cur)->type));
+				// allocate memory and copy vector in from-space to to-space
+				alloc           = RPTR(*top);
+				*top               += 4;
+				VECOF(alloc)->size  = VECOF(cur)->size;
+				VECOF(alloc)->alloc = VECOF(cur)->alloc;
+				VECOF(alloc)->type  = VECOF(cur)->type;
+				VECOF(alloc)->data  = copy_data(top, VECOF(cur));
+
+				// write to-space address to car of current cons in from-space
+				alloc.type.main     = PTR_T;
+				VECOF(cur)->type    = alloc;
+
+				// replace value itself to copyed to-space address
+				alloc.type.main = type;
+				*v = alloc;
+			}
+			break;
+
+		default:
+			break;
+	}
+
+	return ;
+}
+
+long elapsed_usec(struct timespec* t0)
+{
+	struct timespec t1;
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return (t1.tv_sec - t0->tv_sec) * 1000000 + (t1.tv_nsec - t0->tv_nsec) / 1000;
+}
+
+void record_pause(struct timespec* t0)
+{
+	long usec = elapsed_usec(t0);
+	int  i    = 0;
+	while(i < PAUSE_HIST_SIZE - 1 && (1L << i) <= usec)
+	{
+		i++;
+	}
+	s_pause_hist[i]++;
+	s_pause_cnt++;
+	s_pause_last   = usec;
+	s_pause_total += usec;
+	if(usec > s_pause_max)
+	{
+		s_pause_max = usec;
+	}
+}
+
+#ifndef NOGC
+static void swap_buffer(void)
+{
+	value_t* tmp       = g_memory_pool;
+	size_t   size      = g_pool_size;
+#ifdef CONSGC
+	g_from_top         = g_memory_top;
+#endif // CONSGC
+	g_memory_pool      = g_memory_top = g_memory_pool_from;
+	g_pool_size        = g_from_size;
+	g_memory_max       = g_memory_top + g_pool_size;
+	g_memory_gc        = g_memory_top + gc_limit(g_pool_size);
+	g_memory_pool_from = tmp;
+	g_from_size        = size;
+}
+
+// (re)allocate from-space to hold size words.
+// old from-space is released first to keep peak footprint low.
+static bool alloc_from_space(size_t size)
+{
+	if(size != g_from_size)
+	{
+		pool_free(g_memory_pool_from, g_from_size);
+		g_memory_pool_from = pool_alloc(size);
+		g_from_size        = g_memory_pool_from ? size : 0;
+	}
+	return g_memory_pool_from != 0;
+}
+
+// words which may survive a GC at worst.
+size_t heap_used(void)
+{
+	size_t used = g_memory_top - g_memory_pool;
+#ifdef GENGC
+	used += g_nursery_top - g_nursery;
+#endif // GENGC
+	if(g_los_inline)
+	{
+		used += g_los_words + s_los_alloc;
+	}
+#ifdef HAVE_IMMORTAL
+	if(g_thaw)
+	{
+		used += g_immortal_max - g_immortal;
+	}
+#endif // HAVE_IMMORTAL
+	return used;
+}
+
+// words occupied by objects, including large objects and from-space of running cycle.
+static size_t heap_in_use(void)
+{
+	size_t used = g_memory_top - g_memory_pool + g_los_words + s_los_alloc;
+#ifdef GENGC
+	used += g_nursery_top - g_nursery;
+#endif // GENGC
+#ifdef INCGC
+	used += g_incgc_from_max - g_incgc_from;
+#endif // INCGC
+#ifdef CONSGC
+	used += g_pin_resident;
+#endif // CONSGC
+	return used;
+}
+
+void sample_peak(void)
+{
+	size_t used = heap_in_use();
+	if(used > s_stat_peak)
+	{
+		s_stat_peak = used;
+	}
+}
+
+// semispace size for live words: grow when live data exceeds 1/HEAP_GROW_RATIO
+// of semispace, shrink when it falls below 1/HEAP_SHRINK_RATIO.
+size_t heap_size_for(size_t live)
+{
+	size_t grow   = HEAP_GROW_RATIO;
+	size_t shrink = HEAP_SHRINK_RATIO;
+#ifdef HAVE_COMPACT
+	if(g_compact)
+	{
+		// collected when full, not half full: same free space at half size
+		grow   /= 2;
+		shrink /= 2;
+	}
+#endif // HAVE_COMPACT
+
+	size_t size = g_pool_size;
+	while(size < g_heap_max_size && live * grow > size)
+	{
+		size *= 2;
+	}
+	while(size / 2 >= s_heap_init_size && live * shrink < size)
+	{
+		size /= 2;
+	}
+	return size > g_heap_max_size ? g_heap_max_size : size;
+}
+
+// pages emptied by collection are given back if frequent collections do not
+// touch them again soon, which costs a page fault each: with huge pages, when
+// collections are DISCARD_INTERVAL apart, or when forced.
+bool is_discard_time(bool force)
+{
+	bool apart = elapsed_usec(&s_discard_last) >= DISCARD_INTERVAL;
+	clock_gettime(CLOCK_MONOTONIC, &s_discard_last);
+	return force || apart || s_huge_pages;
+}
+
+void discard_from_space(bool force)
+{
+	if(is_discard_time(force))
+	{
+		pool_discard(g_memory_pool_from, g_from_size, g_memory_pool_from);
+	}
+}
+
+// prepare from-space large enough to receive everything in use, then swap.
+bool flip(void)
+{
+	size_t used = heap_used();
+	while(g_heap_size < used)
+	{
+		g_heap_size *= 2;
+	}
+#ifdef PARGC
+	g_par_bound = used;
+#endif // PARGC
+
+	if(!alloc_from_space(g_heap_size))
+	{
+		// retry with current size
+		g_heap_size = g_pool_size;
+		if(g_heap_size < used || !alloc_from_space(g_heap_size))
+		{
+			return false;
+		}
+	}
+
+	swap_buffer();
+	return true;
+}
+#endif  // NOGC
+
+#if defined(HAVE_COMPACT) || defined(HAVE_IMMORTAL)
+void visit_roots(void (*fn)(value_t*))
+{
+	fn(&g_package_list);
+	for(mutator_t* m = g_mutators; m; m = m->next)
+	{
+		for(int i = 0; i < m->root_ptr; i++)
+		{
+			if(m->root[i].size)
+			{
+				for(int j = 0; j <= *m->root[i].size; j++)
+				{
+					fn(m->root[i].data + j);
+				}
+			}
+			else
+			{
+				fn(m->root[i].data);
+			}
+		}
+	}
+}
+#endif // HAVE_COMPACT || HAVE_IMMORTAL
+
+#ifdef HAVE_IMMORTAL
+// forget slots which no longer refer out of immortal region.
+void prune_immortal_roots(void)
+{
+	size_t j = 0;
+	for(size_t i = 0; i < g_imm_rem_cnt; i++)
+	{
+		value_t* slot = g_imm_rem[i];
+		if(is_immortal_root(*slot))
+		{
+			g_imm_rem[j++] = slot;
+		}
+		else
+		{
+			size_t k = slot - g_immortal;
+			s_imm_rem_bits[k / 8] &= ~(1 << (k % 8));
+		}
+	}
+	g_imm_rem_cnt = j;
+}
+
+// remembered slots are roots. data of a frozen vector is not moved with its header: copy it here.
+static void copy_immortal_roots(void)
+{
+	if(g_thaw)
+	{
+		return;		// immortal objects are copied as usual
+	}
+
+	for(size_t i = 0; i < g_imm_rem_cnt; i++)
+	{
+		value_t* slot = g_imm_rem[i];
+		if(!is_immortal_root(*slot))
+		{
+			continue;
+		}
+		else if(ptrp(*slot))
+		{
+			*slot = copy_data(&g_memory_top, immortal_header(slot));
+		}
+		else
+		{
+			copy1(&g_memory_top, slot);
+		}
+	}
+	prune_immortal_roots();
+}
+#endif // HAVE_IMMORTAL
+
+// copy roots of all threads to memory pool
+static void copy_thread_roots(void)
+{
+	for(mutator_t* m = g_mutators; m; m = m->next)
+	{
+		for(int i = 0; i < m->root_ptr; i++)
+		{
+			if(m->root[i].size)
+			{
+				for(int j = 0; j <= *m->root[i].size; j++)
+				{
+					copy1(&g_memory_top, m->root[i].data + j);
+				}
+			}
+			else
+			{
+				copy1(&g_memory_top, m->root[i].data);
+			}
+		}
+	}
+}
+
+void copy_root(void)
+{
+	// copy g_package_list to memory pool
+	copy1(&g_memory_top, &g_package_list);
+
+	// copy root to memory pool
+	copy_thread_roots();
+#ifdef HAVE_IMMORTAL
+	copy_immortal_roots();
+#endif // HAVE_IMMORTAL
+}
+
+// Cheney scan from scanned to top, and marked large objects.
+// in depth order, block being filled is scanned first: objects are copied near their parents.
+// its words are scanned again later, which does nothing.
+static void scan_heap(value_t* scanned)
+{
+	value_t* partial = scanned;	// scan pointer in last block
+	do
+	{
+		while(scanned != g_memory_top)
+		{
+			if(g_gc_order == GC_ORDER_DEPTH)
+			{
+				value_t* block = g_memory_pool + ((g_memory_top - 1 - g_memory_pool) & ~(SCAN_BLOCK_SIZE - 1));
+				partial        = partial < block ? block : partial;
+				if(partial > scanned && partial != g_memory_top)
+				{
+					copy1(&g_memory_top, partial++);
+					continue;
+				}
+			}
+			copy1(&g_memory_top, scanned++);
+		}
+
+		while(g_los_scan)
+		{
+			los_t*   b    = g_los_scan;
+			value_t* data = los_data(b);
+			g_los_scan    = b->scan;
+			for(size_t i = 0; i < los_words(b); i++)
+			{
+				copy1(&g_memory_top, data + i);
+			}
+		}
+	} while(scanned != g_memory_top);
+}
+
+// referent of registered weak slot is copied by running collection.
+static bool is_forwarded(value_t v)
+{
+	value_t p = AVALUE(v);
+#ifdef CDRCODE
+	return ptrp(rtypeof(v) == VEC_T ? VECOF(p)->type : cell_of(v)->car);
+#else  // CDRCODE
+	return ptrp(rtypeof(v) == VEC_T ? VECOF(p)->type : CONSOF(p)->car);
+#endif // CDRCODE
+}
+
+// trace values of weak-key entries whose keys are copied, until no more key is.
+// then put copied referents back into their weak slots: the rest are left nil.
+static void scan_weak(void)
+{
+	for(bool more = true; more; )
+	{
+		size_t   cnt     = g_weak_cnt;
+		value_t* scanned = g_memory_top;
+		more             = false;
+		for(size_t i = 0; i < cnt; i++)
+		{
+			value_t* value = g_weak[i].value;
+			if(value && is_forwarded(g_weak[i].ref))
+			{
+				*value          = g_weak[i].val;
+				g_weak[i].value = 0;
+				copy1(&g_memory_top, value);	// may register more weak slots
+				more            = true;
+			}
+		}
+		scan_heap(scanned);
+		more = more || g_weak_cnt != cnt;
+	}
+
+	for(size_t i = 0; i < g_weak_cnt; i++)
+	{
+		if(is_forwarded(g_weak[i].ref))
+		{
+			*g_weak[i].slot = g_weak[i].ref;
+			copy1(&g_memory_top, g_weak[i].slot);	// replaced by address of the copy
+		}
+		else
+		{
+			g_stat_weak_cleared++;
+		}
+	}
+	g_weak_cnt = 0;
+}
+
+#ifdef THREADS
+/////////////////////////////////////////////////////////////////////
+// private: stop the world
+
+// called with s_world_lock held.
+static void park_locked(void)
+{
+	s_running--;
+	pthread_cond_signal(&s_world_parked);
+	while(g_safepoint)
+	{
+		pthread_cond_wait(&s_world_resumed, &s_world_lock);
+	}
+	s_running++;
+}
+
+// wait until all other threads are parked at safepoints.
+// returns false without stopping if other thread has collected meanwhile.
+static bool stop_world(void)
+{
+	pthread_mutex_lock(&s_world_lock);
+	if(g_safepoint)
+	{
+		park_locked();
+		pthread_mutex_unlock(&s_world_lock);
+		return false;
+	}
+
+	__atomic_store_n(&g_safepoint, 1, __ATOMIC_RELEASE);
+	while(s_running > 1)
+	{
+		pthread_cond_wait(&s_world_parked, &s_world_lock);
+	}
+
+	// every buffer is in from-space after GC
+	for(mutator_t* m = g_mutators; m; m = m->next)
+	{
+		*m->tlab_top = *m->tlab_max = 0;
+	}
+	return true;
+}
+
+static void resume_world(void)
+{
+	__atomic_store_n(&g_safepoint, 0, __ATOMIC_RELEASE);
+	pthread_cond_broadcast(&s_world_resumed);
+	pthread_mutex_unlock(&s_world_lock);
+}
+#endif // THREADS
+
+#if !defined(INCGC) || defined(HAVE_IMMORTAL)
+static void exec_gc_root(void)
+{
+	g_weak_on = true;
+#ifdef CONSGC
+	pin_roots();
+	scan_pinned();
+#endif // CONSGC
+#ifdef PARGC
+	if(!par_collect())
+#endif // PARGC
+	{
+		copy_root();
+
+		// scan and copy rest
+		scan_heap(g_memory_pool);
+	}
+	scan_weak();
+	g_weak_on = false;
+	los_sweep();
+#ifdef CONSGC
+	release_blocks();
+#endif // CONSGC
+	discard_from_space(false);
+
+	g_stat_gc_cnt++;
+	g_stat_copied   += g_memory_top - g_memory_pool;
+	g_stat_survivor  = g_memory_top - g_memory_pool + g_los_words;
+
+#ifdef TRACE_GC
+	fprintf(stderr, " Replacing symbols...\n");
+#endif
+}
+#endif // !INCGC || HAVE_IMMORTAL
+
+#ifdef GENGC
+static void clear_nursery(void)
+{
+	g_nursery_top = g_nursery;
+	s_remset_ptr  = 0;
+}
+
+// promote all live nursery objects to the top of old generation.
+// roots are root stack, package list and remembered set.
+static void exec_minor_gc(void)
+{
+	size_t used = g_nursery_top - g_nursery;
+
+#ifdef DEBUG_GC
+	bool force_major = ++s_gc_minor_cnt % 64 == 0;
+#else  // DEBUG_GC
+	bool force_major = false;
+#endif // DEBUG_GC
+
+	if(force_major || g_memory_top >= g_memory_gc || g_memory_top + used >= g_memory_max)
+	{
+		exec_gc();	// old generation is full: major GC
+		return;
+	}
+
+#ifdef TRACE_GC
+	fprintf(stderr, "Executing minor GC...\n");
+#endif
+	struct timespec t0;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	sample_peak();
+	g_gc_minor = true;
+	value_t* scanned = g_memory_top;
+
+	copy_root();
+	for(int i = 0; i < s_remset_ptr; i++)
+	{
+		copy1(&g_memory_top, s_remset[i]);
+	}
+
+	// scan and copy rest: only promoted objects
+	scan_heap(scanned);
+	g_gc_minor = false;
+
+	s_stat_minor_cnt++;
+	g_stat_copied += g_memory_top - scanned;
+
+	clear_nursery();
+	record_pause(&t0);
+#ifdef TRACE_GC
+	fprintf(stderr, "Executing minor GC Done.\n");
+#endif
+}
+
+// allocate in nursery, or in old generation when GC is locked and nursery is full.
+static value_t* alloc_young(size_t n)
+{
+	if(g_nursery_top + n > g_nursery_max || FORCE_GC)
+	{
+		if(g_lock_cnt == 0)
+		{
+			exec_minor_gc();
+		}
+		else if(g_nursery_top + n > g_nursery_max)
+		{
+			value_t* p = g_memory_top;
+			if(p + n >= g_memory_max)
+			{
+				return 0;
+			}
+			g_memory_top += n;
+
+			// slots are initialized after return without barrier: remember them in advance
+			for(int i = 0; i < n; i++)
+			{
+				p[i] = NIL;
+				gc_remember(p + i);
+			}
+			return p;
+		}
+	}
+
+	value_t* p = g_nursery_top;
+	g_nursery_top += n;
+	return p;
+}
+#endif // GENGC
+
+#ifndef INCGC
+// full GC. request is words the caller is going to allocate after GC.
+static value_t* exec_collect(size_t request)
+{
+#ifdef NOGC
+	return 0;
+#else  // NOGC
+
+#ifdef TRACE_GC
+	fprintf(stderr, "Executing GC...\n");
+#endif
+	struct timespec t0;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	sample_peak();
+#ifdef HAVE_COMPACT
+	if(g_compact)
+	{
+		value_t* r = exec_compact(request);
+		record_pause(&t0);
+#ifdef TRACE_GC
+		fprintf(stderr, "Executing GC Done.\n");
+#endif
+		return r;
+	}
+#endif // HAVE_COMPACT
+	if(!flip())
+	{
+		return 0;
+	}
+	exec_gc_root();
+#ifdef GENGC
+	clear_nursery();
+#endif // GENGC
+
+	// size next to-space by occupancy after this GC
+	g_heap_size = heap_size_for(g_memory_top - g_memory_pool + request);
+	if(g_heap_size != g_pool_size && g_memory_top + request >= g_memory_gc)
+	{
+		// request does not fit: move to resized space right now
+#ifdef TRACE_GC
+		fprintf(stderr, " Resizing heap to %ld words...\n", (long)g_heap_size);
+#endif
+		if(flip())
+		{
+			exec_gc_root();
+		}
+	}
+
+	record_pause(&t0);
+#ifdef TRACE_GC
+	fprintf(stderr, "Executing GC Done.\n");
+#endif
+	return g_memory_top;
+#endif // NOGC
+}
+
+value_t* collect(size_t request)
+{
+#ifdef THREADS
+	if(!stop_world())
+	{
+		return g_memory_top;	// other thread has collected
+	}
+	value_t* r = exec_collect(request);
+	resume_world();
+	return r;
+#else  // THREADS
+	return exec_collect(request);
+#endif // THREADS
+}
+#endif // INCGC
+
+#ifdef THREADS
+/////////////////////////////////////////////////////////////////////
+// private: thread local allocation
+
+// take n words from heap shared by threads. collect if heap is full.
+static value_t* heap_alloc(size_t n)
+{
+	value_t* top = __atomic_load_n(&g_memory_top, __ATOMIC_RELAXED);
+	while(true)
+	{
+		if(top + n >= g_memory_gc && g_lock_cnt == 0)
+		{
+			if(stop_world())
+			{
+				// every thread refills its buffer soon after: reserve n words
+				// before the world is resumed.
+				value_t* r = exec_collect(n + TLAB_SIZE * s_attached);
+				if(r && g_memory_top + n < g_memory_max)
+				{
+					g_memory_top += n;
+				}
+				else
+				{
+					r = 0;
+				}
+				resume_world();
+				return r;
+			}
+			top = __atomic_load_n(&g_memory_top, __ATOMIC_RELAXED);	// other thread has collected
+		}
+		else if(top + n >= g_memory_max)
+		{
+			return 0;
+		}
+		else if(__atomic_compare_exchange_n(&g_memory_top, &top, top + n, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		{
+			return top;
+		}
+	}
+}
+
+// slow path of allocation: make room for n words in buffer of running thread.
+// rest of old buffer is wasted. it is less than LOS_THRESHOLD words.
+static bool tlab_refill(size_t n)
+{
+	safepoint();
+	if(FORCE_GC && g_lock_cnt == 0)
+	{
+		collect(0);
+	}
+	if(g_tlab_top && (size_t)(g_tlab_max - g_tlab_top) >= n)
+	{
+		return true;	// empty vector data needs valid address, too
+	}
+
+	value_t* p = heap_alloc(TLAB_SIZE);
+	if(!p)
+	{
+		return false;
+	}
+#ifdef CHECK_GC_SANITY
+	// heap is scanned up to g_memory_top
+	for(int i = 0; i < TLAB_SIZE; i++)
+	{
+		p[i] = NIL;
+	}
+#endif // CHECK_GC_SANITY
+
+	g_tlab_top = p;
+	g_tlab_max = p + TLAB_SIZE;
+	return true;
+}
+#endif // THREADS
+
+#ifdef HAVE_IMMORTAL
+/////////////////////////////////////////////////////////////////////
+// private: immortal region support
+
+static bool remember_immortal(value_t* slot)
+{
+	if(g_imm_rem_cnt >= s_imm_rem_size)
+	{
+		size_t    size = s_imm_rem_size ? s_imm_rem_size * 2 : REMSET_INITIAL_SIZE;
+		value_t** p    = (value_t**)realloc(g_imm_rem, sizeof(value_t*) * size);
+		if(!p)
+		{
+			return false;
+		}
+		g_imm_rem      = p;
+		s_imm_rem_size = size;
+	}
+
+	size_t k = slot - g_immortal;
+	s_imm_rem_bits[k / 8]      |= 1 << (k % 8);
+	g_imm_rem[g_imm_rem_cnt++]  = slot;
+	return true;
+}
+
+// immortal objects are copied out by GC while g_thaw is set: then the region is garbage.
+static void release_immortal(void)
+{
+	pool_free(g_immortal, g_immortal_max - g_immortal);
+	free(s_imm_rem_bits);
+	g_immortal     = 0;
+	g_immortal_max = 0;
+	s_imm_rem_bits = 0;
+	g_imm_rem_cnt  = 0;
+	g_thaw         = false;
+}
+
+// references to heap are moved to the copy of heap in immortal region.
+static void relocate_slot(value_t* v)
+{
+	value_t* p = VPTROF(*v);
+	if(rtypeof(*v) < OTH_T && p >= g_memory_pool && p < g_memory_top)
+	{
+		v->raw += PTR_RAW(g_immortal) - PTR_RAW(g_memory_pool);
+	}
+}
+
+// replace immortal region with heap, which has all live objects after GC with g_thaw set.
+static bool move_to_immortal(void)
+{
+	size_t   n     = g_memory_top - g_memory_pool;
+	value_t* block = pool_alloc(n);
+	uint8_t* bits  = (uint8_t*)calloc(n / 8 + 1, 1);
+	if(!block || !bits)
+	{
+		pool_free(block, n);
+		free(bits);
+		return false;
+	}
+
+	memcpy(block, g_memory_pool, sizeof(value_t) * n);
+	release_immortal();
+	g_immortal     = block;
+	g_immortal_max = block + n;
+	s_imm_rem_bits = bits;
+
+	visit_roots(relocate_slot);
+	for(size_t i = 0; i < g_los_cnt; i++)
+	{
+		value_t* data = los_data(g_los[i]);
+		for(size_t j = 0; j < los_words(g_los[i]); j++)
+		{
+			relocate_slot(data + j);
+		}
+	}
+	for(value_t* p = block; p < block + n; p++)
+	{
+		relocate_slot(p);
+		if(ptrp(*p) && is_immortal_root(*p) && !remember_immortal(p))
+		{
+			rerr_alloc();	// data in large object space is not scanned without it
+		}
+	}
+
+	g_memory_top = g_memory_pool;
+	return true;
+}
+#endif // HAVE_IMMORTAL
+
+/////////////////////////////////////////////////////////////////////
+// public: Control GC
+
+#ifdef CONSGC
+// roots out of C stack: globals and raw vectors.
+void push_root_reg(value_t* v)
+{
+	push_root_raw_vec(v, 0);
+}
+
+void push_root_raw_vec(value_t *v, int* sp)
+{
+	root_t* r = s_self->root + s_self->root_ptr++;
+	r->data   = v;
+	r->size   = sp;
+	r->depth  = g_root_reg = g_root_depth++;
+	assert(s_self->root_ptr < ROOT_SIZE);
+	return;
+}
+
+void pop_root_reg(void)
+{
+	mutator_t* m = s_self;
+	while(m->root_ptr > 0 && m->root[m->root_ptr - 1].depth >= g_root_depth)
+	{
+		m->root_ptr--;
+	}
+	g_root_reg = m->root_ptr > 0 ? m->root[m->root_ptr - 1].depth : -1;
+	return;
+}
+#else  // CONSGC
+void push_root(value_t* v)
+{
+	mutator_t* m = s_self;
+	m->root[m->root_ptr  ].data = v;
+	m->root[m->root_ptr++].size = 0;
+	assert(m->root_ptr < ROOT_SIZE);
+	return;
+}
+
+void push_root_raw_vec(value_t *v, int* sp)
+{
+	mutator_t* m = s_self;
+	m->root[m->root_ptr  ].data = v;
+	m->root[m->root_ptr++].size = sp;
+	assert(m->root_ptr < ROOT_SIZE);
+	return;
+}
+
+void pop_root(int n)
+{
+	mutator_t* m = s_self;
+	for(int i = 0; i < n; i++)
+	{
+		m->root[m->root_ptr  ].data = 0;
+		m->root[m->root_ptr--].size = 0;
+	}
+	return;
+}
+#endif // CONSGC
+
+#ifdef THREADS
+// register running thread as a mutator. heap must not be used before this.
+void attach_thread(void)
+{
+	mutator_t* m = (mutator_t*)calloc(1, sizeof(mutator_t));
+	if(!m) abort();
+	m->tlab_top  = &g_tlab_top;
+	m->tlab_max  = &g_tlab_max;
+	g_tlab_top   = g_tlab_max = 0;
+	g_lock_cnt   = 0;
+
+	pthread_mutex_lock(&s_world_lock);
+	while(g_safepoint)
+	{
+		pthread_cond_wait(&s_world_resumed, &s_world_lock);
+	}
+	m->next    = g_mutators;
+	g_mutators = m;
+	s_running++;
+	s_attached++;
+	pthread_mutex_unlock(&s_world_lock);
+	s_self     = m;
+}
+
+// unregister running thread. its roots must be popped.
+void detach_thread(void)
+{
+	mutator_t* m = s_self;
+	assert(m->root_ptr == 0);
+
+	pthread_mutex_lock(&s_world_lock);
+	for(mutator_t** p = &g_mutators; *p; p = &(*p)->next)
+	{
+		if(*p == m)
+		{
+			*p = m->next;
+			break;
+		}
+	}
+	s_stat_cons_cnt   += m->cons_cnt;
+	s_stat_vector_cnt += m->vector_cnt;
+	s_stat_data       += m->data;
+	s_running--;
+	s_attached--;
+	pthread_cond_signal(&s_world_parked);
+	pthread_mutex_unlock(&s_world_lock);
+
+	free(m);
+	s_self     = 0;
+	g_tlab_top = g_tlab_max = 0;
+}
+
+// slow path of safepoint.
+void park_thread(void)
+{
+	pthread_mutex_lock(&s_world_lock);
+	park_locked();
+	pthread_mutex_unlock(&s_world_lock);
+}
+
+// running thread does not touch heap until leave_blocking, e.g. waiting input.
+// GC does not wait for it.
+void enter_blocking(void)
+{
+	pthread_mutex_lock(&s_world_lock);
+	s_running--;
+	pthread_cond_signal(&s_world_parked);
+	pthread_mutex_unlock(&s_world_lock);
+}
+
+void leave_blocking(void)
+{
+	pthread_mutex_lock(&s_world_lock);
+	while(g_safepoint)
+	{
+		pthread_cond_wait(&s_world_resumed, &s_world_lock);
+	}
+	s_running++;
+	pthread_mutex_unlock(&s_world_lock);
+}
+#endif // THREADS
+
+value_t* exec_gc(void)
+{
+	return collect(0);
+}
 
-static root_t	s_root[ROOT_SIZE]	= { 0 };
-static int	s_root_ptr		=   0;
+// full collection. incremental mode finishes running cycle and stops the world
+// for a whole one: weak references are cleared only there.
+void force_gc(void)
+{
+#ifdef INCGC
+	incgc_complete();
 
-/////////////////////////////////////////////////////////////////////
-// private: support functions
+	struct timespec t0;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	sample_peak();
+	if(flip())
+	{
+		exec_gc_root();
+	}
+	record_pause(&t0);
+#else  // INCGC
+	exec_gc();
+#endif // INCGC
+#ifndef NOGC
+	discard_from_space(true);
+#endif  // NOGC
+}
 
-#ifndef NDEBUG
-inline static bool is_from(value_t v)
+// move all live objects into immortal region. later GCs neither move nor scan them
+// except slots remembered by write_barrier. returns nil if not supported.
+value_t freeze_heap(void)
 {
-	return ((value_t*)v.cons >= g_memory_pool_from && (value_t*)v.cons < g_memory_pool_from + INITIAL_ALLOC_SIZE);
+#ifdef HAVE_IMMORTAL
+	if(g_lock_cnt)
+	{
+		return NIL;	// caller may hold addresses of objects
+	}
+#ifdef THREADS
+	while(!stop_world())
+	{
+		// other thread has collected: try again
+	}
+#endif // THREADS
+#ifdef INCGC
+	incgc_complete();
+#endif // INCGC
+
+#ifdef TRACE_GC
+	fprintf(stderr, "Freezing heap...\n");
+#endif
+	struct timespec t0;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	sample_peak();
+
+	// copy everything live, including immortal objects, into heap
+	g_thaw  = true;
+	bool ok = flip();
+	if(ok)
+	{
+		exec_gc_root();
+#ifdef GENGC
+		clear_nursery();
+#endif // GENGC
+#ifdef HAVE_COMPACT
+		release_from_space();
+#endif // HAVE_COMPACT
+		if(!move_to_immortal())
+		{
+			release_immortal();	// objects stay in heap
+			ok = false;
+		}
+		discard_from_space(true);
+		pool_discard(g_memory_pool, g_pool_size, g_memory_top);
+	}
+	g_thaw = false;
+	record_pause(&t0);
+
+#ifdef TRACE_GC
+	fprintf(stderr, "Freezing heap Done.\n");
+#endif
+#ifdef THREADS
+	resume_world();
+#endif // THREADS
+	return ok ? g_t : RERR(ERR_ALLOC, NIL);
+#else  // HAVE_IMMORTAL
+	return NIL;
+#endif // HAVE_IMMORTAL
 }
 
-inline static bool is_to(value_t v)
+// semispaces mapped after this are asked to be backed by transparent huge pages.
+void set_huge_pages(bool on)
 {
-	return ((value_t*)v.cons >= g_memory_pool && (value_t*)v.cons < g_memory_max);
+	s_huge_pages = on;
 }
-#endif // NDEBUG
 
-inline static bool is_sanity_addr(value_t v)
+void set_gc_pause_budget(long usec)
 {
-	return ((value_t*)v.cons >= g_memory_pool && (value_t*)v.cons < g_memory_top);
+#ifdef INCGC
+	g_incgc_budget = usec;
+#endif // INCGC
 }
 
-inline static bool is_sanity(value_t v)
+void print_gc_pauses(FILE* fp)
 {
-	if(rtypeof(v) < OTH_T)
+	// percentiles are upper bounds of histogram buckets
+	long p50 = 0, p99 = 0, cnt = 0;
+	for(int i = 0; i < PAUSE_HIST_SIZE; i++)
 	{
-		if(!(is_sanity_addr(AVALUE(v)) || nilp(v) || AVALUE(v).raw == 0))
+		cnt += s_pause_hist[i];
+		if(!p50 && cnt * 100 >= s_pause_cnt * 50) p50 = 1L << i;
+		if(!p99 && cnt * 100 >= s_pause_cnt * 99) p99 = 1L << i;
+	}
+
+	fprintf(fp, "GC pauses: %ld, max %ld usec, p50 < %ld usec, p99 < %ld usec\n", s_pause_cnt, s_pause_max, p50, p99);
+	for(int i = 0; i < PAUSE_HIST_SIZE; i++)
+	{
+		if(s_pause_hist[i])
 		{
-			abort();
-			return false;
+			fprintf(fp, "  < %8ld usec: %ld\n", 1L << i, s_pause_hist[i]);
 		}
 	}
-	return true;
 }
 
-inline static void copy1(value_t** top, value_t* v)
+void get_gc_stats(gc_stats_t* stats)
 {
-	rtype_t type = rtypeof(*v);
-	value_t cur  = AVALUE(*v);
-	value_t alloc;
+	size_t cons   = s_stat_cons_cnt;
+	size_t vector = s_stat_vector_cnt;
+	size_t data   = s_stat_data;
+#ifdef THREADS
+	pthread_mutex_lock(&s_world_lock);
+#endif // THREADS
+	for(mutator_t* m = g_mutators; m; m = m->next)
+	{
+		cons   += m->cons_cnt;
+		vector += m->vector_cnt;
+		data   += m->data;
+	}
+#ifdef THREADS
+	pthread_mutex_unlock(&s_world_lock);
+#endif // THREADS
+
+	sample_peak();
+	stats->collections       = g_stat_gc_cnt;
+	stats->minor_collections = s_stat_minor_cnt;
+	stats->pauses            = s_pause_cnt;
+	stats->cons_bytes        = cons   * 2 * sizeof(value_t);
+	stats->vector_bytes      = vector * 4 * sizeof(value_t);
+	stats->vector_data_bytes = data   * sizeof(value_t);
+	stats->copied_bytes      = g_stat_copied     * sizeof(value_t);
+	stats->survivor_bytes    = g_stat_survivor   * sizeof(value_t);
+	stats->pause_last        = s_pause_last;
+	stats->pause_total       = s_pause_total;
+	stats->pause_max         = s_pause_max;
+	stats->heap_bytes        = heap_in_use()     * sizeof(value_t);
+	stats->heap_peak_bytes   = s_stat_peak       * sizeof(value_t);
+	stats->heap_size_bytes   = g_pool_size       * sizeof(value_t);
+#ifdef HAVE_IMMORTAL
+	stats->immortal_bytes    = (g_immortal_max - g_immortal) * sizeof(value_t);
+#else  // HAVE_IMMORTAL
+	stats->immortal_bytes    = 0;
+#endif // HAVE_IMMORTAL
+	stats->weak_cleared      = g_stat_weak_cleared;
+	stats->rss_bytes         = resident_bytes();
+}
 
-	switch(type)
+#ifdef GENGC
+int gc_remember(value_t* slot)
+{
+	if(s_remset_ptr > 0 && s_remset[s_remset_ptr - 1] == slot)
 	{
-		case CONS_T:
-		case ERR_T:
-		case CLOJ_T:
-		case MACRO_T:
-		case SYM_T:
-			if(cur.raw == 0) break;	// null value
-			if(ptrp(cur.cons->car))	// target cons is already copied
+		return 0;
+	}
+
+	if(s_remset_ptr >= s_remset_size)
+	{
+		s_remset_size = s_remset_size ? s_remset_size * 2 : REMSET_INITIAL_SIZE;
+		s_remset      = (value_t**)realloc(s_remset, sizeof(value_t*) * s_remset_size);
+		if(!s_remset)
+		{
+			rerr_alloc();
+		}
+	}
+	s_remset[s_remset_ptr++] = slot;
+	return 1;
+}
+#endif // GENGC
+
+#ifdef HAVE_IMMORTAL
+void gc_remember_immortal(value_t* slot)
+{
+	size_t k = slot - g_immortal;
+#ifdef THREADS
+	pthread_mutex_lock(&s_imm_lock);
+#endif // THREADS
+	bool r = (s_imm_rem_bits[k / 8] >> (k % 8) & 1) || remember_immortal(slot);
+#ifdef THREADS
+	pthread_mutex_unlock(&s_imm_lock);
+#endif // THREADS
+	if(!r)
+	{
+		rerr_alloc();
+	}
+}
+#endif // HAVE_IMMORTAL
+
+bool check_lock(void)
+{
+	return s_self->root_ptr == 0;
+}
+
+bool check_sanity(void)
+{
+	// scan root
+	for(mutator_t* m = g_mutators; m; m = m->next)
+	{
+		for(int i = 0; i < m->root_ptr; i++)
+		{
+			if(m->root[i].size)
 			{
-				// replace value itself to copyed to-space address
-				alloc = cur.cons->car;
-				assert(is_to(alloc));
-				alloc.type.main = type;
-				*v = alloc;
+				for(int j = 0; j <= *m->root[i].size; j++)
+				{
+					is_sanity(m->root[i].data[j]);
+				}
 			}
 			else
 			{
-				assert(is_from(cur));
-				// allocate memory and copy car/cdr of current cons in from-space to to-space
-				alloc.raw      = (uintptr_t)*top;
-				*(*top)++ = UNSAFE_CAR(cur);
-				*(*top)++ = UNSAFE_CDR(cur);
+				is_sanity(*m->root[i].data);
+			}
+		}
+	}
 
-				// write to-space address to car of current cons in from-space
-				alloc.type.main = PTR_T;
-				cur.cons->car   = alloc;
+	// memory pool
+	for(value_t* i = g_memory_pool; i < g_memory_top; i++)
+	{
+		is_sanity(*i);
+	}
 
-				// replace value itself to copyed to-space address
-				alloc.type.main = type;
-				*v = alloc;
-			}
-			break;
+#ifdef GENGC
+	for(value_t* i = g_nursery; i < g_nursery_top; i++)
+	{
+		is_sanity(*i);
+	}
+#endif // GENGC
 
-		case VEC_T:
-			if(ptrp(cur.vector->type))	// target vector is already copied
+#ifdef HAVE_IMMORTAL
+	// immortal slots referring out of it must be remembered
+	for(value_t* i = g_immortal; i < g_immortal_max; i++)
+	{
+		size_t k = i - g_immortal;
+		if(is_immortal_root(*i) && !(s_imm_rem_bits[k / 8] >> (k % 8) & 1))
+		{
+			abort();
+		}
+		is_sanity(*i);
+	}
+#endif // HAVE_IMMORTAL
+
+	return true;
+}
+
+/////////////////////////////////////////////////////////////////////
+// private: core image support
+//
+// core image is a header page followed by sections: heap words, whose
+// references are linked at CORE_BASE, and a word for each root. header names
+// version and build of its writer, and has checksums of itself and of each
+// section, so an image of other build or a damaged one is refused before it
+// is used. raw heap loaded at CORE_BASE is the file mapped copy on write, so
+// loading touches only pages in use. elsewhere words are copied and
+// relocated. packed heap is smaller to ship, and it is always decoded.
+
+enum { CORE_HEAP = 0, CORE_ENV, CORE_PACKAGES, CORE_ENTRY, CORE_SECTIONS };	// kinds of section
+enum { CORE_RAW = 0, CORE_PACKED };				// encodings of section
+
+typedef struct
+{
+	uint64_t	offset;		// bytes from start of file
+	uint64_t	bytes;		// stored in file
+	uint64_t	words;		// after decoding
+	uint64_t	encoding;
+	uint64_t	sum;		// checksum of stored bytes
+} core_section_t;
+
+typedef struct
+{
+	char		magic[8];	// CORE_MAGIC
+	uint32_t	version;	// CORE_VERSION
+	uint32_t	word_size;	// sizeof(value_t) of writer
+	uint64_t	features;	// core_features() of writer
+	uint64_t	base;		// CORE_BASE of writer
+	core_section_t	section[CORE_SECTIONS];		// indexed by kind
+	uint64_t	sum;		// checksum of header before it
+} core_header_t;
+
+typedef struct
+{
+	uint64_t	a;
+	uint64_t	b;
+} core_sum_t;
+
+static bool	s_pack_core		= false;	// save heap of core image packed
+static pid_t	s_snapshot_pid		= 0;		// process saving core image in background
+static int	s_snapshot_status	= 0;		// of it, when it is waited
+
+// core image linked into executable by make boot (boot_core.S), page aligned.
+// they are null in executable without it.
+extern const char	g_boot_core[]		__attribute__((weak));
+extern const char	g_boot_core_end[]	__attribute__((weak));
+
+// build options which change layout of objects.
+static uint64_t core_features(void)
+{
+	uint64_t f = 0;
+#ifdef CDRCODE
+	f |= 1;
+#endif // CDRCODE
+#ifdef COMPRESSED_REFS
+	f |= 2;
+#endif // COMPRESSED_REFS
+	return f;
+}
+
+// add bytes to Fletcher style checksum of 64-bit words. only the last bytes
+// added to a checksum may be a partial word.
+static void core_sum(core_sum_t* s, const void* p, size_t bytes)
+{
+	const char* c = (const char*)p;
+	uint64_t    w;
+	size_t      i = 0;
+	for(; i + sizeof(w) <= bytes; i += sizeof(w))
+	{
+		memcpy(&w, c + i, sizeof(w));
+		s->a += w;
+		s->b += s->a;
+	}
+	if(i < bytes)
+	{
+		w = 0;
+		memcpy(&w, c + i, bytes - i);
+		s->a += w;
+		s->b += s->a;
+	}
+}
+
+static uint64_t core_sum_of(const core_sum_t* s)
+{
+	return s->a ^ (s->b << 32 | s->b >> 32);
+}
+
+static uint64_t core_checksum(const void* p, size_t bytes)
+{
+	core_sum_t s = { 1, 0 };
+	core_sum(&s, p, bytes);
+	return core_sum_of(&s);
+}
+
+// reference in heap word w, moved by delta.
+inline static value_t relocate_word(value_t w, uintptr_t delta)
+{
+	if(rtypeof(w) < OTH_T && AVALUE(w).raw != 0)
+	{
+		w.raw += delta;
+	}
+	return w;
+}
+
+// packed word is its difference from the word two before it, which is the
+// same field of the previous cons, zigzag coded 7 bits a byte.
+static size_t pack_word(uint8_t* buf, value_t w, value_t w2)
+{
+#if __WORDSIZE == 32 || defined(COMPRESSED_REFS)
+	int64_t  d = (int32_t)(w.raw - w2.raw);
+#else  // __WORDSIZE == 32 || COMPRESSED_REFS
+	int64_t  d = (int64_t)(w.raw - w2.raw);
+#endif // __WORDSIZE == 32 || COMPRESSED_REFS
+	uint64_t z = (uint64_t)d << 1 ^ (uint64_t)(d >> 63);
+	size_t   n = 0;
+	for(; z >= 0x80; z >>= 7)
+	{
+		buf[n++] = (uint8_t)(z | 0x80);
+	}
+	buf[n++] = (uint8_t)z;
+	return n;
+}
+
+// decode words of packed bytes to p, relocated by delta.
+static bool unpack_words(const uint8_t* s, size_t bytes, value_t* p, size_t words, uintptr_t delta)
+{
+	const uint8_t* end = s + bytes;
+	value_t        w1  = { .raw = 0 };
+	value_t        w2  = { .raw = 0 };
+	for(size_t i = 0; i < words; i++)
+	{
+		uint64_t z = 0;
+		for(int shift = 0; ; shift += 7)
+		{
+			if(s == end || shift > 63)
 			{
-				// replace value itself to copyed to-space address
-				alloc = cur.vector->type;
-				assert(is_to(alloc));
-				alloc.type.main = type;
-				*v = alloc;
+				return false;
 			}
-			else
+			z |= (uint64_t)(*s & 0x7f) << shift;
+			if(!(*s++ & 0x80))
 			{
-				assert(is_from(cur));
-				assert(intp(cur.vector->size));
-				assert(intp(cur.vector->alloc));
-				assert(nilp(cur.vector->type));
-				// allocate memory and copy vector in from-space to to-space
-				alloc.raw           = (uintptr_t)*top;
-				*top               += 4;
-				alloc.vector->size  = cur.vector->size;
-				alloc.vector->alloc = cur.vector->alloc;
-				alloc.vector->type  = cur.vector->type;
-				if(VPTROF(cur.vector->data))
-				{
-					assert(ptrp(cur.vector->data));
-					alloc.vector->data  = RPTR(*top);
-					for(int i = 0; i < INTOF(cur.vector->alloc); i++)
-						*(*top)++ = VPTROF(cur.vector->data)[i];
-				}
-				else
-				{
-					alloc.vector->data  = RPTR(0);
-				}
-
-				// write to-space address to car of current cons in from-space
-				alloc.type.main     = PTR_T;
-				cur.vector->type    = alloc;
-
-				// replace value itself to copyed to-space address
-				alloc.type.main = type;
-				*v = alloc;
+				break;
 			}
-			break;
+		}
 
-		default:
-			break;
+		value_t w = { .raw = w2.raw + (z >> 1 ^ -(z & 1)) };
+		w2   = w1;
+		w1   = w;
+		p[i] = relocate_word(w, delta);
 	}
-
-	return ;
+	return s == end;
 }
 
-static void swap_buffer(void)
+// write bytes of section, adding them to its checksum.
+static bool write_section(FILE* fp, core_section_t* sec, core_sum_t* s, const void* p, size_t bytes)
 {
-	value_t* tmp       = g_memory_pool;
-	g_memory_pool      = g_memory_top = g_memory_pool_from;
-	g_memory_max       = g_memory_top + INITIAL_ALLOC_SIZE;
-	g_memory_gc        = g_memory_top + INITIAL_ALLOC_SIZE / 2;
-	g_memory_pool_from = tmp;
+	core_sum(s, p, bytes);
+	sec->bytes += bytes;
+	return fwrite(p, 1, bytes, fp) == bytes;
 }
 
-static void exec_gc_root(void)
+// write heap section translated by delta from current position, page aligned.
+static bool write_heap(FILE* fp, core_section_t* sec, uintptr_t delta)
 {
-	// copy g_package_list to memory pool
-	copy1(&g_memory_top, &g_package_list);
+	sec->offset   = ftell(fp);
+	sec->words    = g_memory_top - g_memory_pool;
+	sec->encoding = s_pack_core ? CORE_PACKED : CORE_RAW;
+
+	// packed bytes are written by whole words: rest is carried to next chunk
+	size_t   size = sizeof(value_t) * CORE_CHUNK_SIZE;
+	uint8_t* buf  = (uint8_t*)malloc(s_pack_core ? size * 10 / sizeof(value_t) + sizeof(uint64_t) : size);
+	if(!buf)
+	{
+		return false;
+	}
 
-	// copy root to memory pool
-	for(int i = 0; i < s_root_ptr; i++)
+	core_sum_t s    = { 1, 0 };
+	size_t     rest = 0;
+	bool       ok   = true;
+	for(value_t* p = g_memory_pool; ok && p < g_memory_top; p += CORE_CHUNK_SIZE)
 	{
-		if(s_root[i].size)
+		size_t n = MIN(g_memory_top - p, CORE_CHUNK_SIZE);
+		if(s_pack_core)
 		{
-			for(int j = 0; j <= *s_root[i].size; j++)
+			size_t len = rest;
+			for(size_t i = 0; i < n; i++)
 			{
-				copy1(&g_memory_top, s_root[i].data + j);
+				value_t w  = relocate_word(p[i], delta);
+				value_t w2 = p + i >= g_memory_pool + 2 ? relocate_word(p[i - 2], delta) : (value_t){ .raw = 0 };
+				len       += pack_word(buf + len, w, w2);
 			}
+			size_t whole = p + n < g_memory_top ? len & ~(sizeof(uint64_t) - 1) : len;
+			ok   = write_section(fp, sec, &s, buf, whole);
+			rest = len - whole;
+			memmove(buf, buf + whole, rest);
 		}
 		else
 		{
-			copy1(&g_memory_top, s_root[i].data);
+			value_t* v = (value_t*)buf;
+			for(size_t i = 0; i < n; i++)
+			{
+				v[i] = relocate_word(p[i], delta);
+			}
+			ok = write_section(fp, sec, &s, buf, n * sizeof(value_t));
 		}
 	}
+	free(buf);
+	sec->sum = core_sum_of(&s);
+	return ok;
+}
 
-	// scan and copy rest
-	value_t* scanned = g_memory_pool;
-	while(scanned != g_memory_top)
+// write root section of a word, translated by delta.
+static bool write_root(FILE* fp, core_section_t* sec, value_t v, uintptr_t delta)
+{
+	core_sum_t s = { 1, 0 };
+	v             = relocate_word(v, delta);
+	sec->offset   = ftell(fp);
+	sec->words    = 1;
+	sec->encoding = CORE_RAW;
+	bool ok       = write_section(fp, sec, &s, &v, sizeof(v));
+	sec->sum      = core_sum_of(&s);
+	return ok;
+}
+
+static bool write_image(FILE* fp, value_t env, value_t entry)
+{
+	core_header_t h     = { CORE_MAGIC, CORE_VERSION, sizeof(value_t), core_features(), CORE_BASE };
+	uintptr_t     delta = CORE_BASE - PTR_RAW(g_memory_pool);
+	if(fseek(fp, CORE_HEADER_SIZE, SEEK_SET) != 0 ||
+	   !write_heap(fp, &h.section[CORE_HEAP],     delta) ||
+	   !write_root(fp, &h.section[CORE_ENV],      env,            delta) ||
+	   !write_root(fp, &h.section[CORE_PACKAGES], g_package_list, delta) ||
+	   !write_root(fp, &h.section[CORE_ENTRY],    entry,          delta))
 	{
-		copy1(&g_memory_top, scanned++);
+		return false;
 	}
 
-#ifdef TRACE_GC
-	fprintf(stderr, " Replacing symbols...\n");
-#endif
+	h.sum = core_checksum(&h, offsetof(core_header_t, sum));
+	return fseek(fp, 0, SEEK_SET) == 0 && fwrite(&h, sizeof(h), 1, fp) == 1;
 }
 
-/////////////////////////////////////////////////////////////////////
-// public: Control GC
-
-void push_root(value_t* v)
+// returns why image of size bytes is refused, or 0 if it may be loaded.
+static const char* check_image(const char* img, size_t size, core_header_t* h)
 {
-	s_root[s_root_ptr  ].data = v;
-	s_root[s_root_ptr++].size = 0;
-	assert(s_root_ptr < ROOT_SIZE);
-	return;
-}
+	if(size < sizeof(*h) || memcmp(img, CORE_MAGIC, sizeof(h->magic)) != 0)
+	{
+		return "not a core image.";
+	}
+	memcpy(h, img, sizeof(*h));
+	if(h->sum != core_checksum(h, offsetof(core_header_t, sum)))
+	{
+		return "core image header is damaged.";
+	}
+	if(h->version != CORE_VERSION)
+	{
+		return "core image is of other version.";
+	}
+	if(h->word_size != sizeof(value_t) || h->features != core_features())
+	{
+		return "core image is of other build.";
+	}
 
-void push_root_raw_vec(value_t *v, int* sp)
-{
-	s_root[s_root_ptr  ].data = v;
-	s_root[s_root_ptr++].size = sp;
-	assert(s_root_ptr < ROOT_SIZE);
-	return;
+	for(int i = 0; i < CORE_SECTIONS; i++)
+	{
+		const core_section_t* sec = &h->section[i];
+		if(sec->offset > size || sec->bytes > size - sec->offset)
+		{
+			return "core image is truncated.";
+		}
+		if(sec->words == 0 || (i != CORE_HEAP && sec->words != 1) ||
+		   (sec->encoding != CORE_RAW && (i != CORE_HEAP || sec->encoding != CORE_PACKED)) ||
+		   (sec->encoding == CORE_RAW && sec->bytes != sec->words * sizeof(value_t)))
+		{
+			return "core image has invalid section.";
+		}
+		if(sec->sum != core_checksum(img + sec->offset, sec->bytes))
+		{
+			return "core image is damaged.";
+		}
+	}
+	return 0;
 }
 
-void pop_root(int n)
+// block of n words at CORE_BASE, with raw heap of image at off in file fd
+// mapped copy on write at its start. returns 0 if heap is not mappable, or
+// the address is in use.
+static value_t* map_image(int fd, off_t off, const core_header_t* h, size_t n)
 {
-	for(int i = 0; i < n; i++)
+	const core_section_t* sec = &h->section[CORE_HEAP];
+	if(fd < 0 || h->base != CORE_BASE || sec->encoding != CORE_RAW || (off + sec->offset) % 4096 != 0)
 	{
-		s_root[s_root_ptr  ].data = 0;
-		s_root[s_root_ptr--].size = 0;
+		return 0;
 	}
-	return;
+
+	size_t   bytes = pool_bytes(n);
+	value_t* p     = (value_t*)map_pages_at(RAW_PTR(CORE_BASE), bytes);
+	if(p && mmap(p, pool_bytes(sec->words), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, off + sec->offset) == MAP_FAILED)
+	{
+		unmap_pages(p, bytes);
+		p = 0;
+	}
+	return p;
 }
 
-value_t* exec_gc(void)
+// decode heap of image to p, and relocate it there.
+static bool copy_image(const char* img, const core_header_t* h, value_t* p)
 {
-#ifdef NOGC
-	return 0;
-#else  // NOGC
-
-#ifdef TRACE_GC
-	fprintf(stderr, "Executing GC...\n");
-#endif
-	swap_buffer();
-	exec_gc_root();
+	const core_section_t* sec   = &h->section[CORE_HEAP];
+	uintptr_t             delta = PTR_RAW(p) - h->base;
+	if(sec->encoding == CORE_PACKED)
+	{
+		return unpack_words((const uint8_t*)img + sec->offset, sec->bytes, p, sec->words, delta);
+	}
 
+	memcpy(p, img + sec->offset, sec->bytes);
+	for(size_t i = 0; i < sec->words; i++)
+	{
+		p[i] = relocate_word(p[i], delta);
+	}
+	return true;
+}
 
-#ifdef TRACE_GC
-	fprintf(stderr, "Executing GC Done.\n");
-#endif
-	return g_memory_top;
-#endif // NOGC
+// root of kind in image whose heap is loaded at p.
+static value_t image_root(const char* img, const core_header_t* h, int kind, value_t* p)
+{
+	value_t v;
+	memcpy(&v, img + h->section[kind].offset, sizeof(v));
+	return relocate_word(v, PTR_RAW(p) - h->base);
 }
 
-void force_gc(void)
+// make empty heap large enough to load size words.
+static bool reserve_heap(size_t size)
 {
-	exec_gc();
+	assert(g_memory_top == g_memory_pool);
+#ifndef NOGC
+	g_heap_size = heap_size_for(size);
+	if(g_heap_size != g_pool_size && !flip())
+	{
+		return false;
+	}
+#ifdef HAVE_COMPACT
+	release_from_space();
+#endif // HAVE_COMPACT
+#endif  // NOGC
+	return size < g_pool_size;
 }
 
-bool check_lock(void)
+
+// image becomes bottom of heap pool. returns address of image.
+static value_t* load_heap(int fd, off_t off, const char* img, const core_header_t* h)
 {
-	return s_root_ptr == 0;
+	size_t words = h->section[CORE_HEAP].words;
+	if(!reserve_heap(words))
+	{
+		return 0;
+	}
+
+	value_t* p = map_image(fd, off, h, g_pool_size);
+	if(p)
+	{
+		pool_free(g_memory_pool, g_pool_size);
+		g_memory_pool = p;
+		g_memory_max  = g_memory_pool + g_pool_size;
+		g_memory_gc   = g_memory_pool + gc_limit(g_pool_size);
+	}
+	else if(!copy_image(img, h, g_memory_pool))
+	{
+		return 0;
+	}
+	g_memory_top = g_memory_pool + words;
+	return g_memory_pool;
 }
 
-bool check_sanity(void)
+#ifdef HAVE_IMMORTAL
+// image becomes immortal region, as if heap was frozen after it is loaded.
+// nothing in it refers out of it. returns address of image.
+static value_t* load_immortal(int fd, off_t off, const char* img, const core_header_t* h)
 {
-	// scan root
-	for(int i = 0; i < s_root_ptr; i++)
+	size_t   n    = h->section[CORE_HEAP].words;
+	value_t* p    = map_image(fd, off, h, n);
+	uint8_t* bits = (uint8_t*)calloc(n / 8 + 1, 1);
+	if(!p && (p = pool_alloc(n)) && !copy_image(img, h, p))
 	{
-		if(s_root[i].size)
-		{
-			for(int j = 0; j <= *s_root[i].size; j++)
-			{
-				is_sanity(s_root[i].data[j]);
-			}
-		}
-		else
-		{
-			is_sanity(*s_root[i].data);
-		}
+		pool_free(p, n);
+		p = 0;
+	}
+	if(!p || !bits)
+	{
+		pool_free(p, n);
+		free(bits);
+		return 0;
 	}
 
-	// memory pool
-	for(value_t* i = g_memory_pool; i < g_memory_top; i++)
+	release_immortal();
+	g_immortal     = p;
+	g_immortal_max = p + n;
+	s_imm_rem_bits = bits;
+	return p;
+}
+#endif // HAVE_IMMORTAL
+
+// load image of size bytes at img, which is at off in file fd if fd is not -1.
+// entry clojure of image is set to *entry, nil if it has none.
+static value_t load_image(const char* img, size_t size, int fd, off_t off, bool immortal, value_t* entry)
+{
+	core_header_t h;
+	const char*   why = check_image(img, size, &h);
+	if(why)
 	{
-		is_sanity(*i);
+		return rerr(str_to_rstr(why), NIL);
 	}
 
-	return true;
+#ifdef HAVE_IMMORTAL
+	value_t* p = immortal ? load_immortal(fd, off, img, &h) : load_heap(fd, off, img, &h);
+#else  // HAVE_IMMORTAL
+	value_t* p = load_heap(fd, off, img, &h);
+#endif // HAVE_IMMORTAL
+	if(!p)
+	{
+		return rerr(RINT(ERR_ALLOC), NIL);
+	}
+
+	value_t env    = image_root(img, &h, CORE_ENV,      p);
+	g_package_list = image_root(img, &h, CORE_PACKAGES, p);
+	*entry         = image_root(img, &h, CORE_ENTRY,    p);
+	init_global();
+	return env;
 }
 
-/////////////////////////////////////////////////////////////////////
-// public: core image functions
+// set file offset of boot core image if it is in a loadable segment of object.
+static int exe_offset_of(struct dl_phdr_info* info, size_t size, void* data)
+{
+	off_t*    off  = (off_t*)data;
+	uintptr_t addr = (uintptr_t)g_boot_core;
+	for(int i = 0; i < info->dlpi_phnum; i++)
+	{
+		const ElfW(Phdr)* ph    = &info->dlpi_phdr[i];
+		uintptr_t         start = info->dlpi_addr + ph->p_vaddr;
+		if(ph->p_type == PT_LOAD && addr >= start && addr < start + ph->p_filesz)
+		{
+			*off = ph->p_offset + (addr - start);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// process forked to save core image has only the thread which forked it:
+// other mutators and GC threads are forgotten, and their locks are new.
+static void snapshot_child(void)
+{
+#ifdef THREADS
+	pthread_mutex_init(&s_world_lock, 0);
+	pthread_cond_init(&s_world_parked, 0);
+	pthread_cond_init(&s_world_resumed, 0);
+	pthread_mutex_init(&s_los_lock, 0);
+	g_mutators      = s_self;
+	s_self->next    = 0;
+	s_running       = 1;
+	s_attached      = 1;
+	g_safepoint     = 0;
+#endif // THREADS
+#ifdef PARGC
+	par_forget_threads();
+#endif // PARGC
+	s_snapshot_pid  = 0;
+}
 
-value_t save_core(value_t fn, value_t env)
+static value_t write_core(value_t fn, value_t env, value_t entry)
 {
 	assert(is_str(fn));
 
@@ -278,59 +2628,77 @@ value_t save_core(value_t fn, value_t env)
 #ifdef NOGC
 	return 0;
 #else  // NOGC
+#ifdef INCGC
+	incgc_complete();
+#endif // INCGC
 
 #ifdef TRACE_GC
 	fprintf(stderr, "Executing partial GC for env-compaction...\n");
 #endif
 
-	// swap buffer and gc partial root
-	swap_buffer();
+	// swap buffer and gc partial root.
+	// core image is one block: large objects and immortal objects are copied into heap.
+	g_los_inline = true;
+#ifdef HAVE_IMMORTAL
+	g_thaw       = true;
+#endif // HAVE_IMMORTAL
+	if(!flip())
+	{
+		g_los_inline = false;
+#ifdef HAVE_IMMORTAL
+		g_thaw       = false;
+#endif // HAVE_IMMORTAL
+		return RERR(ERR_ALLOC, NIL);
+	}
+#ifdef CONSGC
+	// pinned objects are not moved: image has copies of them
+	pin_roots();
+	g_pin_image = true;
+#endif // CONSGC
 	copy1(&g_memory_top, &env);
 	copy1(&g_memory_top, &g_package_list);
+	copy1(&g_memory_top, &entry);
 
 	// scan and copy rest
-	value_t* scanned = g_memory_pool;
-	while(scanned != g_memory_top)
-	{
-		copy1(&g_memory_top, scanned++);
-	}
+	scan_heap(g_memory_pool);
+#ifdef CONSGC
+	g_pin_image = false;
+#endif // CONSGC
 
 #ifdef TRACE_GC
 	fprintf(stderr, "Executing GC Done, saving core image...\n");
 #endif
-	char* s = rstr_to_str(fn);
-	if(s)
+	// image is written to other file which replaces fn: fn may be the image
+	// loaded now, whose pages not written yet are read from the file.
+	char* s   = rstr_to_str(fn);
+	char* tmp = s ? (char*)malloc(strlen(s) + 5) : 0;
+	if(tmp)
 	{
-		FILE* fp = fopen(s, "wb");
-		free(s);
+		sprintf(tmp, "%s.tmp", s);
+		FILE* fp = fopen(tmp, "wb");
 		if(fp)
 		{
-			for(value_t* p = g_memory_pool; p < g_memory_top; p++)
+			bool ok = write_image(fp, env, entry);
+			if(fclose(fp) != 0 || !ok || rename(tmp, s) != 0)
 			{
-				value_t w = *p;
-
-				// address translation, g_memory_pool based.
-				if(rtypeof(w) < OTH_T && AVALUE(w).raw != 0)
-				{
-					// shift addres sizeof(cons_t) because avoiding zero pointer (is nil)
-					w.raw -= ((uintptr_t)g_memory_pool - sizeof(cons_t));
-				}
-
-				if(fwrite(&w, sizeof(value_t), 1, fp) != 1)
-				{
-					fclose(fp);
-					return RERR(ERR_FWRITE, NIL);
-				}
+				unlink(tmp);
+				free(tmp);
+				free(s);
+				return RERR(ERR_FWRITE, NIL);
 			}
-			fclose(fp);
+			free(tmp);
+			free(s);
 		}
 		else
 		{
+			free(tmp);
+			free(s);
 			return RERR(ERR_CANTOPEN, NIL);
 		}
 	}
 	else
 	{
+		free(s);
 		return RERR(ERR_TYPE, NIL);
 	}
 
@@ -338,27 +2706,32 @@ value_t save_core(value_t fn, value_t env)
 	fprintf(stderr, "Saving core image done, execute rest GC...\n");
 #endif
 
+	value_t* scanned = g_memory_top;
+#ifdef CONSGC
+	pin_unmap();
+	scan_pinned();
+#endif // CONSGC
+
 	// copy root to memory pool
-	for(int i = 0; i < s_root_ptr; i++)
-	{
-		if(s_root[i].size)
-		{
-			for(int j = 0; j <= *s_root[i].size; j++)
-			{
-				copy1(&g_memory_top, s_root[i].data + j);
-			}
-		}
-		else
-		{
-			copy1(&g_memory_top, s_root[i].data);
-		}
-	}
+	copy_thread_roots();
 
 	// scan and copy rest
-	while(scanned != g_memory_top)
-	{
-		copy1(&g_memory_top, scanned++);
-	}
+	scan_heap(scanned);
+	g_los_inline = false;
+	los_sweep();
+#ifdef HAVE_IMMORTAL
+	release_immortal();
+#endif // HAVE_IMMORTAL
+#ifdef GENGC
+	clear_nursery();
+#endif // GENGC
+#ifdef CONSGC
+	release_blocks();
+#endif // CONSGC
+	discard_from_space(true);
+#ifdef HAVE_COMPACT
+	release_from_space();
+#endif // HAVE_COMPACT
 
 #ifdef TRACE_GC
 	fprintf(stderr, "Executing GC Done.\n");
@@ -368,75 +2741,287 @@ value_t save_core(value_t fn, value_t env)
 #endif // NOGC
 }
 
-value_t load_core(const char* fn)
+/////////////////////////////////////////////////////////////////////
+// public: core image functions
+
+// entry is clojure which process loading the image runs, or nil.
+value_t save_core(value_t fn, value_t env, value_t entry)
 {
-	// load all heap
-	FILE* fp = fopen(fn, "rb");
-	if(fp)
+#ifdef THREADS
+	push_root(&fn);
+	push_root(&env);
+	push_root(&entry);
+	while(!stop_world())
 	{
-		fseek(fp, 0, SEEK_END);
-		long size = ftell(fp);
-		rewind(fp);
-		if(size > 0 && size < INITIAL_ALLOC_SIZE * sizeof(value_t))
-		{
-			// read core file to heap
-			size_t cnt = size / sizeof(value_t);
-			long r = fread(g_memory_pool, sizeof(value_t), cnt, fp);
-			fclose(fp);
-			if(r == cnt)
-			{
-				// fix address
-				for(g_memory_top = g_memory_pool; g_memory_top < g_memory_pool + cnt; g_memory_top++)
-				{
-					// address translation, g_memory_pool based.
-					if(rtypeof(*g_memory_top) < OTH_T && AVALUE(*g_memory_top).raw != 0)
-					{
-						// shift addres sizeof(cons_t) because avoiding zero pointer (is nil)
-						g_memory_top->raw += (uintptr_t)g_memory_pool - sizeof(cons_t);
-					}
-				}
+		// other thread has collected: try again
+	}
+	pop_root(3);
+
+	value_t r = write_core(fn, env, entry);
+	resume_world();
+	return r;
+#else  // THREADS
+	return write_core(fn, env, entry);
+#endif // THREADS
+}
 
-				// restore pakage list
-				value_t env;
-				env.raw                  = (uintptr_t) g_memory_pool;
-				env.type.main            = CONS_T;	//**** ad-hock: error when empty env
+// load core image. with immortal, its objects are immortal as if frozen.
+// image refused is not used: error has the reason.
+value_t load_core(const char* fn, bool immortal, value_t* entry)
+{
+	int fd = open(fn, O_RDONLY);
+	if(fd < 0)
+	{
+		return rerr(RINT(ERR_CANTOPEN), NIL);
+	}
 
-				g_package_list.raw       = (uintptr_t)(g_memory_pool + 2);
-				g_package_list.type.main = CONS_T;
+	struct stat st;
+	char*       img = fstat(fd, &st) == 0 && st.st_size > 0 ?
+		(char*)mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : (char*)MAP_FAILED;
+	value_t     env = img != MAP_FAILED ? load_image(img, st.st_size, fd, 0, immortal, entry) : rerr(RINT(ERR_FREAD), NIL);
+	if(img != MAP_FAILED)
+	{
+		munmap(img, st.st_size);
+	}
+	close(fd);
+	return env;
+}
 
-				init_global();
-				return env;
-			}
-			else
-			{
-				return RERR(ERR_FREAD, NIL);
-			}
-		}
-		else
-		{
-			return RERR(ERR_FREAD, NIL);
-		}
+// load core image linked into executable by make boot. heap of it is mapped
+// from the executable file if it is found, or copied from read only data.
+value_t load_boot_core(bool immortal, value_t* entry)
+{
+	if(!g_boot_core)
+	{
+		return rerr(RINT(ERR_FILENOTFOUND), NIL);
 	}
-	else
+
+	off_t off = -1;
+	int   fd  = dl_iterate_phdr(exe_offset_of, &off) ? open("/proc/self/exe", O_RDONLY) : -1;
+	value_t env = load_image(g_boot_core, g_boot_core_end - g_boot_core, fd, off, immortal, entry);
+	if(fd >= 0)
+	{
+		close(fd);
+	}
+	return env;
+}
+
+// fork process which saves core image while this one goes on: it shares
+// the heap copy on write, so this one pauses only while forking. returns
+// process id in this one, 0 in the child, or error. the child ends by exit_core.
+value_t fork_core(void)
+{
+	if(s_snapshot_pid)
+	{
+		return rerr(str_to_rstr("core snapshot is running."), NIL);
+	}
+
+#ifdef THREADS
+	while(!stop_world())
+	{
+		// other thread has collected: try again
+	}
+#endif // THREADS
+	fflush(0);
+	pid_t pid = fork();
+	if(pid == 0)
 	{
-		return RERR(ERR_CANTOPEN, NIL);
+		snapshot_child();
+		return RINT(0);
 	}
-	// not reached
+#ifdef THREADS
+	resume_world();
+#endif // THREADS
+
+	if(pid < 0)
+	{
+		return rerr(str_to_rstr("cannot fork core snapshot."), NIL);
+	}
+	s_snapshot_pid = pid;
+	return RINT(pid);
+}
+
+// end child of fork_core with result r of saving core image.
+// other errors than of a cause code end it with 255.
+void exit_core(value_t r)
+{
+	_exit(!errp(r)                                            ? 0 :
+	      intp(RERR_CAUSE(r)) && INTOF(RERR_CAUSE(r)) > 0 &&
+	      INTOF(RERR_CAUSE(r)) < 256                          ? INTOF(RERR_CAUSE(r)) : 255);
+}
+
+// result of last core snapshot: t if it is saved or none is taken, error if it
+// fails, or nil while it is running. with block, wait until it ends.
+value_t wait_core(bool block)
+{
+	if(s_snapshot_pid)
+	{
+		int   status;
+		pid_t pid = waitpid(s_snapshot_pid, &status, block ? 0 : WNOHANG);
+		if(pid == 0)
+		{
+			return NIL;
+		}
+		s_snapshot_status = pid < 0 || !WIFEXITED(status) ? 255 : WEXITSTATUS(status);
+		s_snapshot_pid    = 0;
+	}
+
+	return s_snapshot_status == 0   ? g_t :
+	       s_snapshot_status == 255 ? rerr(str_to_rstr("core snapshot fails."), NIL) :
+	                                  rerr(RINT(s_snapshot_status), NIL);
+}
+
+void set_pack_core(bool on)
+{
+	s_pack_core = on;
 }
 
 /////////////////////////////////////////////////////////////////////
 // public: memory allocator
 
-void init_allocator(void)
+// parse size in bytes with optional K, M or G suffix. returns 0 if invalid.
+size_t parse_heap_size(const char* s)
+{
+	char*  end  = 0;
+	size_t size = s ? strtoul(s, &end, 10) : 0;
+	if(!s || end == s)
+	{
+		return 0;
+	}
+
+	switch(*end)
+	{
+		case 'g': case 'G': size *= 1024;	// fall through
+		case 'm': case 'M': size *= 1024;	// fall through
+		case 'k': case 'K': size *= 1024; end++; break;
+		default: break;
+	}
+	return *end ? 0 : size;
+}
+
+// "copy" or "compact". returns GC_DEFAULT if invalid or not supported by this build.
+gc_mode_t parse_gc_mode(const char* s)
+{
+	if(s && strcmp(s, "copy") == 0)
+	{
+		return GC_COPY;
+	}
+#ifdef HAVE_COMPACT
+	if(s && strcmp(s, "compact") == 0)
+	{
+		return GC_COMPACT;
+	}
+#endif // HAVE_COMPACT
+	return GC_DEFAULT;
+}
+
+gc_order_t parse_gc_order(const char* s)
+{
+	if(s && strcmp(s, "breadth") == 0)
+	{
+		return GC_ORDER_BREADTH;
+	}
+#ifndef INCGC
+	if(s && strcmp(s, "cdr") == 0)
+	{
+		return GC_ORDER_CDR;
+	}
+	if(s && strcmp(s, "depth") == 0)
+	{
+		return GC_ORDER_DEPTH;
+	}
+#endif // INCGC
+	return GC_ORDER_DEFAULT;
+}
+
+// incremental GC copies in breadth order only.
+void set_gc_order(gc_order_t order)
+{
+	if(order == GC_ORDER_DEFAULT)
+	{
+		order = parse_gc_order(getenv("RUDEL_GC_ORDER"));
+	}
+	g_gc_order = order == GC_ORDER_DEFAULT ? GC_ORDER_BREADTH : order;
+}
+
+// GC threads of full copying collection including collecting one.
+// 0 means environment variable or number of processors.
+void set_gc_threads(int n)
+{
+#ifdef PARGC
+	par_set_threads(n);
+#endif // PARGC
+}
+
+// heap_size and max_heap_size are in bytes per semispace, or of whole heap with GC_COMPACT.
+// 0 and GC_DEFAULT mean environment variable or default.
+void init_allocator(size_t heap_size, size_t max_heap_size, gc_mode_t mode)
 {
-	g_memory_pool      = (value_t*)malloc(sizeof(value_t) * INITIAL_ALLOC_SIZE);
+	if(!heap_size)
+	{
+		heap_size = parse_heap_size(getenv("RUDEL_HEAP_SIZE"));
+	}
+	if(!max_heap_size)
+	{
+		max_heap_size = parse_heap_size(getenv("RUDEL_MAX_HEAP_SIZE"));
+	}
+	if(mode == GC_DEFAULT)
+	{
+		mode = parse_gc_mode(getenv("RUDEL_GC"));
+	}
+#ifdef HAVE_COMPACT
+	g_compact = mode == GC_COMPACT;
+#endif // HAVE_COMPACT
+	set_gc_order(GC_ORDER_DEFAULT);
+	set_gc_threads(0);
+
+	s_heap_init_size = heap_size     ? heap_size     / sizeof(value_t) : INITIAL_HEAP_SIZE;
+	g_heap_max_size  = max_heap_size ? max_heap_size / sizeof(value_t) : MAX_HEAP_SIZE;
+	if(s_heap_init_size < MIN_HEAP_SIZE)
+	{
+		s_heap_init_size = MIN_HEAP_SIZE;
+	}
+	if(g_heap_max_size < s_heap_init_size)
+	{
+		g_heap_max_size = s_heap_init_size;
+	}
+	g_pool_size        = g_heap_size = s_heap_init_size;
+#ifdef CONSGC
+	// C stack is between stack pointer and the end at process start
+	extern void* __libc_stack_end;
+	struct rlimit rl;
+	g_stack_base       = (char*)__libc_stack_end;
+	g_stack_size       = getrlimit(RLIMIT_STACK, &rl) == 0 && rl.rlim_cur < C_STACK_MAX ? rl.rlim_cur : C_STACK_MAX;
+	g_root_reg         = -1;
+#endif // CONSGC
+
+	if(getenv("RUDEL_HUGE_PAGES"))
+	{
+		s_huge_pages = true;
+	}
+#ifdef COMPRESSED_REFS
+	init_arena();
+#endif // COMPRESSED_REFS
+	g_memory_pool      = pool_alloc(g_pool_size);
 #ifndef NOGC
-	g_memory_pool_from = (value_t*)malloc(sizeof(value_t) * INITIAL_ALLOC_SIZE);
+	g_memory_pool_from = pool_alloc(g_pool_size);
+	g_from_size        = g_pool_size;
 #endif  // NOGC
+#ifdef HAVE_COMPACT
+	release_from_space();
+#endif // HAVE_COMPACT
 	g_memory_top       = g_memory_pool;
-	g_memory_max       = g_memory_pool + INITIAL_ALLOC_SIZE;
-	g_memory_gc        = g_memory_pool + INITIAL_ALLOC_SIZE / 2;
+	g_memory_max       = g_memory_pool + g_pool_size;
+	g_memory_gc        = g_memory_pool + gc_limit(g_pool_size);
 	g_lock_cnt         = 0;
+#ifdef THREADS
+	attach_thread();
+#endif // THREADS
+#ifdef GENGC
+	g_nursery          = pool_alloc(NURSERY_SIZE);
+	g_nursery_top      = g_nursery;
+	g_nursery_max      = g_nursery + NURSERY_SIZE;
+#endif // GENGC
 }
 
 cons_t* alloc_cons(void)
@@ -444,7 +3029,25 @@ cons_t* alloc_cons(void)
 #ifdef CHECK_GC_SANITY
 	check_sanity();
 #endif // CHECK_GC_SANITY
+	profile_alloc(2);
 
+#ifdef GENGC
+	cons_t* c = (cons_t*)alloc_young(2);
+	if(!c)
+	{
+		return 0;
+	}
+#elif defined(THREADS)
+	if(g_tlab_max - g_tlab_top < 2 || FORCE_GC)
+	{
+		if(!tlab_refill(2))
+		{
+			return 0;
+		}
+	}
+	cons_t* c = (cons_t*)g_tlab_top;
+	g_tlab_top += 2;
+#else  // GENGC
 	cons_t* c = (cons_t*)g_memory_top;
 	g_memory_top += 2;
 
@@ -472,6 +3075,7 @@ cons_t* alloc_cons(void)
 			return 0;
 		}
 	}
+#endif // GENGC
 
 #ifdef DUMP_ALLOC_ADDR
 #if __WORDSIZE == 32
@@ -481,11 +3085,12 @@ cons_t* alloc_cons(void)
 #endif
 #endif	// DUMP_ALLOC_ADDR
 
-#ifdef DEBUG_GC
+	s_self->cons_cnt++;
+#if defined(DEBUG_GC) && !defined(GENGC) && !defined(THREADS)
 	g_memory_top -= 2;
 	check_sanity();
 	g_memory_top += 2;
-#endif // DEBUG_GC
+#endif // DEBUG_GC && !GENGC && !THREADS
 	return c;
 }
 
@@ -494,6 +3099,24 @@ vector_t* alloc_vector()
 #ifdef CHECK_GC_SANITY
 	check_sanity();
 #endif // CHECK_GC_SANITY
+	profile_alloc(4);
+#ifdef GENGC
+	vector_t* v = (vector_t*)alloc_young(4);
+	if(!v)
+	{
+		return 0;
+	}
+#elif defined(THREADS)
+	if(g_tlab_max - g_tlab_top < 4 || FORCE_GC)
+	{
+		if(!tlab_refill(4))
+		{
+			return 0;
+		}
+	}
+	vector_t* v = (vector_t*)g_tlab_top;
+	g_tlab_top += 4;
+#else  // GENGC
 	vector_t* v = (vector_t*)g_memory_top;
 	g_memory_top += 4;
 
@@ -521,6 +3144,7 @@ vector_t* alloc_vector()
 			return 0;
 		}
 	}
+#endif // GENGC
 
 #ifdef DUMP_ALLOC_ADDR
 #if __WORDSIZE == 32
@@ -530,14 +3154,51 @@ vector_t* alloc_vector()
 #endif
 #endif	// DUMP_ALLOC_ADDR
 
-#ifdef CHECK_GC_SANITY
+	s_self->vector_cnt++;
+#if defined(CHECK_GC_SANITY) && !defined(GENGC) && !defined(THREADS)
 	g_memory_top -= 4;
 	check_sanity();
 	g_memory_top += 4;
-#endif // CHECK_GC_SANITY
+#endif // CHECK_GC_SANITY && !GENGC && !THREADS
 	return v;
 }
 
+#ifdef CDRCODE
+// n cdr-coded cells of a run: n cars and cdr of the last, padded to even words.
+// they are nil, and caller fills them before allocating again.
+value_t* alloc_run(size_t n)
+{
+#ifdef CHECK_GC_SANITY
+	check_sanity();
+#endif // CHECK_GC_SANITY
+	assert(n > 0 && n <= CDR_RUN_SIZE);
+	size_t size = (n + 2) & ~1;
+	profile_alloc(size);
+
+	if((g_memory_top + size >= g_memory_gc || FORCE_GC) && g_lock_cnt == 0)
+	{
+		if(!collect(size))
+		{
+			return 0;
+		}
+	}
+	if(g_memory_top + size >= g_memory_max)
+	{
+		return 0;
+	}
+
+	value_t* p    = g_memory_top;
+	g_memory_top += size;
+	for(size_t i = 0; i < size; i++)
+	{
+		p[i] = NIL;
+	}
+
+	s_self->cons_cnt += n;
+	return p;
+}
+#endif // CDRCODE
+
 value_t alloc_vector_data(value_t v, size_t size)
 {
 #ifdef CHECK_GC_SANITY
@@ -548,49 +3209,127 @@ value_t alloc_vector_data(value_t v, size_t size)
 	push_root(&v);
 
 	size = size + (size % 2);	// align
+	profile_alloc(size);
 
-	if((g_memory_top + size >= g_memory_gc || FORCE_GC) && g_lock_cnt == 0)
+	value_t** top = 0;	// 0: large object space
+	if(size >= LOS_THRESHOLD)
 	{
-		if(!exec_gc())
+		if((s_los_alloc + size >= g_pool_size / 2 || FORCE_GC) && g_lock_cnt == 0)
 		{
-			return NIL;
+			collect(0);
+		}
+	}
+	else
+	{
+#ifdef GENGC
+		// vector data lives in the same generation as its header
+		top = &g_nursery_top;
+		if(!is_nursery(v) || g_nursery_top + size > g_nursery_max || FORCE_GC)
+		{
+			if(is_nursery(v) && g_lock_cnt == 0)
+			{
+				exec_minor_gc();	// promote header to old generation
+			}
+
+			top = &g_memory_top;
+			if(g_memory_top + size >= g_memory_gc && g_lock_cnt == 0)
+			{
+				if(!collect(size))
+				{
+					return NIL;
+				}
+			}
+
+			if(g_memory_top + size >= g_memory_max)
+			{
+				return NIL;
+			}
+		}
+#elif defined(THREADS)
+		// size < LOS_THRESHOLD fits in new buffer
+		top = &g_tlab_top;
+		if(!g_tlab_top || (size_t)(g_tlab_max - g_tlab_top) < size || FORCE_GC)
+		{
+			if(!tlab_refill(size))
+			{
+				pop_root(1);
+				return NIL;
+			}
+		}
+#else  // GENGC
+		top = &g_memory_top;
+		if((g_memory_top + size >= g_memory_gc || FORCE_GC) && g_lock_cnt == 0)
+		{
+			if(!collect(size))
+			{
+				return NIL;
+			}
+			else if(g_memory_top + size >= g_memory_max)
+			{
+				return NIL;
+			}
 		}
 		else if(g_memory_top + size >= g_memory_max)
 		{
 			return NIL;
 		}
+#endif // GENGC
+	}
+
+	value_t  av   = AVALUE(v);
+	value_t* old  = VPTROF(VECOF(av)->data);
+	value_t* data = 0;
+	int      init = 0;	// words already initialized
+	if(top)
+	{
+		data  = *top;
+		*top += size;
 	}
-	else if(g_memory_top + size >= g_memory_max)
+	else
 	{
-		return NIL;
+#ifdef THREADS
+		pthread_mutex_lock(&s_los_lock);
+#endif // THREADS
+		if(is_los(old))
+		{
+			data = los_realloc(old, size);	// grow in place, contents are kept
+			init = INTOF(VECOF(av)->alloc);
+			old  = 0;
+		}
+		else
+		{
+			data = los_alloc(size);
+		}
+#ifdef THREADS
+		pthread_mutex_unlock(&s_los_lock);
+#endif // THREADS
 	}
 
-	value_t av = AVALUE(v);
-	if(VPTROF(av.vector->data))
+	if(!data)
 	{
-		for(int i = 0; i < INTOF(av.vector->size); i++)
-			g_memory_top[i] = VPTROF(av.vector->data)[i];
-
-		// must be nillify for GC
-		for(int i = INTOF(av.vector->size); i < size; i++)
-			g_memory_top[i] = NIL;
+		return NIL;
 	}
-	else
+
+	if(old)
 	{
-		// must be nillify for GC
-		for(int i = 0; i < size; i++)
-			g_memory_top[i] = NIL;
+		init = INTOF(VECOF(av)->size);
+		for(int i = 0; i < init; i++)
+			write_barrier(data + i, old[i]);
 	}
 
-	av.vector->data  = RPTR(size ? g_memory_top : 0);
-	av.vector->alloc = RINT(size);
-	g_memory_top += size;
+	// must be nillify for GC
+	for(int i = init; i < size; i++)
+		data[i] = NIL;
+
+	write_barrier(&VECOF(av)->data, RPTR(size ? data : 0));	// header may be frozen
+	VECOF(av)->alloc = RINT(size);
+	s_self->data    += size;
 
 #ifdef DUMP_ALLOC_ADDR
-#if __WORDSIZE == 32
-	fprintf(stderr, "vdat: %08x, size %d\n", ALIGN(av.vector->data), size);
+#if __WORDSIZE == 32 || defined(COMPRESSED_REFS)
+	fprintf(stderr, "vdat: %08x, size %d\n", ALIGN(VECOF(av)->data), size);
 #else
-	fprintf(stderr, "vdat: %016lx, size %ld\n", ALIGN(av.vector->data), size);
+	fprintf(stderr, "vdat: %016lx, size %ld\n", ALIGN(VECOF(av)->data), size);
 #endif
 #endif	// DUMP_ALLOC_ADDR
 
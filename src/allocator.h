@@ -1,10 +1,94 @@
 #ifndef _ALLOCATOR_H_
 #define _ALLOCATOR_H_
 
-#define INITIAL_ALLOC_SIZE	(32 * 1024 * 1024)
-//#define INITIAL_ALLOC_SIZE	(256 * 1024)
-//#define INITIAL_ALLOC_SIZE	(5 * 1024)
+// heap sizes are in words per semispace
+#define INITIAL_HEAP_SIZE	(1024 * 1024)
+#define MAX_HEAP_SIZE		(64 * 1024 * 1024)
+#define MIN_HEAP_SIZE		(4 * 1024)
+#define HEAP_GROW_RATIO		4
+#define HEAP_SHRINK_RATIO	16
+#define LOS_THRESHOLD		(4 * 1024)	// vector data in words to be placed in large object space
+#define LOS_INITIAL_SIZE	64
 #define ROOT_SIZE		1024
+#define REMSET_INITIAL_SIZE	1024
+#ifdef GENGC
+#define NURSERY_SIZE		(1024 * 1024)
+#endif // GENGC
+#ifdef INCGC
+#ifdef GENGC
+#error "INCGC and GENGC are exclusive"
+#endif // GENGC
+#define INCGC_STEP		(4 * 1024)	// words allocated between incremental steps
+#define INCGC_PAUSE_BUDGET	1000		// default pause budget in usec
+#endif // INCGC
+#ifdef CONSGC
+#if defined(GENGC) || defined(INCGC)
+#error "CONSGC is exclusive with GENGC and INCGC"
+#endif // GENGC || INCGC
+#define C_STACK_MAX		(256 * 1024 * 1024)	// bytes of C stack at most, when not limited
+#endif // CONSGC
+#ifdef THREADS
+#if defined(GENGC) || defined(INCGC) || defined(CONSGC)
+#error "THREADS is exclusive with GENGC, INCGC and CONSGC"
+#endif // GENGC || INCGC || CONSGC
+#define TLAB_SIZE		(8 * 1024)	// words of thread local allocation buffer
+#define TLS			__thread
+#else  // THREADS
+#define TLS
+#endif // THREADS
+#ifdef PARGC
+#if defined(GENGC) || defined(INCGC) || defined(CONSGC)
+#error "PARGC is exclusive with GENGC, INCGC and CONSGC"
+#endif // GENGC || INCGC || CONSGC
+#define PARGC_MAX_THREADS	64
+#define PARGC_LAB_SIZE		(2 * 1024)	// words of to-space block each GC thread copies into
+#define PARGC_ROOT_CHUNK	256		// root slots claimed at once
+#define PARGC_SHARE_SIZE	64		// least unscanned words of block given to idle threads
+#ifndef PARGC_MIN_WORDS
+#define PARGC_MIN_WORDS		(256 * 1024)	// smaller heaps are collected by one thread
+#endif // PARGC_MIN_WORDS
+#endif // PARGC
+#define HUGE_PAGE_SIZE		(2 * 1024 * 1024)	// bytes, semispaces are aligned to it with huge pages
+#ifdef COMPRESSED_REFS
+#define ARENA_SIZE		(4UL * 1024 * 1024 * 1024)	// bytes of address space for heap
+#define ARENA_RANGE_SIZE	64		// initial free ranges of arena
+#endif // COMPRESSED_REFS
+#define DISCARD_INTERVAL	(1000 * 1000)	// usec between collections to give back emptied pages
+#if defined(COMPRESSED_REFS)
+#define CORE_BASE		0x40000000UL		// core image is linked at this offset in arena
+#elif __WORDSIZE == 32
+#define CORE_BASE		0x60000000UL		// core image is linked at this address
+#else
+#define CORE_BASE		0x100000000000UL	// core image is linked at this address
+#endif
+#define CORE_MAGIC		"\177RUDCORE"	// first bytes of core image
+#define CORE_VERSION		7		// bump when layout of objects, VM instructions or builtins change
+#define CORE_HEADER_SIZE	4096		// bytes before heap in core image: heap is page aligned in file
+#define CORE_CHUNK_SIZE		(64 * 1024)	// words translated and written at once
+#define PAUSE_HIST_SIZE		32		// log2 buckets of pause time in usec
+#define SCAN_BLOCK_SIZE		64		// words of to-space block scanned first in depth order
+#if !defined(NOGC) && !defined(GENGC) && !defined(INCGC) && !defined(CONSGC)
+#define HAVE_COMPACT				// mark-compact collector is selectable at startup
+#endif // !NOGC && !GENGC && !INCGC && !CONSGC
+#if !defined(NOGC) && !defined(CONSGC)
+#define HAVE_IMMORTAL				// live objects can be frozen into non-moving region
+#endif // !NOGC && !CONSGC
+
+typedef enum
+{
+	GC_DEFAULT = 0,		// environment variable or copying
+	GC_COPY,		// semispace copying
+	GC_COMPACT,		// sliding mark-compact, no from-space
+} gc_mode_t;
+
+// order of objects copied by copying collector. compaction keeps address order.
+typedef enum
+{
+	GC_ORDER_DEFAULT = 0,	// environment variable or breadth
+	GC_ORDER_BREADTH,	// Cheney scan: breadth-first
+	GC_ORDER_CDR,		// cdr chain of copied cons is copied right after it
+	GC_ORDER_DEPTH,		// cdr chaining and approximately depth-first scan (Moon)
+} gc_order_t;
 
 #ifdef DEBUG_GC
 #define FORCE_GC 1
@@ -12,6 +96,28 @@
 #define FORCE_GC 0
 #endif // DEBUG_GC
 
+// GC and allocator statistics since start up. sizes are in bytes, times in usec.
+typedef struct
+{
+	long	collections;		// full collections (completed cycles with INCGC)
+	long	minor_collections;	// nursery collections (GENGC)
+	long	pauses;			// stop-the-world pauses including incremental steps
+	size_t	cons_bytes;		// allocated cons cells
+	size_t	vector_bytes;		// allocated vector headers
+	size_t	vector_data_bytes;	// allocated vector data including large objects
+	size_t	copied_bytes;		// copied by collector
+	size_t	survivor_bytes;		// live after last full collection
+	long	pause_last;
+	long	pause_total;
+	long	pause_max;
+	size_t	heap_bytes;		// in use now
+	size_t	heap_peak_bytes;	// in use at most, sampled on allocation slow path
+	size_t	heap_size_bytes;	// semispace size
+	size_t	immortal_bytes;		// frozen objects, not collected
+	long	weak_cleared;		// weak references cleared by collector
+	size_t	rss_bytes;		// resident set size of process, 0 if unknown
+} gc_stats_t;
+
 EXTERN value_t* g_memory_pool;
 #ifndef NOGC
 EXTERN value_t* g_memory_pool_from;
@@ -19,11 +125,67 @@ EXTERN value_t* g_memory_pool_from;
 EXTERN value_t* g_memory_top;
 EXTERN value_t* g_memory_max;
 EXTERN value_t* g_memory_gc;
-EXTERN int	g_lock_cnt;
+#ifdef HAVE_IMMORTAL
+EXTERN value_t* g_immortal;		// frozen objects: not moved, scanned only via remembered set
+EXTERN value_t* g_immortal_max;
+#endif // HAVE_IMMORTAL
+EXTERN TLS int	g_lock_cnt;
+#ifdef THREADS
+EXTERN TLS value_t* g_tlab_top;		// thread local allocation buffer carved from heap
+EXTERN TLS value_t* g_tlab_max;
+EXTERN int	g_safepoint;		// stop-the-world is requested
+#endif // THREADS
+#ifdef GENGC
+EXTERN value_t* g_nursery;
+EXTERN value_t* g_nursery_top;
+EXTERN value_t* g_nursery_max;
+#endif // GENGC
+#ifdef INCGC
+EXTERN value_t* g_incgc_from;		// used from-space while a cycle is running, otherwise empty
+EXTERN value_t* g_incgc_from_max;
+#endif // INCGC
+#ifdef CONSGC
+EXTERN char*	g_stack_base;		// C stack is scanned conservatively from here
+EXTERN size_t	g_stack_size;
+EXTERN int	g_root_depth;		// pushed roots including locals on C stack
+EXTERN int	g_root_reg;		// depth of last registered root, -1 if none
+#endif // CONSGC
+
+#ifdef CONSGC
+void		push_root_reg		(value_t* v);
+void		pop_root_reg		(void);
+
+static inline bool is_c_stack(void* p)
+{
+	return (uintptr_t)g_stack_base - (uintptr_t)p < g_stack_size;
+}
 
+// locals on C stack are found by stack scan and pinned: they are only counted.
+static inline void push_root(value_t* v)
+{
+	if(is_c_stack(v))
+	{
+		g_root_depth++;
+	}
+	else
+	{
+		push_root_reg(v);
+	}
+}
+
+static inline void pop_root(int n)
+{
+	g_root_depth -= n;
+	if(g_root_reg >= g_root_depth)
+	{
+		pop_root_reg();
+	}
+}
+#else  // CONSGC
 void		push_root		(value_t* v);
-void		push_root_raw_vec	(value_t *v, int* sp);
 void		pop_root		(int n);
+#endif // CONSGC
+void		push_root_raw_vec	(value_t *v, int* sp);
 value_t*	exec_gc			(void);
 void		force_gc		(void);
 INLINE(value_t*	check_gc(void),		(g_memory_top >= g_memory_gc || FORCE_GC) && g_lock_cnt == 0 ?  exec_gc() : 0)
@@ -31,13 +193,124 @@ INLINE(int	lock_gc(void),		g_lock_cnt++)
 INLINE(int	unlock_gc(void),	g_lock_cnt--)
 bool		check_lock		(void);
 bool		check_sanity		(void);
+void		set_huge_pages		(bool on);
+void		set_gc_pause_budget	(long usec);
+void		print_gc_pauses		(FILE* fp);
+void		get_gc_stats		(gc_stats_t* stats);
+value_t		freeze_heap		(void);
+
+#ifdef THREADS
+void		attach_thread		(void);
+void		detach_thread		(void);
+void		park_thread		(void);
+void		enter_blocking		(void);
+void		leave_blocking		(void);
+
+// threads stop here while other thread collects. heap values may move.
+static inline void safepoint(void)
+{
+	if(__atomic_load_n(&g_safepoint, __ATOMIC_ACQUIRE) && g_lock_cnt == 0)
+	{
+		park_thread();
+	}
+}
+#else  // THREADS
+static inline void safepoint(void)	{ }
+static inline void enter_blocking(void)	{ }
+static inline void leave_blocking(void)	{ }
+#endif // THREADS
+
+#ifdef GENGC
+int		gc_remember		(value_t* slot);
+
+static inline bool is_nursery_addr(value_t* p)
+{
+	return p >= g_nursery && p < g_nursery_max;
+}
+
+static inline bool is_nursery(value_t v)
+{
+	return is_nursery_addr(VPTROF(v));
+}
+#endif // GENGC
+
+#ifdef INCGC
+value_t		incgc_forward		(value_t* slot);
+
+static inline bool is_incgc_from(value_t v)
+{
+	value_t* p = VPTROF(v);
+	return p >= g_incgc_from && p < g_incgc_from_max;
+}
+#endif // INCGC
+
+#ifdef HAVE_IMMORTAL
+void		gc_remember_immortal	(value_t* slot);
+
+static inline bool is_immortal_addr(value_t* p)
+{
+	return p >= g_immortal && p < g_immortal_max;
+}
+
+static inline bool is_immortal(value_t v)
+{
+	return is_immortal_addr(VPTROF(v));
+}
+#endif // HAVE_IMMORTAL
+
+// every load of a heap slot goes through read_barrier: in incremental mode
+// from-space objects are copied before the mutator sees them (Baker).
+static inline value_t read_barrier(value_t* slot)
+{
+#ifdef INCGC
+	if(rtypeof(*slot) < OTH_T && is_incgc_from(*slot))
+	{
+		return incgc_forward(slot);
+	}
+#endif // INCGC
+	return *slot;
+}
+
+// every store of a value into an existing heap slot goes through write_barrier:
+// in generational mode it records old-to-young pointers in the remembered set,
+// and frozen slots pointing out of immortal region are recorded in theirs.
+// slot is compared as address: it may be out of heap arena.
+static inline value_t write_barrier(value_t* slot, value_t v)
+{
+#ifdef HAVE_IMMORTAL
+	if(is_immortal_addr(slot) && rtypeof(v) < OTH_T && AVALUE(v).raw != 0 && !is_immortal(v))
+	{
+		gc_remember_immortal(slot);
+	}
+#endif // HAVE_IMMORTAL
+#ifdef GENGC
+	if(rtypeof(v) < OTH_T && is_nursery(v) && !is_nursery_addr(slot))
+	{
+		gc_remember(slot);
+	}
+#endif // GENGC
+	return *slot = v;
+}
 
-value_t		save_core		(value_t fn, value_t env);
-value_t		load_core		(const char* fn);
+value_t		save_core		(value_t fn, value_t env, value_t entry);
+value_t		load_core		(const char* fn, bool immortal, value_t* entry);
+value_t		load_boot_core		(bool immortal, value_t* entry);
+value_t		fork_core		(void);
+void		exit_core		(value_t r) __attribute__((noreturn));
+value_t		wait_core		(bool block);
+void		set_pack_core		(bool on);
 
-void		init_allocator		(void);
+size_t		parse_heap_size		(const char* s);
+gc_mode_t	parse_gc_mode		(const char* s);
+gc_order_t	parse_gc_order		(const char* s);
+void		set_gc_order		(gc_order_t order);
+void		set_gc_threads		(int n);
+void		init_allocator		(size_t heap_size, size_t max_heap_size, gc_mode_t mode);
 cons_t*		alloc_cons		(void);
 vector_t*	alloc_vector		(void);
 value_t		alloc_vector_data	(value_t v, size_t size);
+#ifdef CDRCODE
+value_t*	alloc_run		(size_t n);
+#endif // CDRCODE
 
 #endif // _ALLOCATOR_H_
@@ -81,6 +81,30 @@ typedef enum {
 	IS_REVERSE,
 	IS_MAKE_PACKAGE,
 	IS_FIND_PACKAGE,
+	IS_GC_STATS,
+	IS_FREEZE_HEAP,
+	IS_GC,
+	IS_MAKE_WEAK_POINTER,
+	IS_WEAK_POINTER_VALUE,
+	IS_MAKE_WEAK_TABLE,
+	IS_WEAK_GET,
+	IS_WEAK_PUT,
+	IS_WEAK_COUNT,
+	IS_SNAPSHOT_CORE,
+	IS_SNAPSHOT_WAIT,
+	IS_ADD_IMM,
+	IS_SUB_IMM,
+	IS_EQ_BNIL,
+	IS_LT_BNIL,
+	IS_ELT_BNIL,
+	IS_MT_BNIL,
+	IS_EMT_BNIL,
+	IS_DUP_MACROP_BNIL,
+	IS_BIND_ARG,
+	IS_ARG_END,
+	IS_TAP,
+	IS_DELETE_FILE,
+	IS_COMPILEDP,
 } vmis_t;
 
 typedef struct
@@ -25,34 +25,76 @@ static inline bool is_cons_pair_or_nil(value_t x)
 	return (rtypeof(x) >= CONS_T && rtypeof(x) <= ERR_T) || nilp(x);
 }
 
+#ifdef CDRCODE
+// append run of n nil cells to list at *head whose last run is *tail. they are roots.
+static value_t add_run(value_t* head, value_t* tail, size_t n)
+{
+	value_t* p = alloc_run(n);
+	if(!p)
+	{
+		return rerr_alloc();
+	}
+
+	value_t r = CDR_RUN(p, n);
+	if(nilp(*head))
+	{
+		*head = r;
+	}
+	else
+	{
+		VPTROF(*tail)[CDR_COUNT(*tail) + 1] = r;	// cdr of last cell
+	}
+	*tail = r;
+	return r;
+}
+
+// cons cells of x up to n.
+static size_t count_cells(value_t x, size_t n)
+{
+	size_t i = 0;
+	for(; i < n && is_cons_pair(x) && !nilp(x); x = cdr(x))
+	{
+		i++;
+	}
+	return i;
+}
+#endif // CDRCODE
+
 /////////////////////////////////////////////////////////////////////
 // public: typical lisp functions
 
 value_t car(value_t x)
 {
 	assert(is_cons_pair_or_nil(x));
+#ifdef CDRCODE
+	return ALIGN(x) ? UNSAFE_CAR(x) : NIL;
+#else  // CDRCODE
 	x = AVALUE(x);
-	return x.raw ? x.cons->car : NIL;
+	return x.raw ? read_barrier(&CONSOF(x)->car) : NIL;
+#endif // CDRCODE
 }
 
 value_t cdr(value_t x)
 {
 	assert(is_cons_pair_or_nil(x));
+#ifdef CDRCODE
+	return ALIGN(x) ? UNSAFE_CDR(x) : NIL;
+#else  // CDRCODE
 	x = AVALUE(x);
-	return x.raw ? x.cons->cdr : NIL;
+	return x.raw ? read_barrier(&CONSOF(x)->cdr) : NIL;
+#endif // CDRCODE
 }
 
 value_t	cons(value_t car, value_t cdr)
 {
 	push_root(&car);
 	push_root(&cdr);
-	value_t	r	= { 0 };
-	r.cons		= alloc_cons();
+	value_t	r	= RPTR(alloc_cons());
 	pop_root(2);
-	if(r.cons)
+	if(r.raw)
 	{
-		r.cons->car	= car;
-		r.cons->cdr	= cdr;
+		CONSOF(r)->car	= car;
+		CONSOF(r)->cdr	= cdr;
 		r.type.main	= CONS_T;
 		return r;
 	}
@@ -111,7 +153,7 @@ value_t rplaca(value_t x, value_t v)
 {
 	assert(is_cons_pair(x));
 
-	AVALUE(x).cons->car = v;
+	write_barrier(&CELLOF(x)->car, v);
 	return x;
 }
 
@@ -119,7 +161,30 @@ value_t rplacd(value_t x, value_t v)
 {
 	assert(is_cons_pair(x));
 
-	AVALUE(x).cons->cdr = v;
+#ifdef CDRCODE
+	if(CDR_COUNT(x) && !is_indirect(CONSOF(AVALUE(x))->car))
+	{
+		// cdr of the cell is next cell: move the cell to an ordinary cons
+		push_root(&x);
+		push_root(&v);
+		value_t c = cons(NIL, v);
+		pop_root(2);
+
+		if(CDR_COUNT(x) && !is_indirect(CONSOF(AVALUE(x))->car))	// GC may have made it last cell
+		{
+			if(errp(c))
+			{
+				return c;
+			}
+			cons_t* cell = CONSOF(AVALUE(x));
+			CONSOF(AVALUE(c))->car = cell->car;
+			c.raw |= CDR_INDIRECT;
+			write_barrier(&cell->car, c);
+			return x;
+		}
+	}
+#endif // CDRCODE
+	write_barrier(&CELLOF(x)->cdr, v);
 	return x;
 }
 
@@ -192,6 +257,27 @@ value_t list(int n, ...)
 	int num = n - 1;
 	push_root_raw_vec(args, &num);
 
+#ifdef CDRCODE
+	value_t    r = NIL;
+	value_t tail = NIL;
+	push_root(&r);
+	push_root(&tail);
+
+	for(int i = 0; i < n; i += CDR_RUN_SIZE)
+	{
+		int     k   = MIN(n - i, CDR_RUN_SIZE);
+		value_t run = add_run(&r, &tail, k);
+		if(errp(run))
+		{
+			r = run;
+			break;
+		}
+		memcpy(VPTROF(run), args + i, sizeof(value_t) * k);
+	}
+
+	pop_root(3);
+	return r;
+#else  // CDRCODE
 	value_t    r = cons(NIL, NIL);
 	value_t  cur = r;
 	push_root(&r);
@@ -204,6 +290,7 @@ value_t list(int n, ...)
 
 	pop_root(3);
 	return cdr(r);
+#endif // CDRCODE
 }
 
 value_t find(value_t key, value_t list, bool (*test)(value_t, value_t))
@@ -259,6 +346,26 @@ value_t reverse(value_t x)
 		value_t r = NIL;
 		push_root(&x);
 		push_root(&r);
+#ifdef CDRCODE
+		// first cells of x make last run of result
+		while(!nilp(x))
+		{
+			size_t   n = count_cells(x, CDR_RUN_SIZE);
+			value_t* p = n ? alloc_run(n) : 0;
+			if(!p)
+			{
+				r = n ? rerr_alloc() : rerr(RINT(ERR_TYPE), NIL);
+				break;
+			}
+
+			for(size_t i = 0; i < n; i++, x = cdr(x))
+			{
+				p[n - 1 - i] = car(x);
+			}
+			p[n] = r;
+			r    = CDR_RUN(p, n);
+		}
+#else  // CDRCODE
 		for(; !nilp(x); x = cdr(x))
 		{
 			if(consp(x))
@@ -271,6 +378,7 @@ value_t reverse(value_t x)
 				break;
 			}
 		}
+#endif // CDRCODE
 
 		pop_root(2);
 		return r;
@@ -280,6 +388,31 @@ value_t reverse(value_t x)
 value_t copy_list(value_t lst)
 {
 	push_root(&lst);
+#ifdef CDRCODE
+	value_t r    = NIL;
+	value_t tail = NIL;
+	push_root(&r);
+	push_root(&tail);
+
+	rtype_t t = rtypeof(lst);
+
+	while(!nilp(lst))
+	{
+		size_t  n   = count_cells(lst, CDR_RUN_SIZE);
+		value_t run = n ? add_run(&r, &tail, n) : rerr(RINT(ERR_TYPE), NIL);
+		if(errp(run))
+		{
+			pop_root(3);
+			return run;
+		}
+
+		value_t* p = VPTROF(run);
+		for(size_t i = 0; i < n; i++, lst = cdr(lst))
+		{
+			p[i] = car(lst);
+		}
+	}
+#else  // CDRCODE
 	value_t r   = cons(NIL, NIL);
 	value_t cur = r;
 	push_root(&r);
@@ -293,12 +426,37 @@ value_t copy_list(value_t lst)
 	}
 
 	r = cdr(r);
+#endif // CDRCODE
 	r.type.main = t;
 
 	pop_root(3);
 	return r;
 }
 
+#ifdef CDRCODE
+// list of n nils, filled by caller.
+value_t make_list(size_t n)
+{
+	value_t    r = NIL;
+	value_t tail = NIL;
+	push_root(&r);
+	push_root(&tail);
+
+	for(size_t i = 0; i < n; i += CDR_RUN_SIZE)
+	{
+		value_t run = add_run(&r, &tail, MIN(n - i, CDR_RUN_SIZE));
+		if(errp(run))
+		{
+			r = run;
+			break;
+		}
+	}
+
+	pop_root(2);
+	return r;
+}
+#endif // CDRCODE
+
 value_t getf(value_t key, value_t def, value_t plist)
 {
 	assert(symbolp(key));
@@ -430,11 +588,9 @@ value_t init(value_t pkg)
 	return env;
 }
 
-void rep_file(char* fn, value_t env)
+// set terminate-catcher of env. gc must be locked.
+static void set_root_catcher(value_t env)
 {
-	lock_gc();
-
-	// build terminate-catcher code
 	value_t str = str_to_rstr("exception caches at root: ");
 	value_t catch = make_vector(7);
 	vpush(ROP (IS_PUSH),		catch);
@@ -445,6 +601,14 @@ void rep_file(char* fn, value_t env)
 
 	value_t clojure = cloj(NIL, NIL, cons(catch, catch), NIL, NIL);
 	set_env(g_exception_stack, cons(clojure, NIL), env);
+}
+
+void rep_file(char* fn, value_t env)
+{
+	lock_gc();
+
+	// build terminate-catcher code
+	set_root_catcher(env);
 
 	// build rep code
 	value_t rfn   = str_to_rstr(fn);
@@ -483,20 +647,40 @@ void rep_file(char* fn, value_t env)
 	exec_vm(cd, env);
 }
 
+// apply entry clojure of core image to no argument.
+void run_entry(value_t entry, value_t env)
+{
+	lock_gc();
+	set_root_catcher(env);
+
+	value_t code = make_vector(5);
+	vpush(ROP (IS_PUSH),		code);
+	vpush(RINT(0),			code);
+	vpush(ROP (IS_PUSHR),		code);
+	vpush(entry,			code);
+	vpush(ROP (IS_AP),		code);
+	vpush(ROP (IS_HALT),		code);
+
+	value_t cd = cons(code, code);
+
+	unlock_gc();
+
+	exec_vm(cd, env);
+}
+
 /////////////////////////////////////////////////////////////////////
 // public: vector support
 
 value_t make_vector(unsigned n)
 {
-	value_t v = { 0 };
-	v.vector  = alloc_vector();
+	value_t v = RPTR(alloc_vector());
 
-	if(v.vector)
+	if(v.raw)
 	{
-		v.vector->size  = RINT(0);
-		v.vector->alloc = RINT(0);
-		v.vector->type  = NIL;
-		v.vector->data  = RPTR(0);
+		VECOF(v)->size  = RINT(0);
+		VECOF(v)->alloc = RINT(0);
+		VECOF(v)->type  = NIL;
+		VECOF(v)->data  = RPTR(0);
 		v.type.main     = VEC_T;
 		v = alloc_vector_data(v, n);
 		return v;
@@ -513,9 +697,9 @@ value_t vref(value_t v, unsigned pos)
 	assert(vsize(v) <= vallocsize(v));
 	v = AVALUE(v);
 
-	if(pos < INTOF(v.vector->size))
+	if(pos < INTOF(VECOF(v)->size))
 	{
-		return VPTROF(v.vector->data)[pos];
+		return read_barrier(VPTROF(VECOF(v)->data) + pos);
 	}
 	else
 	{
@@ -535,7 +719,7 @@ value_t rplacv(value_t v, unsigned pos, value_t data)
 		vresize(v, pos + 1);
 	}
 
-	VPTROF(AVALUE(v).vector->data)[pos] = data;
+	write_barrier(VPTROF(VECOF(AVALUE(v))->data) + pos, data);
 
 	pop_root(2);
 	return data;
@@ -545,30 +729,30 @@ int vsize(value_t v)
 {
 	assert(vectorp(v));
 	v = AVALUE(v);
-	assert(INTOF(v.vector->size) <= INTOF(v.vector->alloc));
-	return INTOF(v.vector->size);
+	assert(INTOF(VECOF(v)->size) <= INTOF(VECOF(v)->alloc));
+	return INTOF(VECOF(v)->size);
 }
 
 int vallocsize(value_t v)
 {
 	assert(vectorp(v));
 	v = AVALUE(v);
-	assert(INTOF(v.vector->size) <= INTOF(v.vector->alloc));
-	return INTOF(v.vector->alloc);
+	assert(INTOF(VECOF(v)->size) <= INTOF(VECOF(v)->alloc));
+	return INTOF(VECOF(v)->alloc);
 }
 
 value_t vtype(value_t v)
 {
 	assert(vectorp(v));
 	assert(vsize(v) <= vallocsize(v));
-	return AVALUE(v).vector->type;
+	return VECOF(AVALUE(v))->type;
 }
 
 value_t* vdata(value_t v)
 {
 	assert(vectorp(v));
 	assert(vsize(v) <= vallocsize(v));
-	return VPTROF(AVALUE(v).vector->data);
+	return VPTROF(VECOF(AVALUE(v))->data);
 }
 
 value_t vresize(value_t v, int n)
@@ -583,7 +767,7 @@ value_t vresize(value_t v, int n)
 	else
 	{
 		// resize allocated area
-		if(INTOF(va.vector->alloc) < n)
+		if(INTOF(VECOF(va)->alloc) < n)
 		{
 			int new_alloc;
 			for(new_alloc = 1; new_alloc < n; new_alloc *= 2);
@@ -596,7 +780,7 @@ value_t vresize(value_t v, int n)
 		}
 
 		// change size
-		va.vector->size = RINT(n);
+		VECOF(va)->size = RINT(n);
 	}
 
 	return v;
@@ -791,12 +975,163 @@ value_t subvec(value_t v, int begin, int end)
 	return r;
 }
 
+/////////////////////////////////////////////////////////////////////
+// public: weak reference support
+//
+// weak pointer and weak-key table are vectors typed in their headers. GC sets
+// slots of collected referents to nil: free entries of table have nil key.
+
+static value_t make_weak_vector(unsigned n, int type)
+{
+	value_t r = make_vector(n);
+	if(vectorp(r))
+	{
+		VECOF(AVALUE(r))->type = RINT(type);
+		return r;
+	}
+	else
+	{
+		return rerr_alloc();
+	}
+}
+
+// index of key in table, or -1.
+static int weak_find(value_t table, value_t key)
+{
+	for(int i = 0; i + 1 < vsize(table); i += 2)
+	{
+		if(EQ(vref(table, i), key))
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+value_t make_weak_pointer(value_t x)
+{
+	push_root(&x);
+	value_t r = make_weak_vector(1, VT_WEAK);
+	if(vectorp(r))
+	{
+		rplacv(r, 0, x);
+	}
+	pop_root(1);
+	return r;
+}
+
+// referent, or nil if it is collected.
+value_t weak_pointer_value(value_t w)
+{
+	assert(weak_pointer_p(w));
+	return vref(w, 0);
+}
+
+bool weak_pointer_p(value_t x)
+{
+	return vectorp(x) && EQ(vtype(x), RINT(VT_WEAK));
+}
+
+value_t make_weak_table(void)
+{
+	return make_weak_vector(0, VT_WEAK_KEY);
+}
+
+bool weak_table_p(value_t x)
+{
+	return vectorp(x) && EQ(vtype(x), RINT(VT_WEAK_KEY));
+}
+
+// value of key compared by eq, or nil if not found.
+value_t weak_get(value_t table, value_t key)
+{
+	assert(weak_table_p(table));
+	int i = nilp(key) ? -1 : weak_find(table, key);
+	return i < 0 ? NIL : vref(table, i + 1);
+}
+
+// nil can't be a key: it marks free entries.
+value_t weak_put(value_t table, value_t key, value_t value)
+{
+	assert(weak_table_p(table));
+	if(nilp(key))
+	{
+		return RERR(ERR_ARG, NIL);
+	}
+
+	int i = weak_find(table, key);
+	if(i < 0)
+	{
+		i = weak_find(table, NIL);	// reuse entry cleared by GC
+	}
+
+	push_root(&table);
+	push_root(&key);
+	push_root(&value);
+	if(i < 0)
+	{
+		i = vsize(table);
+		if(errp(vresize(table, i + 2)))
+		{
+			pop_root(3);
+			return rerr_alloc();
+		}
+	}
+	rplacv(table, i,     key);
+	rplacv(table, i + 1, value);
+
+	pop_root(3);
+	return value;
+}
+
+// entries whose keys are not collected yet.
+int weak_count(value_t table)
+{
+	assert(weak_table_p(table));
+	int n = 0;
+	for(int i = 0; i + 1 < vsize(table); i += 2)
+	{
+		if(!nilp(vref(table, i)))
+		{
+			n++;
+		}
+	}
+	return n;
+}
+
 /////////////////////////////////////////////////////////////////////
 // public: bridge functions from C to LISP
 
 value_t str_to_cons	(const char* s)
 {
 	assert(s != NULL);
+#ifdef CDRCODE
+	value_t    r = NIL;
+	value_t tail = NIL;
+	push_root(&r);
+	push_root(&tail);
+
+	for(size_t len = strlen(s); len > 0; )
+	{
+		size_t  n   = MIN(len, CDR_RUN_SIZE);
+		value_t run = add_run(&r, &tail, n);
+		if(errp(run))
+		{
+			r = run;
+			break;
+		}
+
+		value_t* p = VPTROF(run);
+		for(size_t i = 0; i < n; i++)
+		{
+			p[i] = RINT(*s++);
+		}
+		len -= n;
+	}
+
+	pop_root(2);
+	return r;
+#else  // CDRCODE
 	value_t    r = cons(NIL, NIL);
 	value_t  cur = r;
 	push_root(&r);
@@ -811,6 +1146,7 @@ value_t str_to_cons	(const char* s)
 	pop_root(2);
 
 	return cdr(r);
+#endif // CDRCODE
 }
 
 value_t str_to_vec	(const char* s)
@@ -1029,6 +1365,45 @@ value_t gensym	(value_t env)
 	return r;	// gensym symbol is unregisterd: so same name doesn't cause eq.
 }
 
+// property list of GC and allocator statistics keyed by keywords.
+value_t gc_stats(void)
+{
+	gc_stats_t st;
+	get_gc_stats(&st);
+
+	struct { const char* key; int64_t val; } tbl[] = {
+		{ "collections",	st.collections		},
+		{ "minor-collections",	st.minor_collections	},
+		{ "pauses",		st.pauses		},
+		{ "cons-bytes",		st.cons_bytes		},
+		{ "vector-bytes",	st.vector_bytes		},
+		{ "vector-data-bytes",	st.vector_data_bytes	},
+		{ "copied-bytes",	st.copied_bytes		},
+		{ "survivor-bytes",	st.survivor_bytes	},
+		{ "pause-last",		st.pause_last		},
+		{ "pause-total",	st.pause_total		},
+		{ "pause-max",		st.pause_max		},
+		{ "heap-bytes",		st.heap_bytes		},
+		{ "heap-peak-bytes",	st.heap_peak_bytes	},
+		{ "heap-size-bytes",	st.heap_size_bytes	},
+		{ "immortal-bytes",	st.immortal_bytes	},
+		{ "weak-cleared",	st.weak_cleared		},
+		{ "rss-bytes",		st.rss_bytes		},
+	};
+
+	value_t r = NIL;
+	push_root(&r);
+	for(int i = sizeof(tbl) / sizeof(tbl[0]) - 1; i >= 0; i--)
+	{
+		r         = cons(RINT(tbl[i].val < RINT_MAX ? tbl[i].val : RINT_MAX), r);	// saturated
+		value_t k = intern(tbl[i].key, find_package(NIL));
+		r         = cons(k, r);
+	}
+
+	pop_root(1);
+	return r;
+}
+
 /////////////////////////////////////////////////////////////////////
 // public: support functions writing LISP on C
 bool is_str(value_t v)
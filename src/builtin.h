@@ -45,7 +45,23 @@ typedef enum {
 	SP_KEY,
 } special_t;
 
-#if __WORDSIZE == 32
+// COMPRESSED_REFS: 64-bit process with 32-bit values. heap references are
+// offsets from g_heap_base, and every heap object is in the 4GB arena there.
+#if defined(COMPRESSED_REFS) && __WORDSIZE == 32
+#error "COMPRESSED_REFS is for 64-bit build"
+#endif // COMPRESSED_REFS && __WORDSIZE == 32
+
+// CDRCODE: lists made at once are runs of contiguous cars. count of cells
+// after a cell in its run is kept in unused high bits of pointers to it.
+#ifdef CDRCODE
+#if __WORDSIZE == 32 || defined(COMPRESSED_REFS)
+#error "CDRCODE is for 64-bit build without COMPRESSED_REFS"
+#endif // __WORDSIZE == 32 || COMPRESSED_REFS
+#if defined(GENGC) || defined(INCGC) || defined(CONSGC) || defined(THREADS) || defined(PARGC)
+#error "CDRCODE is exclusive with GENGC, INCGC, CONSGC, THREADS and PARGC"
+#endif // GENGC || INCGC || CONSGC || THREADS || PARGC
+#endif // CDRCODE
+#if __WORDSIZE == 32 || defined(COMPRESSED_REFS)
 typedef struct
 {
 	uint32_t	main:   3;
@@ -98,11 +114,13 @@ struct _vector_t;
 typedef union _value_t
 {
 	type_t			type;
-	struct _cons_t*		cons;
-	struct _vector_t*	vector;
 	ref_t			ref;
 	opcode_t		op;
+#ifdef COMPRESSED_REFS
+	uint32_t		raw;
+#else  // COMPRESSED_REFS
 	uintptr_t		raw;
+#endif // COMPRESSED_REFS
 } value_t;
 
 
@@ -120,17 +138,41 @@ typedef struct _vector_t
 	value_t		data;
 } vector_t;
 
+#ifdef COMPRESSED_REFS
+// arena is aligned to 4GB: a reference is low 32 bits of address, and
+// reference 0 maps to first page of arena which is never accessible.
+// VPTROF keeps 0 as null pointer, CONSOF and VECOF are for objects.
+EXTERN char* g_heap_base;
+#define PTR_RAW(P)   ((uint32_t)(uintptr_t)(P))
+#define RAW_PTR(R)   ((void*)(g_heap_base + (R)))
+INLINE(value_t* raw_ptr_or_null(uint32_t r), r ? (value_t*)RAW_PTR(r) : 0)
+#else  // COMPRESSED_REFS
+#define PTR_RAW(P)   ((uintptr_t)(P))
+#define RAW_PTR(R)   ((void*)(R))
+#endif // COMPRESSED_REFS
+
 #define NIL          ((value_t){ .type.main   = CONS_T, .type.sub = 0,         .type.val   = 0 })
-#define RPTR(X)      ((value_t){ .raw = PTR_T | (uintptr_t)(X) })
+#define RPTR(X)      ((value_t){ .raw = PTR_T | PTR_RAW(X) })
 
-#if __WORDSIZE == 32
+#if __WORDSIZE == 32 || defined(COMPRESSED_REFS)
 	#define ALIGN(X)    ((X).raw & 0xfffffff8)
+	#define RINT_MAX    0x7fffff		// largest integer in a value
+#elif defined(CDRCODE)
+	#define ALIGN(X)    ((X).raw & 0x0000fffffffffff8)
+	#define RINT_MAX    0x7fffffffffffffL
 #else
 	#define ALIGN(X)    ((X).raw & 0xfffffffffffffff8)
+	#define RINT_MAX    0x7fffffffffffffL
 #endif
 
 #define AVALUE(X)    ((value_t){ .raw = ALIGN(X) })
+#ifdef COMPRESSED_REFS
+#define VPTROF(X)    raw_ptr_or_null(ALIGN(X))
+#else  // COMPRESSED_REFS
 #define VPTROF(X)    ((value_t*)ALIGN(X))
+#endif // COMPRESSED_REFS
+#define CONSOF(X)    ((cons_t*)RAW_PTR((X).raw))		// X is aligned
+#define VECOF(X)     ((vector_t*)RAW_PTR((X).raw))
 
 #define RCHAR(X)     ((value_t){ .type.main   = OTH_T,  .type.sub = CHAR_T,    .type.val   = (X) })
 #define RINT(X)      ((value_t){ .type.main   = OTH_T,  .type.sub = INT_T,     .type.val   = (X) })
@@ -140,7 +182,11 @@ typedef struct _vector_t
 #define RREF(X, Y)   ((value_t){ .ref .main   = OTH_T,  .ref .sub = REF_T,     .ref .depth = (X), .ref.width  = (Y) })
 #define RERR(X, Y)   rerr_pos(RINT(X), (Y))
 
+#ifdef COMPRESSED_REFS
+#define INTOF(X)        (((int32_t)(X).raw) >> 8)
+#else  // COMPRESSED_REFS
 #define INTOF(X)        (((intptr_t)(X).raw) >> 8)
+#endif // COMPRESSED_REFS
 #define REF_D(X)        ((X).ref.depth)
 #define REF_W(X)        ((X).ref.width)
 #define SPECIAL(X)      ((X).type.val)
@@ -150,6 +196,11 @@ typedef struct _vector_t
 
 #define EQ(X, Y)	((X).raw == (Y).raw)
 
+// integer in type field of vector header, nil for plain vectors.
+// full GC clears weak slots whose referents are not reached otherwise.
+#define VT_WEAK			1	// every slot is weak
+#define VT_WEAK_KEY		2	// key and value pairs: key is weak, value is kept while key is
+
 #define ERR_TYPE		1
 #define ERR_EOF			2
 #define ERR_PARSE		3
@@ -171,14 +222,60 @@ typedef struct _vector_t
 #define ERR_WCHAR		18
 #define ERR_EXCEPTION		19
 
-#define UNSAFE_CAR(X)	AVALUE(X).cons->car
-#define UNSAFE_CDR(X)	AVALUE(X).cons->cdr
+#ifdef CDRCODE
+// a run is n cars followed by cdr of the last one, padded to even words. a
+// pointer to a cell of it has number of cells after it in the run at CDR_SHIFT:
+// cdr of the cell is the next word, and the last cell is an ordinary cons.
+// rplacd on other cells replaces car with an indirection to an ordinary cons,
+// and GC gives references to the cell that cons.
+#define CDR_SHIFT	48
+#define CDR_MAX		0x7fff			// cells after a cell in a run
+#define CDR_RUN_SIZE	1024			// cells of a run made at once, longer lists are chained
+#define CDR_ONE		(1UL << CDR_SHIFT)
+#define CDR_INDIRECT	(1UL << 63)		// set in car of cell moved to ordinary cons
+
+#define CDR_COUNT(X)	(((X).raw >> CDR_SHIFT) & CDR_MAX)
+#define CDR_RUN(P, N)	((value_t){ .raw = CONS_T | PTR_RAW(P) | ((N) - 1) * CDR_ONE })	// first cell of run of N cells
+
+INLINE(bool    is_indirect(value_t x), (x.raw & CDR_INDIRECT) != 0)
+
+// cell which holds car and cdr of cons x
+static inline cons_t* cell_of(value_t x)
+{
+	cons_t* c = CONSOF(AVALUE(x));
+	return CDR_COUNT(x) && is_indirect(c->car) ? CONSOF(AVALUE(c->car)) : c;
+}
+
+static inline value_t cdr_of(value_t x)
+{
+	cons_t* c = CONSOF(AVALUE(x));
+	if(CDR_COUNT(x) == 0)
+	{
+		return c->cdr;
+	}
+	else if(is_indirect(c->car))
+	{
+		return CONSOF(AVALUE(c->car))->cdr;
+	}
+	else
+	{
+		return (value_t){ .raw = ((x.raw & ~7UL) + sizeof(value_t) - CDR_ONE) | CONS_T };
+	}
+}
+
+#define CELLOF(X)	cell_of(X)
+#define UNSAFE_CAR(X)	(cell_of(X)->car)
+#define UNSAFE_CDR(X)	cdr_of(X)
+#else  // CDRCODE
+#define CELLOF(X)	CONSOF(AVALUE(X))
+#define UNSAFE_CAR(X)	read_barrier(&CONSOF(AVALUE(X))->car)
+#define UNSAFE_CDR(X)	read_barrier(&CONSOF(AVALUE(X))->cdr)
+#endif // CDRCODE
 
 #define GCCONS(X, CAR, CDR) \
-	value_t X; \
-	X.cons      = alloc_cons(); \
-	X.cons->car = (CAR); \
-	X.cons->cdr = (CDR); \
+	value_t X   = RPTR(alloc_cons()); \
+	CONSOF(X)->car = (CAR); \
+	CONSOF(X)->cdr = (CDR); \
 	X.type.main = CONS_T; \
 	push_root(&X);
 
@@ -223,6 +320,9 @@ value_t find		(value_t key, value_t list, bool (*test)(value_t, value_t));
 int	count		(value_t x);
 value_t reverse		(value_t x);
 value_t copy_list	(value_t lst);
+#ifdef CDRCODE
+value_t make_list	(size_t n);
+#endif // CDRCODE
 value_t getf		(value_t key, value_t def, value_t plist);
 
 value_t rerr		(value_t cause, value_t pos);
@@ -235,6 +335,7 @@ value_t	macro		(value_t ast, value_t ast_env, value_t code, value_t vm_env, valu
 value_t slurp		(char* fn);
 value_t init		(value_t pkg);
 void	rep_file	(char* fn, value_t env);
+void	run_entry	(value_t entry, value_t env);
 
 value_t make_vector	(unsigned n);
 value_t vref		(value_t v, unsigned pos);
@@ -254,6 +355,15 @@ value_t vconc		(value_t x, value_t y);
 value_t vnconc		(value_t x, value_t y);
 value_t subvec		(value_t v, int begin, int end);
 
+value_t make_weak_pointer	(value_t x);
+value_t weak_pointer_value	(value_t w);
+bool	weak_pointer_p		(value_t x);
+value_t make_weak_table		(void);
+bool	weak_table_p		(value_t x);
+value_t weak_get		(value_t table, value_t key);
+value_t weak_put		(value_t table, value_t key, value_t value);
+int	weak_count		(value_t table);
+
 value_t str_to_cons	(const char* s);
 value_t str_to_vec	(const char* s);
 value_t mbstr_to_vec	(const char* s);
@@ -272,6 +382,7 @@ value_t intern		(const char* s, value_t package);
 value_t intern_r	(value_t s, value_t package);
 
 value_t gensym		(value_t env);
+value_t gc_stats	(void);
 
 bool	is_str		(value_t v);
 
@@ -303,4 +414,7 @@ EXTERN value_t g_package_list;
 EXTERN value_t* g_istbl;
 EXTERN int      g_istbl_size;
 
+// arity in g_istbl of builtin of 2 arguments whose last may be omitted: it is nil then.
+#define RINT_OPT(n)	RINT(-(n))
+
 #endif // _builtin_h_
@@ -1,5 +1,6 @@
 
 #include <assert.h>
+#include <stdlib.h>
 #include "builtin.h"
 #include "compile_vm.h"
 #include "env.h"
@@ -13,6 +14,50 @@
 // private:
 
 static value_t compile_vm1(value_t code, value_t debug, value_t ast, value_t env);
+static value_t compile_vm_check_builtin(value_t atom);
+
+// instruction is is followed by its entity in code.
+static bool has_entity(value_t is)
+{
+	return is.op.mnem == IS_PUSH || is.op.mnem == IS_PUSHR || is.op.mnem == IS_GOTO || is.op.mnem == IS_BIND_ARG;
+}
+
+/////////////////////////////////////////////////////////////////////
+// superinstructions: idioms the compiler emits most are fused into one
+// instruction each.
+
+// branch instruction for condition cond compiled to the end of code: code
+// of a comparison ends with it, and it is replaced by compare-and-branch.
+static vmis_t compile_vm_cmp_bnil(value_t cond, value_t code)
+{
+	value_t op = consp(cond) && symbolp(car(cond)) ? compile_vm_check_builtin(car(cond)) : NIL;
+	if(nilp(op) || !EQ(vref(code, vsize(code) - 1), op))
+	{
+		return IS_BNIL;
+	}
+
+	switch(op.op.mnem)
+	{
+		case IS_EQ:	return IS_EQ_BNIL;
+		case IS_LT:	return IS_LT_BNIL;
+		case IS_ELT:	return IS_ELT_BNIL;
+		case IS_MT:	return IS_MT_BNIL;
+		case IS_EMT:	return IS_EMT_BNIL;
+		default:	return IS_BNIL;
+	}
+}
+
+// immediate operand of arithmetic builtin bfn applied to args, or -1:
+// second argument is small integer.
+static int64_t compile_vm_arith_imm(value_t bfn, value_t args)
+{
+	if(!(EQ(bfn, ROP(IS_ADD)) || EQ(bfn, ROP(IS_SUB))) || !consp(cdr(args)) || !nilp(cdr(cdr(args))) || !intp(car(cdr(args))))
+	{
+		return -1;
+	}
+	int64_t imm = INTOF(car(cdr(args)));
+	return imm >= 0 && imm < 0x8000 ? imm : -1;
+}
 
 /////////////////////////////////////////////////////////////////////
 // special form: setq
@@ -112,8 +157,17 @@ static value_t compile_vm_if(value_t code, value_t debug, value_t ast, value_t e
 	code = compile_vm1(code, debug, first(ast), env);
 	if(errp(code)) goto cleanup;
 
+	// comparison is fused with branch
+	vmis_t br = compile_vm_cmp_bnil(first(ast), code);
 	int cond_br = vsize(code);
-	vpush(ROP(IS_BNIL), code);	vpush(ast, debug);	// dummy operand(0)
+	if(br != IS_BNIL)
+	{
+		cond_br--;
+	}
+	else
+	{
+		vpush(ROP(IS_BNIL), code);	vpush(ast, debug);	// dummy operand(0)
+	}
 
 	// true situation
 	code = compile_vm1(code, debug, second(ast), env);
@@ -129,7 +183,7 @@ static value_t compile_vm_if(value_t code, value_t debug, value_t ast, value_t e
 	int next_addr = vsize(code);
 
 	// fix branch address: relative to pc
-	rplacv(code, cond_br, ROPD(IS_BNIL, true_br + 1 - cond_br));
+	rplacv(code, cond_br, ROPD(br,      true_br + 1 - cond_br));
 	rplacv(code, true_br, ROPD(IS_BR,   next_addr - true_br));
 
 cleanup:
@@ -263,33 +317,9 @@ static value_t	compile_vm_arg_lambda(value_t code, value_t debug, value_t key, v
 			}
 			else
 			{
-				// arg num check
-				vpush(ROP (IS_SWAP),         code);	vpush(key, debug);
-				vpush(ROP (IS_DUP),          code);	vpush(key, debug);
-				vpush(ROP (IS_PUSH),         code);	vpush(key, debug);
-				vpush(RINT(0),               code);	vpush(key, debug);
-				vpush(ROP (IS_EQ),           code);	vpush(key, debug);
-				vpush(ROPD(IS_BNIL, 6),      code);	vpush(key, debug);
-
-				// too few argument: throw error
-				vpush(ROP (IS_PUSH),         code);	vpush(key, debug);
-				vpush(RINT(ERR_ARG),         code);	vpush(key, debug);
-				vpush(ROP (IS_ERR),          code);	vpush(key, debug);
-				vpush(ROP (IS_PR_STR),       code);	vpush(key, debug);
-				vpush(ROP (IS_THROW),        code);	vpush(key, debug);
-
-				// dec argnum
-				vpush(ROP (IS_PUSH),         code);	vpush(key, debug);
-				vpush(RINT(1),               code);	vpush(key, debug);
-				vpush(ROP (IS_SWAP),         code);	vpush(key, debug);
-				vpush(ROP (IS_SUB),          code);	vpush(key, debug);
-
-				// insert to env
-				vpush(ROP (IS_ROTL),         code);	vpush(key, debug);
-				vpush(ROP (IS_SWAP),         code);	vpush(key, debug);
-				vpush(ROP (IS_PUSHR),        code);	vpush(key, debug);
+				// arg num check, dec argnum and insert to env
+				vpush(ROP (IS_BIND_ARG),     code);	vpush(key, debug);
 				vpush(key_car,               code);	vpush(key, debug);
-				vpush(ROP (IS_CONS_VPUSH),   code);	vpush(key, debug);
 			}
 			break;
 
@@ -382,18 +412,7 @@ static value_t	compile_vm_arg_lambda(value_t code, value_t debug, value_t key, v
 	}
 	else
 	{
-		vpush(ROP (IS_SWAP),            code);		vpush(key, debug);
-		vpush(ROP (IS_PUSH),            code);		vpush(key, debug);
-		vpush(RINT(0),                  code);		vpush(key, debug);
-		vpush(ROP (IS_EQ),              code);		vpush(key, debug);
-		vpush(ROPD(IS_BNIL, 3),         code);		vpush(key, debug);
-		vpush(ROP (IS_POP),             code);		vpush(key, debug);	// pop environment
-		vpush(ROPD(IS_BR, 6),           code);		vpush(key, debug);
-		vpush(ROP (IS_PUSH),            code);		vpush(key, debug);
-		vpush(RINT(ERR_ARG),            code);		vpush(key, debug);
-		vpush(ROP (IS_ERR),             code);		vpush(key, debug);
-		vpush(ROP (IS_PR_STR),          code);		vpush(key, debug);
-		vpush(ROP (IS_THROW),           code);		vpush(key, debug);
+		vpush(ROP (IS_ARG_END),         code);		vpush(key, debug);	// too many argument check, pop environment
 	}
 
 cleanup:
@@ -401,6 +420,52 @@ cleanup:
 	return code;
 }
 
+// code from pc returns without doing anything: only branches and
+// popping let environment (RET restores env) are passed to RET.
+static bool compile_vm_is_tail(value_t code, int pc)
+{
+	for(int n = 0; n < vsize(code) && pc < vsize(code); n++)
+	{
+		value_t is = vref(code, pc);
+		if(rtypeof(is) != VMIS_T)
+		{
+			return false;
+		}
+
+		switch(is.op.mnem)
+		{
+			case IS_RET:		return true;
+			case IS_BR:		pc += is.op.operand;	break;
+			case IS_VPOP_ENV:	pc++;			break;
+			default:		return false;
+		}
+	}
+	return false;
+}
+
+// mark calls in tail position, that is last form of progn, branches of if
+// and body of let in lambda body: AP is replaced by TAP, which reuses frame
+// of current clojure.
+static void compile_vm_tail(value_t code)
+{
+	for(int i = 0; i < vsize(code); i++)
+	{
+		value_t is = vref(code, i);
+		if(rtypeof(is) != VMIS_T)
+		{
+			continue;
+		}
+		if(is.op.mnem == IS_AP && compile_vm_is_tail(code, i + 1))
+		{
+			rplacv(code, i, ROP(IS_TAP));
+		}
+		else if(has_entity(is))
+		{
+			i++;	// next code is entity
+		}
+	}
+}
+
 static value_t compile_vm_lambda(value_t ast, value_t env)
 {
 	assert(consp(ast));
@@ -436,6 +501,7 @@ static value_t compile_vm_lambda(value_t ast, value_t env)
 
 	// lambda is clojure call
 	vpush(ROPD(IS_RET, count(def)), lambda_code);	vpush(ast, lambda_debug);	// RET
+	compile_vm_tail(lambda_code);
 	lambda_code = cons(lambda_code, lambda_debug);
 
 cleanup:
@@ -619,14 +685,17 @@ static value_t compile_vm_check_builtin(value_t atom)
 	return NIL;
 }
 
-static int compile_vm_get_builtin_argnum(value_t atom)
+// number of arguments of builtin. opt is set if its last argument may be omitted.
+static int compile_vm_get_builtin_argnum(value_t atom, bool* opt)
 {
 	assert(symbolp(atom));
 	for(int i = 0; i <= g_istbl_size; i += 3)
 	{
 		if(EQ(g_istbl[i], atom))
 		{
-			return INTOF(g_istbl[i + 2]);
+			int n = INTOF(g_istbl[i + 2]);
+			*opt  = n < 0;
+			return n < 0 ? -n : n;
 		}
 	}
 
@@ -765,12 +834,31 @@ static value_t compile_vm_apply(value_t code, value_t debug, value_t ast, value_
 		if(!nilp(bfn))			// apply builtin
 		{
 			push_root(&bfn);
-			int n = compile_vm_get_builtin_argnum(fn);
-			if(n != argnum)
+			bool opt;
+			int  n    = compile_vm_get_builtin_argnum(fn, &opt);
+			bool omit = opt && argnum == n - 1;
+			if(n != argnum && !omit)
 			{
 				pop_root(6);
 				return RERR(ERR_ARG, ast);
 			}
+			int64_t imm = compile_vm_arith_imm(bfn, cdr(ast));
+			if(imm >= 0)		// push immediate and arith
+			{
+				code = compile_vm1(code, debug, second(ast), env);
+				if(!errp(code))
+				{
+					vpush(ROPD(bfn.op.mnem == IS_ADD ? IS_ADD_IMM : IS_SUB_IMM, imm), code);	vpush(ast, debug);
+				}
+				pop_root(6);
+				return code;
+			}
+
+			if(omit)			// omitted last argument is pushed first
+			{
+				vpush(ROP(IS_PUSH), code);	vpush(ast, debug);
+				vpush(NIL,          code);	vpush(ast, debug);
+			}
 			code = compile_vm_builtin_arg(true, code, debug, cdr(ast), env);		// arguments
 			if(errp(code))
 			{
@@ -833,11 +921,8 @@ static value_t compile_vm_apply(value_t code, value_t debug, value_t ast, value_
 
 	///////////////////
 	// check function type and select call type
-	vpush(ROP(IS_DUP), code);		vpush(ast, debug);
-	vpush(ROP(IS_MACROP), code);		vpush(ast, debug);
-
 	int cond_br = vsize(code);
-	vpush(ROP(IS_BNIL), code);		vpush(ast, debug);	// dummy operand(0)
+	vpush(ROP(IS_DUP_MACROP_BNIL), code);	vpush(ast, debug);	// dummy operand(0)
 
 	///////////////////
 	// true situation: macro call
@@ -868,8 +953,8 @@ static value_t compile_vm_apply(value_t code, value_t debug, value_t ast, value_
 
 	///////////////////
 	// fix branch address: relative to pc
-	rplacv(code, cond_br, ROPD(IS_BNIL, true_br + 1 - cond_br));
-	rplacv(code, true_br, ROPD(IS_BR,   next_addr - true_br));
+	rplacv(code, cond_br, ROPD(IS_DUP_MACROP_BNIL, true_br + 1 - cond_br));
+	rplacv(code, true_br, ROPD(IS_BR,              next_addr - true_br));
 
 cleanup:
 	pop_root(5);
@@ -996,22 +1081,50 @@ static value_t compile_vm1(value_t code, value_t debug, value_t ast, value_t env
 		if(!nilp(op))
 		{
 			// create clojure calling built-in function
-			int n = compile_vm_get_builtin_argnum(ast);
+			bool opt;
+			int n = compile_vm_get_builtin_argnum(ast, &opt);
 			assert(n >= 0);
+			assert(!opt || n == 2);
 			value_t b_code  = make_vector(2);
 			push_root(&b_code);
 			value_t b_debug = make_vector(2);
 			push_root(&b_debug);
 
-			// arg num check
-			vpush(ROP(IS_PUSH),     b_code);	vpush(ast, b_debug);
-			vpush(RINT(n),          b_code);	vpush(ast, b_debug);	// argnum
-			vpush(ROP(IS_EQ),       b_code);	vpush(ast, b_debug);
-			vpush(ROPD(IS_BNIL, 3), b_code);	vpush(ast, b_debug);
-
-			// exec operation
-			vpush(op,               b_code);	vpush(ast, b_debug);
-			vpush(ROP(IS_RET),      b_code);	vpush(ast, b_debug);
+			if(opt)
+			{
+				// all arguments
+				vpush(ROP(IS_DUP),      b_code);	vpush(ast, b_debug);
+				vpush(ROP(IS_PUSH),     b_code);	vpush(ast, b_debug);
+				vpush(RINT(n),          b_code);	vpush(ast, b_debug);	// argnum
+				vpush(ROP(IS_EQ),       b_code);	vpush(ast, b_debug);
+				vpush(ROPD(IS_BNIL, 4), b_code);	vpush(ast, b_debug);
+				vpush(ROP(IS_POP),      b_code);	vpush(ast, b_debug);	// pop argnum
+				vpush(op,               b_code);	vpush(ast, b_debug);
+				vpush(ROP(IS_RET),      b_code);	vpush(ast, b_debug);
+
+				// last argument omitted: nil is put under the others
+				vpush(ROP(IS_PUSH),     b_code);	vpush(ast, b_debug);
+				vpush(RINT(n - 1),      b_code);	vpush(ast, b_debug);	// argnum
+				vpush(ROP(IS_EQ),       b_code);	vpush(ast, b_debug);
+				vpush(ROPD(IS_BNIL, 6), b_code);	vpush(ast, b_debug);
+				vpush(ROP(IS_PUSH),     b_code);	vpush(ast, b_debug);
+				vpush(NIL,              b_code);	vpush(ast, b_debug);
+				vpush(ROP(IS_SWAP),     b_code);	vpush(ast, b_debug);
+				vpush(op,               b_code);	vpush(ast, b_debug);
+				vpush(ROP(IS_RET),      b_code);	vpush(ast, b_debug);
+			}
+			else
+			{
+				// arg num check
+				vpush(ROP(IS_PUSH),     b_code);	vpush(ast, b_debug);
+				vpush(RINT(n),          b_code);	vpush(ast, b_debug);	// argnum
+				vpush(ROP(IS_EQ),       b_code);	vpush(ast, b_debug);
+				vpush(ROPD(IS_BNIL, 3), b_code);	vpush(ast, b_debug);
+
+				// exec operation
+				vpush(op,               b_code);	vpush(ast, b_debug);
+				vpush(ROP(IS_RET),      b_code);	vpush(ast, b_debug);
+			}
 
 			// too few argument: throw error
 			vpush(ROP (IS_PUSH),    b_code);	vpush(ast, b_debug);
@@ -1033,6 +1146,233 @@ static value_t compile_vm1(value_t code, value_t debug, value_t ast, value_t env
 }
 
 
+/////////////////////////////////////////////////////////////////////
+// precompile: clojures in global environment and clojures made by their
+// code are compiled before core image is saved, so they are not compiled
+// again in each process which loads it.
+
+// true if key is bound in frame.
+static bool bound_in(value_t key, value_t frame)
+{
+	for(int i = 0; i < vsize(frame); i++)
+	{
+		if(EQ(UNSAFE_CAR(vref(frame, i)), key))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// true if code pushes a symbol bound in global frame: it was compiled before
+// the symbol is defined, and the first PUSH would replace it to reference.
+static bool has_late_bind(value_t code, value_t global)
+{
+	for(int i = 0; i < vsize(code); i++)
+	{
+		value_t is = vref(code, i);
+		if(rtypeof(is) != VMIS_T)
+		{
+			continue;
+		}
+		if(is.op.mnem == IS_PUSH && i + 1 < vsize(code))
+		{
+			value_t v   = vref(code, i + 1);
+			value_t pkg = symbolp(v) ? symbol_package(v) : NIL;
+			if(symbolp(v) && !(!nilp(pkg) && nilp(UNSAFE_CAR(pkg))) && bound_in(v, global))	// keyword is self-evaluated
+			{
+				return true;
+			}
+		}
+		if(has_entity(is))
+		{
+			i++;	// next code is entity
+		}
+	}
+	return false;
+}
+
+// compile clojure or macro c, and clojures its code makes.
+static value_t precompile1(value_t c, value_t env)
+{
+	value_t global = car(last(env));
+	if(!nilp(third(c)) && has_late_bind(car(third(c)), global))
+	{
+		rplaca(cdr(cdr(c)), NIL);
+	}
+
+	push_root(&c);
+	push_root(&env);
+	value_t r = nilp(third(c)) ? compile_vm(c, env) : NIL;
+	if(errp(r))
+	{
+		pop_root(2);
+		return r;
+	}
+
+	// clojures pushed by code are copied on PUSH: copies share code compiled here
+	value_t code = car(third(c));
+	push_root(&code);
+	for(int i = 0; i < vsize(code); i++)
+	{
+		value_t v = vref(code, i);
+		if((clojurep(v) || macrop(v)) && errp(r = precompile1(v, env)))
+		{
+			break;
+		}
+	}
+	pop_root(3);
+	return r;
+}
+
+/////////////////////////////////////////////////////////////////////
+// tree shaking: core image saved from an entry clojure has only bindings of
+// global frame and symbols which the entry may reach. symbols in code, asts
+// and data reach their global bindings, and references compiled from symbols
+// reach slots of their widths. packages are not traced: they have the reached
+// symbols only while the image is written. slots of global frame are kept in
+// place for compiled references, and slots not reached share a dummy binding.
+
+typedef struct
+{
+	uintptr_t*	set;		// visited objects, open addressing. 0 is empty
+	size_t		size;		// power of 2
+	size_t		cnt;
+	value_t		global;		// global frame
+	bool*		used;		// slots of global frame reached
+} shake_t;
+
+// first slot of visited set of size for raw word w.
+inline static size_t shake_hash(uintptr_t w, size_t size)
+{
+	return (size_t)((w >> 3) * 0x9E3779B97F4A7C15ULL) & (size - 1);
+}
+
+// add v to visited set. returns false if it is visited already or memory is short.
+static bool shake_visit(shake_t* s, value_t v)
+{
+	if(s->cnt * 2 >= s->size)
+	{
+		size_t     size = s->size ? s->size * 2 : 4096;
+		uintptr_t* set  = (uintptr_t*)calloc(size, sizeof(uintptr_t));
+		if(!set)
+		{
+			return false;
+		}
+		for(size_t i = 0; i < s->size; i++)
+		{
+			if(s->set[i])
+			{
+				size_t j = shake_hash(s->set[i], size);
+				while(set[j])
+				{
+					j = (j + 1) & (size - 1);
+				}
+				set[j] = s->set[i];
+			}
+		}
+		free(s->set);
+		s->set  = set;
+		s->size = size;
+	}
+
+	size_t j = shake_hash(v.raw, s->size);
+	for(; s->set[j]; j = (j + 1) & (s->size - 1))
+	{
+		if(s->set[j] == v.raw)
+		{
+			return false;
+		}
+	}
+	s->set[j] = v.raw;
+	s->cnt++;
+	return true;
+}
+
+static bool shake_visited(shake_t* s, value_t v)
+{
+	if(s->size == 0)
+	{
+		return false;
+	}
+	for(size_t j = shake_hash(v.raw, s->size); s->set[j]; j = (j + 1) & (s->size - 1))
+	{
+		if(s->set[j] == v.raw)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+static void shake_walk(shake_t* s, value_t v);
+
+static void shake_slot(shake_t* s, int i)
+{
+	if(i >= 0 && i < vsize(s->global) && !s->used[i])
+	{
+		s->used[i] = true;
+		shake_walk(s, vref(s->global, i));
+	}
+}
+
+static void shake_walk(shake_t* s, value_t v)
+{
+	for(;;)
+	{
+		if(refp(v))
+		{
+			shake_slot(s, v.ref.width);	// conservative: its frame may not be global
+			return;
+		}
+		if(rtypeof(v) >= OTH_T || rtypeof(v) == PTR_T || AVALUE(v).raw == 0 || !shake_visit(s, v))
+		{
+			return;
+		}
+
+		switch(rtypeof(v))
+		{
+			case SYM_T:	// not traced into its package
+				for(int i = 0; i < vsize(s->global); i++)
+				{
+					if(EQ(UNSAFE_CAR(vref(s->global, i)), v))
+					{
+						shake_slot(s, i);
+						break;
+					}
+				}
+				return;
+
+			case VEC_T:
+				if(!EQ(v, s->global))
+				{
+					for(int i = 0; i < vsize(v); i++)
+					{
+						shake_walk(s, vref(v, i));
+					}
+				}
+				return;
+
+			default:	// cons, clojure, macro and error are lists
+				shake_walk(s, UNSAFE_CAR(v));
+				v = UNSAFE_CDR(v);
+				break;
+		}
+	}
+}
+
+// exchange cdr of each (place . value) in swap with cdr of place.
+static void shake_swap(value_t swap)
+{
+	for(; !nilp(swap); swap = cdr(swap))
+	{
+		value_t p = car(swap);
+		value_t v = cdr(car(p));
+		rplacd(car(p), cdr(p));
+		rplacd(p, v);
+	}
+}
+
 /////////////////////////////////////////////////////////////////////
 // public: compile for VM
 
@@ -1065,5 +1405,104 @@ value_t compile_vm(value_t ast, value_t env)
 	return cons(code, debug);
 }
 
+// compile every clojure and macro in global frame of env. returns error of
+// the first one which is not compiled, or nil.
+value_t precompile(value_t env)
+{
+	assert(consp(env));
+
+	push_root(&env);
+	value_t global = car(last(env));
+	push_root(&global);
+
+	value_t r = NIL;
+	for(int i = 0; i < vsize(global) && !errp(r); i++)
+	{
+		value_t v = UNSAFE_CDR(vref(global, i));
+		if(clojurep(v) || macrop(v))
+		{
+			r = precompile1(v, env);
+		}
+	}
+
+	pop_root(2);
+	return r;
+}
+
+// save core image which runs entry, with only what it may reach from env.
+value_t save_shaken_core(value_t fn, value_t entry, value_t env)
+{
+	assert(clojurep(entry));
+	assert(consp(env));
+
+	push_root(&fn);
+	push_root(&entry);
+	push_root(&env);
+	value_t r = precompile(env);
+	if(errp(r) || errp(r = precompile1(entry, env)))
+	{
+		pop_root(3);
+		return r;
+	}
+
+	// no GC runs from here until the image is written: visited set holds addresses
+	lock_gc();
+	value_t global = car(last(env));
+	shake_t s      = { 0, 0, 0, global, (bool*)calloc(vsize(global) + 1, sizeof(bool)) };
+	if(!s.used)
+	{
+		unlock_gc();
+		pop_root(3);
+		return RERR(ERR_ALLOC, NIL);
+	}
+
+	// names of packages are found by init_global. bindings it uses are kept.
+	for(value_t pkg = g_package_list; !nilp(pkg); pkg = cdr(pkg))
+	{
+		shake_visit(&s, car(pkg));
+		shake_walk(&s, car(car(pkg)));
+	}
+	value_t roots[] = { g_nil, g_t, g_package, g_gensym_counter, g_exception_stack, g_debug, g_trace };
+	for(unsigned i = 0; i < sizeof(roots) / sizeof(roots[0]); i++)
+	{
+		shake_walk(&s, roots[i]);
+	}
+	shake_walk(&s, entry);
+
+	// pruned global frame and symbol lists are swapped in while the image is written
+	value_t dummy = cons(NIL, NIL);
+	value_t frame = make_vector(vsize(global));
+	for(int i = 0; i < vsize(global); i++)
+	{
+		vpush(s.used[i] ? vref(global, i) : dummy, frame);
+	}
+	value_t swap  = NIL;
+	for(value_t pkg = g_package_list; !nilp(pkg); pkg = cdr(pkg))
+	{
+		value_t syms = NIL;
+		for(value_t l = cdr(car(pkg)); !nilp(l); l = cdr(l))
+		{
+			if(shake_visited(&s, car(l)))
+			{
+				syms = cons(car(l), syms);
+			}
+		}
+		swap = cons(cons(car(pkg), reverse(syms)), swap);
+	}
+	free(s.set);
+	free(s.used);
+	unlock_gc();
+
+	push_root(&global);
+	push_root(&swap);
+	rplaca(last(env), frame);
+	shake_swap(swap);
+	r = save_core(fn, last(env), entry);
+	shake_swap(swap);
+	rplaca(last(env), global);
+	pop_root(5);
+	return r;
+}
+
 // End of File
 /////////////////////////////////////////////////////////////////////
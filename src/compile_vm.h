@@ -3,5 +3,7 @@
 
 
 value_t compile_vm	(value_t ast, value_t env);
+value_t precompile	(value_t env);
+value_t save_shaken_core(value_t fn, value_t entry, value_t env);
 
 #endif // _compile_vm_h_
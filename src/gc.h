@@ -0,0 +1,397 @@
+#ifndef _GC_H_
+#define _GC_H_
+
+// private to allocator.c and the collectors in gc_*.c: state and helpers they
+// share. nothing else includes this.
+
+#include <stddef.h>
+#include <time.h>
+#if defined(THREADS) || defined(PARGC)
+#include <pthread.h>
+#endif // THREADS || PARGC
+#include "builtin.h"
+#include "allocator.h"
+
+/////////////////////////////////////////////////////////////////////
+// GC root
+
+typedef struct
+{
+	value_t*	data;
+	int*		size;
+#ifdef CONSGC
+	int		depth;		// g_root_depth when pushed
+#endif // CONSGC
+} root_t;
+
+// per thread state. without THREADS there is one mutator.
+typedef struct mutator
+{
+	root_t		root[ROOT_SIZE];
+	int		root_ptr;
+	size_t		cons_cnt;	// allocation statistics
+	size_t		vector_cnt;
+	size_t		data;
+#ifdef THREADS
+	value_t**	tlab_top;	// TLS variables of the thread
+	value_t**	tlab_max;
+#endif // THREADS
+	struct mutator*	next;
+} mutator_t;
+
+#ifdef THREADS
+extern mutator_t*		g_mutators;	// attached threads
+#else  // THREADS
+extern mutator_t* const		g_mutators;
+#endif // THREADS
+
+/////////////////////////////////////////////////////////////////////
+// heap size (in words)
+
+extern size_t		g_pool_size;		// current to-space
+extern size_t		g_heap_size;		// next to-space
+extern size_t		g_heap_max_size;
+#ifndef NOGC
+extern size_t		g_from_size;
+#endif  // NOGC
+#ifdef HAVE_COMPACT
+extern bool		g_compact;		// mark-compact instead of copying
+#endif // HAVE_COMPACT
+extern gc_order_t	g_gc_order;
+#ifdef PARGC
+extern size_t		g_par_bound;		// words which may survive running GC
+#endif // PARGC
+#ifdef GENGC
+extern bool		g_gc_minor;
+#endif // GENGC
+#ifdef INCGC
+extern bool		g_incgc_active;
+extern long		g_incgc_budget;
+#endif // INCGC
+
+#ifdef HAVE_IMMORTAL
+/////////////////////////////////////////////////////////////////////
+// immortal region
+
+extern value_t**	g_imm_rem;		// slots in immortal region which may refer out of it
+extern size_t		g_imm_rem_cnt;
+extern bool		g_thaw;			// immortal objects are collected like from-space
+#endif // HAVE_IMMORTAL
+
+#ifndef NOGC
+/////////////////////////////////////////////////////////////////////
+// weak references
+
+typedef struct
+{
+	value_t*	slot;		// weak slot, nil while collecting
+	value_t		ref;		// its referent
+	value_t*	value;		// value slot of weak-key entry not traced yet, or 0
+	value_t		val;
+} weak_t;
+
+extern weak_t*		g_weak;
+extern size_t		g_weak_cnt;
+extern bool		g_weak_on;		// running collection clears weak slots
+#endif // NOGC
+
+/////////////////////////////////////////////////////////////////////
+// statistics (in words)
+
+extern long		g_stat_gc_cnt;
+extern size_t		g_stat_copied;
+extern size_t		g_stat_survivor;
+extern long		g_stat_weak_cleared;
+
+/////////////////////////////////////////////////////////////////////
+// large object space (vector data, not moved by GC)
+
+typedef struct _los_t
+{
+	struct _los_t*	scan;		// next block to be scanned in GC
+	size_t		index;		// index in g_los
+	size_t		bytes;		// mapped size including this header
+	size_t		mark;
+} los_t;
+
+extern los_t**		g_los;
+extern size_t		g_los_cnt;
+extern los_t*		g_los_scan;
+#ifdef INCGC
+extern los_t*		g_los_scan_cur;		// block partially scanned by incremental GC
+extern size_t		g_los_scan_pos;
+#endif // INCGC
+extern size_t		g_los_words;		// live words after last GC
+extern bool		g_los_inline;		// copy large objects into heap (save_core)
+
+inline static los_t* los_block(value_t* data)
+{
+	return (los_t*)data - 1;
+}
+
+inline static value_t* los_data(los_t* b)
+{
+	return (value_t*)(b + 1);
+}
+
+inline static size_t los_words(los_t* b)
+{
+	return (b->bytes - sizeof(los_t)) / sizeof(value_t);
+}
+
+// data is not in semispace, nursery nor immortal region: valid only while mutator is running.
+inline static bool is_los(value_t* data)
+{
+#ifdef GENGC
+	if(data >= g_nursery && data < g_nursery_max)
+	{
+		return false;
+	}
+#endif // GENGC
+#ifdef HAVE_IMMORTAL
+	if(data >= g_immortal && data < g_immortal_max)
+	{
+		return false;
+	}
+#endif // HAVE_IMMORTAL
+	return data && !(data >= g_memory_pool && data < g_memory_max);
+}
+
+#ifdef CONSGC
+/////////////////////////////////////////////////////////////////////
+// pinned blocks (Bartlett mostly-copying)
+
+typedef struct
+{
+	value_t*	start;
+	value_t*	top;		// end of objects
+	size_t		size;		// words allocated
+	uint8_t*	pin;		// objects pinned by running GC, 1 bit per 2 words
+	uint8_t*	live;		// objects pinned by previous GC, 0 if all objects are valid
+	size_t		pin_cnt;
+	size_t		kept_cnt;	// pins when pages were released last
+	int		age;		// GCs the block has been kept
+	size_t		resident;	// words in pages kept
+} pin_block_t;
+
+extern pin_block_t*	g_pin_block;		// last one is from-space while GC is running
+extern int		g_pin_block_cnt;
+extern size_t		g_pin_resident;		// words kept in pinned blocks
+extern bool		g_pin_image;		// copy pinned objects into core image
+extern value_t*		g_from_top;		// end of objects in from-space
+
+inline static bool get_pin_bit(uint8_t* map, size_t i)
+{
+	return map[i / 16] & (1 << (i / 2 % 8));
+}
+
+// from-space is searched first.
+inline static pin_block_t* pin_block_of(value_t* p)
+{
+	if(p >= g_memory_pool && p < g_memory_max)
+	{
+		return 0;	// to-space
+	}
+	for(int i = g_pin_block_cnt - 1; i >= 0; i--)
+	{
+		if(p >= g_pin_block[i].start && p < g_pin_block[i].top)
+		{
+			return g_pin_block + i;
+		}
+	}
+	return 0;
+}
+
+inline static bool is_pinned(value_t* p)
+{
+	pin_block_t* b = pin_block_of(p);
+	return b && get_pin_bit(b->pin, p - b->start);
+}
+#endif // CONSGC
+
+/////////////////////////////////////////////////////////////////////
+// support functions
+
+#ifndef NOGC
+inline static bool is_from(value_t v)
+{
+#ifdef CONSGC
+	return pin_block_of(VPTROF(v)) != 0;	// from-space and pinned blocks
+#else  // CONSGC
+#ifdef HAVE_IMMORTAL
+	if(g_thaw && is_immortal(v))
+	{
+		return true;
+	}
+#endif // HAVE_IMMORTAL
+	return (VPTROF(v) >= g_memory_pool_from && VPTROF(v) < g_memory_pool_from + g_from_size);
+#endif // CONSGC
+}
+#endif  // NOGC
+
+#ifdef GENGC
+// minor GC collects only nursery, major GC collects nursery and from-space
+inline static bool is_collected(value_t v)
+{
+	return is_nursery(v) || (!g_gc_minor && is_from(v));
+}
+#endif // GENGC
+
+#ifdef INCGC
+// mutator stores to-space values into grey objects while a cycle is running
+inline static bool is_collected(value_t v)
+{
+	return is_from(v);
+}
+#endif // INCGC
+
+#ifdef CONSGC
+// pinned objects are not moved
+inline static bool is_collected(value_t v)
+{
+	pin_block_t* b = pin_block_of(VPTROF(v));
+	return b && !get_pin_bit(b->pin, VPTROF(v) - b->start);
+}
+#endif // CONSGC
+
+#ifndef NOGC
+// vector data to be copied with its header, otherwise it is in large object space.
+inline static bool is_copied_data(value_t* data)
+{
+#ifdef GENGC
+	return g_los_inline || is_collected(RPTR(data));
+#else  // GENGC
+	return g_los_inline || is_from(RPTR(data));
+#endif // GENGC
+}
+
+// object is moved by running copying collection, or freed if it is not reached.
+inline static bool is_moved(value_t v)
+{
+#if defined(GENGC) || defined(INCGC) || defined(CONSGC)
+	return is_collected(v);
+#else  // GENGC || INCGC || CONSGC
+	return is_from(v);
+#endif // GENGC || INCGC || CONSGC
+}
+
+void		defer_weak		(value_t* slot, value_t* value, bool (*is_target)(value_t));
+
+// weak slots of data of vector v, when data is copied or marked by a full collection.
+inline static void defer_weak_data(vector_t* v, value_t* data, bool (*is_target)(value_t))
+{
+	if(!g_weak_on || !intp(v->type))
+	{
+		return;
+	}
+
+	size_t n = INTOF(v->alloc);
+	if(INTOF(v->type) == VT_WEAK)
+	{
+		for(size_t i = 0; i < n; i++)
+		{
+			defer_weak(data + i, 0, is_target);
+		}
+	}
+	else if(INTOF(v->type) == VT_WEAK_KEY)
+	{
+		for(size_t i = 0; i + 1 < n; i += 2)
+		{
+			defer_weak(data + i, data + i + 1, is_target);
+		}
+	}
+}
+#endif  // NOGC
+
+// allocation triggers GC when this many words of heap are used.
+inline static size_t gc_limit(size_t size)
+{
+#ifdef HAVE_COMPACT
+	if(g_compact)
+	{
+		return size;	// no to-space to fit in
+	}
+#endif // HAVE_COMPACT
+	return size / 2;
+}
+
+#ifdef HAVE_IMMORTAL
+// remembered slot still refers out of immortal region.
+inline static bool is_immortal_root(value_t v)
+{
+	return rtypeof(v) < OTH_T && AVALUE(v).raw != 0 && !is_immortal(v);
+}
+
+// vector header of remembered data field.
+inline static vector_t* immortal_header(value_t* slot)
+{
+	return (vector_t*)((char*)slot - offsetof(vector_t, data));
+}
+#endif // HAVE_IMMORTAL
+
+/////////////////////////////////////////////////////////////////////
+// allocator.c
+
+value_t*	pool_alloc		(size_t words);
+void		pool_free		(value_t* p, size_t words);
+#ifndef NOGC
+void		pool_discard		(value_t* pool, size_t words, value_t* p);
+#endif  // NOGC
+void		los_mark		(value_t* data);
+void		los_sweep		(void);
+void		copy1			(value_t** top, value_t* v);
+void		copy_root		(void);
+long		elapsed_usec		(struct timespec* t0);
+void		record_pause		(struct timespec* t0);
+#ifndef NOGC
+size_t		heap_used		(void);
+void		sample_peak		(void);
+size_t		heap_size_for		(size_t live);
+bool		is_discard_time		(bool force);
+void		discard_from_space	(bool force);
+bool		flip			(void);
+#endif  // NOGC
+#if defined(HAVE_COMPACT) || defined(HAVE_IMMORTAL)
+void		visit_roots		(void (*fn)(value_t*));
+#endif // HAVE_COMPACT || HAVE_IMMORTAL
+#ifdef HAVE_IMMORTAL
+void		prune_immortal_roots	(void);
+#endif // HAVE_IMMORTAL
+value_t*	collect			(size_t request);	// gc_inc.c with INCGC
+
+#ifdef PARGC
+/////////////////////////////////////////////////////////////////////
+// gc_par.c
+
+bool		par_collect		(void);
+void		par_set_threads		(int n);
+void		par_forget_threads	(void);
+#endif // PARGC
+
+#ifdef CONSGC
+/////////////////////////////////////////////////////////////////////
+// gc_cons.c
+
+void		pin_copy		(value_t** top, value_t* v);
+void		pin_roots		(void);
+void		scan_pinned		(void);
+void		pin_unmap		(void);
+void		release_blocks		(void);
+#endif // CONSGC
+
+#ifdef HAVE_COMPACT
+/////////////////////////////////////////////////////////////////////
+// gc_compact.c
+
+value_t*	exec_compact		(size_t request);
+void		release_from_space	(void);
+#endif // HAVE_COMPACT
+
+#ifdef INCGC
+/////////////////////////////////////////////////////////////////////
+// gc_inc.c
+
+void		incgc_complete		(void);
+#endif // INCGC
+
+#endif // _GC_H_
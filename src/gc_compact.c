@@ -0,0 +1,399 @@
+#include <stdlib.h>
+#include <string.h>
+#include "builtin.h"
+#include "allocator.h"
+#include "gc.h"
+
+#ifdef HAVE_COMPACT
+/////////////////////////////////////////////////////////////////////
+// private: mark-compact collector
+//
+// live objects are marked in a bitmap, one bit per two words, then slid to
+// the bottom of the heap keeping address order. every heap word is a tagged
+// value, so new address of a live word is the number of live words below it.
+
+static uint64_t*	s_mark_bits		= 0;
+static size_t*		s_live_before		= 0;	// live granules below each bitmap word
+static size_t		s_mark_bits_size	= 0;	// in bitmap words
+static value_t*		s_mark_stack		= 0;
+static size_t		s_mark_ptr		= 0;
+static size_t		s_mark_size		= 0;
+static value_t*		s_compact_base		= 0;	// live objects are slid to here
+
+inline static size_t granule_of(value_t* p)
+{
+	return (p - g_memory_pool) / 2;
+}
+
+inline static bool is_marked(value_t* p)
+{
+	size_t g = granule_of(p);
+	return s_mark_bits[g / 64] >> (g % 64) & 1;
+}
+
+static void set_marks(value_t* p, size_t words)
+{
+	for(size_t g = granule_of(p), e = g + words / 2; g < e; g++)
+	{
+		s_mark_bits[g / 64] |= 1ULL << (g % 64);
+	}
+}
+
+static bool alloc_mark_bits(size_t size)
+{
+	size_t n = (size / 2 + 63) / 64;
+	if(n > s_mark_bits_size)
+	{
+		uint64_t* bits = (uint64_t*)realloc(s_mark_bits,   sizeof(uint64_t) * n);
+		size_t*   live = (size_t*)  realloc(s_live_before, sizeof(size_t)   * n);
+		s_mark_bits    = bits ? bits : s_mark_bits;
+		s_live_before  = live ? live : s_live_before;
+		if(!bits || !live)
+		{
+			return false;
+		}
+		memset(s_mark_bits + s_mark_bits_size, 0, sizeof(uint64_t) * (n - s_mark_bits_size));
+		s_mark_bits_size = n;
+	}
+	return true;
+}
+
+static void push_mark(value_t v)
+{
+	if(s_mark_ptr >= s_mark_size)
+	{
+		s_mark_size  = s_mark_size ? s_mark_size * 2 : ROOT_SIZE;
+		s_mark_stack = (value_t*)realloc(s_mark_stack, sizeof(value_t) * s_mark_size);
+		if(!s_mark_stack)
+		{
+			fprintf(stderr, "GC mark stack overflow.\n");
+			abort();
+		}
+	}
+	s_mark_stack[s_mark_ptr++] = v;
+}
+
+#ifdef CDRCODE
+// mark granules from the one of cell p to the end of its run, and trace
+// them as conses. marked granules of a run are marked up to its end.
+static void mark_cells(value_t* p, size_t k)
+{
+	value_t* e = p + k + 2;		// after cdr of last cell
+	for(p -= (p - g_memory_pool) % 2; p < e && !is_marked(p); p += 2)
+	{
+		set_marks(p, 2);
+		value_t g   = RPTR(p);
+		g.type.main = CONS_T;
+		push_mark(g);
+	}
+}
+#endif // CDRCODE
+
+static void mark_value(value_t v)
+{
+	rtype_t  type = rtypeof(v);
+	value_t* p    = VPTROF(v);
+	if(type == PTR_T || type >= OTH_T || p < g_memory_pool || p >= g_memory_top || is_marked(p))
+	{
+		return;
+	}
+
+#ifdef CDRCODE
+	if(type != VEC_T)
+	{
+		mark_cells(p, CDR_COUNT(v));
+		return;
+	}
+#endif // CDRCODE
+	set_marks(p, type == VEC_T ? 4 : 2);
+	push_mark(v);
+}
+
+static void mark_slot(value_t* v)
+{
+	mark_value(*v);
+}
+
+// object is in heap, which is compacted.
+static bool is_compacted(value_t v)
+{
+	return VPTROF(v) >= g_memory_pool && VPTROF(v) < g_memory_top;
+}
+
+// vector data is marked with its header.
+static void mark_data(vector_t* v)
+{
+	value_t* data = VPTROF(v->data);
+	size_t   n    = INTOF(v->alloc);
+	if(!data)
+	{
+		return;
+	}
+	else if(is_los(data))
+	{
+		los_mark(data);		// scanned by mark_heap
+		defer_weak_data(v, data, is_compacted);
+	}
+	else
+	{
+		set_marks(data, n);
+		defer_weak_data(v, data, is_compacted);
+		for(size_t i = 0; i < n; i++)
+		{
+			mark_value(data[i]);
+		}
+	}
+}
+
+// trace marked objects and large objects until nothing is left to scan.
+static void drain_marks(void)
+{
+	do
+	{
+		while(s_mark_ptr)
+		{
+			value_t  v = s_mark_stack[--s_mark_ptr];
+			value_t* p = VPTROF(v);
+			if(rtypeof(v) == VEC_T)
+			{
+				mark_data((vector_t*)p);
+			}
+			else
+			{
+				mark_value(p[0]);
+				mark_value(p[1]);
+			}
+		}
+
+		while(g_los_scan)
+		{
+			los_t*   b    = g_los_scan;
+			value_t* data = los_data(b);
+			g_los_scan    = b->scan;
+			for(size_t i = 0; i < los_words(b); i++)
+			{
+				mark_value(data[i]);
+			}
+		}
+	} while(s_mark_ptr);
+}
+
+// mark values of weak-key entries whose keys are marked, until no more key is.
+// then put marked referents back into their weak slots: the rest are left nil.
+static void mark_weak(void)
+{
+	for(bool more = true; more; )
+	{
+		size_t cnt = g_weak_cnt;
+		more       = false;
+		for(size_t i = 0; i < cnt; i++)
+		{
+			value_t* value = g_weak[i].value;
+			if(value && is_marked(VPTROF(g_weak[i].ref)))
+			{
+				*value          = g_weak[i].val;
+				g_weak[i].value = 0;
+				mark_value(*value);
+				more            = true;
+			}
+		}
+		drain_marks();
+		more = more || g_weak_cnt != cnt;
+	}
+
+	for(size_t i = 0; i < g_weak_cnt; i++)
+	{
+		if(is_marked(VPTROF(g_weak[i].ref)))
+		{
+			*g_weak[i].slot = g_weak[i].ref;	// forwarded with other slots
+		}
+		else
+		{
+			g_stat_weak_cleared++;
+		}
+	}
+	g_weak_cnt = 0;
+}
+
+static void mark_heap(void)
+{
+	visit_roots(mark_slot);
+#ifdef HAVE_IMMORTAL
+	for(size_t i = 0; i < g_imm_rem_cnt; i++)
+	{
+		value_t* slot = g_imm_rem[i];
+		if(!is_immortal_root(*slot))
+		{
+			continue;
+		}
+		else if(ptrp(*slot))
+		{
+			mark_data(immortal_header(slot));
+		}
+		else
+		{
+			mark_value(*slot);
+		}
+	}
+#endif // HAVE_IMMORTAL
+	drain_marks();
+	mark_weak();
+}
+
+// count live granules below each bitmap word. returns live words.
+static size_t count_live(size_t n)
+{
+	size_t live = 0;
+	for(size_t w = 0; w < n; w++)
+	{
+		s_live_before[w] = live;
+		live            += __builtin_popcountll(s_mark_bits[w]);
+	}
+	return live * 2;
+}
+
+static void forward_slot(value_t* v)
+{
+	rtype_t  type = rtypeof(*v);
+	value_t* p    = VPTROF(*v);
+	if(type < OTH_T && p >= g_memory_pool && p < g_memory_top)
+	{
+		size_t  g   = granule_of(p);
+		size_t  w   = g / 64;
+		size_t  dst = s_live_before[w] + __builtin_popcountll(s_mark_bits[w] & ((1ULL << (g % 64)) - 1));
+		value_t r   = RPTR(s_compact_base + dst * 2 + (p - g_memory_pool) % 2);
+		r.type.main = type;
+#ifdef CDRCODE
+		r.raw      |= v->raw & ~0x0000ffffffffffffUL;	// count and indirection
+#endif // CDRCODE
+		*v          = r;
+	}
+}
+
+// update references in roots, live objects and live large objects.
+static void forward_heap(size_t n)
+{
+	visit_roots(forward_slot);
+#ifdef HAVE_IMMORTAL
+	for(size_t i = 0; i < g_imm_rem_cnt; i++)
+	{
+		forward_slot(g_imm_rem[i]);
+	}
+#endif // HAVE_IMMORTAL
+	for(size_t w = 0; w < n; w++)
+	{
+		for(uint64_t bits = s_mark_bits[w]; bits; bits &= bits - 1)
+		{
+			value_t* p = g_memory_pool + (w * 64 + __builtin_ctzll(bits)) * 2;
+			forward_slot(p);
+			forward_slot(p + 1);
+		}
+	}
+
+	for(size_t i = 0; i < g_los_cnt; i++)
+	{
+		if(g_los[i]->mark)
+		{
+			value_t* data = los_data(g_los[i]);
+			for(size_t j = 0; j < los_words(g_los[i]); j++)
+			{
+				forward_slot(data + j);
+			}
+		}
+	}
+}
+
+// move runs of live granules down to s_compact_base in address order.
+static void slide_heap(size_t n)
+{
+	value_t* dst = s_compact_base;
+	for(size_t w = 0; w < n; w++)
+	{
+		uint64_t bits = s_mark_bits[w];
+		while(bits)
+		{
+			int      b   = __builtin_ctzll(bits);
+			uint64_t run = ~(bits >> b);
+			int      len = run ? __builtin_ctzll(run) : 64;
+			value_t* src = g_memory_pool + (w * 64 + b) * 2;
+			if(dst != src)
+			{
+				memmove(dst, src, sizeof(value_t) * len * 2);
+			}
+			dst  += len * 2;
+			bits &= len == 64 ? 0 : ~(((1ULL << len) - 1) << b);
+		}
+		s_mark_bits[w] = 0;
+	}
+}
+
+// compact heap in place, or into a new heap when live data calls for other size.
+value_t* exec_compact(size_t request)
+{
+	if(!alloc_mark_bits(g_pool_size))
+	{
+		return 0;
+	}
+
+	g_weak_on = true;
+	mark_heap();
+	g_weak_on = false;
+	size_t n    = (granule_of(g_memory_top) + 63) / 64;
+	size_t live = count_live(n);
+
+	size_t size    = heap_size_for(live + request);
+	s_compact_base = g_memory_pool;
+	if(size != g_pool_size && alloc_mark_bits(size))
+	{
+#ifdef TRACE_GC
+		fprintf(stderr, " Resizing heap to %ld words...\n", (long)size);
+#endif
+		s_compact_base = pool_alloc(size);
+	}
+	if(!s_compact_base)
+	{
+		s_compact_base = g_memory_pool;
+	}
+
+	forward_heap(n);
+	slide_heap(n);
+	los_sweep();
+#ifdef HAVE_IMMORTAL
+	prune_immortal_roots();
+#endif // HAVE_IMMORTAL
+
+	if(s_compact_base != g_memory_pool)
+	{
+		pool_free(g_memory_pool, g_pool_size);
+		g_memory_pool = s_compact_base;
+		g_pool_size   = size;
+	}
+	g_memory_top = g_memory_pool + live;
+	if(is_discard_time(false))
+	{
+		pool_discard(g_memory_pool, g_pool_size, g_memory_top);	// objects were slid down from there
+	}
+	g_memory_max = g_memory_pool + g_pool_size;
+	g_memory_gc  = g_memory_pool + gc_limit(g_pool_size);
+	g_heap_size  = g_pool_size;
+
+	g_stat_gc_cnt++;
+	g_stat_copied   += live;
+	g_stat_survivor  = live + g_los_words;
+	return g_memory_top;
+}
+
+// compact mode uses from-space only while building core image.
+void release_from_space(void)
+{
+	if(g_compact)
+	{
+		pool_free(g_memory_pool_from, g_from_size);
+		g_memory_pool_from = 0;
+		g_from_size        = 0;
+	}
+}
+#endif // HAVE_COMPACT
+
+// End of File
+/////////////////////////////////////////////////////////////////////
@@ -0,0 +1,422 @@
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "builtin.h"
+#include "allocator.h"
+#include "gc.h"
+
+#ifdef CONSGC
+/////////////////////////////////////////////////////////////////////
+// private: pinned blocks (Bartlett mostly-copying)
+//
+// words on C stack which may point to objects are ambiguous roots: such objects
+// are pinned, that is, not moved and scanned as roots. other objects are copied.
+// a from-space with pinned objects is kept as a pinned block until a GC finds no
+// pin in it, and its pages without pinned objects are returned to the system.
+
+typedef struct
+{
+	value_t*	p;
+	value_t*	copy;		// copy in core image (save_core)
+	bool		vec;
+} pin_t;
+
+pin_block_t*		g_pin_block		= 0;	// last one is from-space while GC is running
+int			g_pin_block_cnt		= 0;
+static int		s_pin_block_size	= 0;
+static pin_t*		s_pin			= 0;	// pinned objects of running GC, sorted by address
+static size_t		s_pin_cnt		= 0;
+static size_t		s_pin_size		= 0;
+static pin_t*		s_pin_prev		= 0;	// pinned objects of previous GC
+static size_t		s_pin_prev_cnt		= 0;
+static size_t		s_pin_prev_size		= 0;
+size_t			g_pin_resident		= 0;	// words kept in pinned blocks
+bool			g_pin_image		= false;	// copy pinned objects into core image
+value_t*		g_from_top		= 0;	// end of objects in from-space
+
+inline static void set_pin_bit(uint8_t* map, size_t i)
+{
+	map[i / 16] |= 1 << (i / 2 % 8);
+}
+
+inline static void clear_pin_bit(uint8_t* map, size_t i)
+{
+	map[i / 16] &= ~(1 << (i / 2 % 8));
+}
+
+inline static size_t pin_map_bytes(size_t words)
+{
+	return (words + 15) / 16;
+}
+
+static pin_t* pin_find(value_t* p)
+{
+	size_t lo = 0, hi = s_pin_cnt;
+	while(lo < hi)
+	{
+		size_t mid = (lo + hi) / 2;
+		if(s_pin[mid].p < p)
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+	return lo < s_pin_cnt && s_pin[lo].p == p ? s_pin + lo : 0;
+}
+
+// pinned objects are not moved: core image (save_core) has copies of them.
+void pin_copy(value_t** top, value_t* v)
+{
+	pin_t* e = pin_find(VPTROF(*v));
+	if(!e)
+	{
+		return;
+	}
+
+	if(!e->copy)
+	{
+		e->copy = *top;
+		if(e->vec)
+		{
+			vector_t* src  = (vector_t*)e->p;
+			vector_t* dst  = (vector_t*)*top;
+			value_t*  data = VPTROF(src->data);
+			*top      += 4;
+			dst->size  = src->size;
+			dst->alloc = src->alloc;
+			dst->type  = src->type;
+			dst->data  = RPTR(data ? *top : 0);
+			for(int i = 0; data && i < INTOF(src->alloc); i++)
+				*(*top)++ = data[i];
+		}
+		else
+		{
+			*(*top)++ = e->p[0];
+			*(*top)++ = e->p[1];
+		}
+	}
+
+	value_t r   = RPTR(e->copy);
+	r.type.main = rtypeof(*v);
+	*v          = r;
+}
+
+// vector header at p in block b: its data must be in a pinned block or large object space.
+static bool is_pin_vector(pin_block_t* b, value_t* p)
+{
+	if(p + 4 > b->top || !intp(p[0]) || !intp(p[1]) || !nilp(p[2]) || !ptrp(p[3]) || INTOF(p[1]) < 0)
+	{
+		return false;
+	}
+
+	value_t*     data  = VPTROF(p[3]);
+	size_t       alloc = INTOF(p[1]);
+	pin_block_t* db    = pin_block_of(data);
+	if(!data || db)
+	{
+		return !data || data + alloc <= db->top;
+	}
+
+	for(size_t i = 0; i < g_los_cnt; i++)
+	{
+		if(los_data(g_los[i]) == data)
+		{
+			return alloc <= los_words(g_los[i]);
+		}
+	}
+	return false;
+}
+
+inline static bool is_pin_valid(pin_block_t* b, size_t i)
+{
+	return !b->live || get_pin_bit(b->live, i);
+}
+
+static void pin_add(pin_block_t* b, value_t* p, bool vec)
+{
+	size_t i = p - b->start;
+	if(get_pin_bit(b->pin, i))
+	{
+		return;
+	}
+
+	if(s_pin_cnt == s_pin_size)
+	{
+		s_pin_size = s_pin_size ? s_pin_size * 2 : 256;
+		s_pin      = (pin_t*)realloc(s_pin, sizeof(pin_t) * s_pin_size);
+		if(!s_pin)
+		{
+			abort();
+		}
+	}
+	set_pin_bit(b->pin, i);
+	b->pin_cnt++;
+	s_pin[s_pin_cnt++] = (pin_t){ p, 0, vec };
+}
+
+// w may point to an object in from-space or a pinned block: pin the object.
+// only objects pinned by previous GC are valid in a pinned block.
+static void pin_word(value_t w)
+{
+	value_t*     p = VPTROF(w);
+	pin_block_t* b = rtypeof(w) == OTH_T ? 0 : pin_block_of(p);
+	if(!b)
+	{
+		return;
+	}
+
+	size_t i = p - b->start;
+	if(ptrp(w))
+	{
+		// untagged pointer may point into vector header, or to cdr
+		for(size_t j = 1; j < 4 && j <= i; j++)
+		{
+			if((i - j) % 2 == 0 && is_pin_valid(b, i - j) && is_pin_vector(b, p - j))
+			{
+				pin_add(b, p - j, true);
+				return;
+			}
+		}
+		i -= i % 2;
+	}
+
+	if(i % 2 == 0 && is_pin_valid(b, i))
+	{
+		pin_add(b, b->start + i, is_pin_vector(b, b->start + i));
+	}
+}
+
+// callers have spilled registers: scan from this frame to the base of C stack.
+static void __attribute__((noinline)) pin_frames(void)
+{
+	volatile uintptr_t mark = 0;
+	for(value_t* p = (value_t*)&mark; p < (value_t*)g_stack_base; p++)
+	{
+		pin_word(*p);
+	}
+}
+
+static void __attribute__((noinline)) pin_stack(void)
+{
+	jmp_buf regs;
+	__builtin_unwind_init();	// callee-saved registers
+	setjmp(regs);
+	pin_frames();
+}
+
+static int cmp_pin(const void* a, const void* b)
+{
+	value_t* pa = ((const pin_t*)a)->p;
+	value_t* pb = ((const pin_t*)b)->p;
+	return pa < pb ? -1 : pa > pb;
+}
+
+// from-space is a pinned block while GC is running.
+void pin_roots(void)
+{
+	if(g_pin_block_cnt == s_pin_block_size)
+	{
+		s_pin_block_size = s_pin_block_size ? s_pin_block_size * 2 : 4;
+		g_pin_block      = (pin_block_t*)realloc(g_pin_block, sizeof(pin_block_t) * s_pin_block_size);
+	}
+
+	pin_block_t* b = g_pin_block ? g_pin_block + g_pin_block_cnt : 0;
+	if(!b || !(b->pin = (uint8_t*)calloc(pin_map_bytes(g_from_size), 1)))
+	{
+		abort();
+	}
+	b->start    = g_memory_pool_from;
+	b->top      = g_from_top;
+	b->size     = g_from_size;
+	b->live     = 0;
+	b->pin_cnt  = 0;
+	b->kept_cnt = 0;
+	b->age      = 0;
+	b->resident = g_from_size;
+	g_pin_block_cnt++;
+
+	s_pin_cnt = 0;
+	pin_stack();
+	qsort(s_pin, s_pin_cnt, sizeof(pin_t), cmp_pin);
+}
+
+// pinned objects are roots: vector data is moved, it is not referred from C stack.
+void scan_pinned(void)
+{
+	for(size_t i = 0; i < s_pin_cnt; i++)
+	{
+		value_t* p = s_pin[i].p;
+		if(s_pin[i].vec)
+		{
+			vector_t* v    = (vector_t*)p;
+			value_t*  data = VPTROF(v->data);
+			if(data && is_from(RPTR(data)))
+			{
+				v->data = RPTR(g_memory_top);
+				for(int j = 0; j < INTOF(v->alloc); j++)
+					*g_memory_top++ = data[j];
+				defer_weak_data(v, VPTROF(v->data), is_moved);
+			}
+			else if(data && is_los(data))
+			{
+				los_mark(data);
+				defer_weak_data(v, data, is_moved);
+			}
+		}
+		else
+		{
+			copy1(&g_memory_top, p);
+			copy1(&g_memory_top, p + 1);
+		}
+	}
+}
+
+inline static void pin_unmap1(value_t* v)
+{
+	rtype_t  type = rtypeof(*v);
+	value_t* p    = VPTROF(*v);
+	if(type != PTR_T && type != OTH_T && p >= g_memory_pool && p < g_memory_top && ptrp(*p))
+	{
+		value_t r   = *p;
+		r.type.main = type;
+		*v          = r;
+	}
+}
+
+// references to copies of pinned objects in core image are redirected to them.
+void pin_unmap(void)
+{
+	for(size_t i = 0; i < s_pin_cnt; i++)
+	{
+		if(s_pin[i].copy)
+		{
+			*s_pin[i].copy = RPTR(s_pin[i].p);
+		}
+	}
+
+	for(value_t* p = g_memory_pool; p < g_memory_top; p++)
+	{
+		pin_unmap1(p);
+	}
+	pin_unmap1(&g_package_list);
+}
+
+// return pages without pinned objects to the system.
+static void release_pages(pin_block_t* b)
+{
+	uintptr_t page = sysconf(_SC_PAGESIZE);
+	uintptr_t next = ((uintptr_t)b->start + page - 1) & ~(page - 1);
+	uintptr_t end  = (uintptr_t)(b->start + b->size) & ~(page - 1);
+
+	b->resident = b->size;
+	for(size_t i = 0; i <= s_pin_cnt; i++)
+	{
+		uintptr_t lo = end;
+		uintptr_t hi = end;
+		if(i < s_pin_cnt)
+		{
+			value_t* p = s_pin[i].p;
+			if(p < b->start || p >= b->top)
+			{
+				continue;
+			}
+			lo = (uintptr_t)p & ~(page - 1);
+			hi = ((uintptr_t)(p + 4) + page - 1) & ~(page - 1);
+		}
+
+		if(lo > next && end > next)
+		{
+			uintptr_t len = (lo < end ? lo : end) - next;
+			madvise((void*)next, len, MADV_DONTNEED);
+			b->resident -= len / sizeof(value_t);
+		}
+		if(hi > next)
+		{
+			next = hi;
+		}
+	}
+}
+
+// keep blocks with pinned objects, and release others.
+// live objects of a kept block are the objects pinned by this GC.
+void release_blocks(void)
+{
+	for(size_t i = 0; i < s_pin_prev_cnt; i++)
+	{
+		pin_block_t* b = pin_block_of(s_pin_prev[i].p);
+		if(b && b->live)
+		{
+			clear_pin_bit(b->live, s_pin_prev[i].p - b->start);
+		}
+	}
+
+	g_pin_resident = 0;
+	for(int i = g_pin_block_cnt - 1; i >= 0; i--)
+	{
+		pin_block_t* b = g_pin_block + i;
+		if(b->pin_cnt)
+		{
+			if(!b->live && !(b->live = (uint8_t*)calloc(pin_map_bytes(b->size), 1)))
+			{
+				abort();
+			}
+			if(b->start == g_memory_pool_from)
+			{
+				g_memory_pool_from = 0;		// next flip allocates new from-space
+				g_from_size        = 0;
+			}
+		}
+		else
+		{
+			if(!g_memory_pool_from)
+			{
+				g_memory_pool_from = b->start;	// reuse as next from-space
+				g_from_size        = b->size;
+			}
+			else if(b->start != g_memory_pool_from)
+			{
+				pool_free(b->start, b->size);
+			}
+			free(b->pin);
+			free(b->live);
+			*b = g_pin_block[--g_pin_block_cnt];
+		}
+	}
+
+	for(size_t i = 0; i < s_pin_cnt; i++)
+	{
+		pin_block_t* b = pin_block_of(s_pin[i].p);
+		set_pin_bit  (b->live, s_pin[i].p - b->start);
+		clear_pin_bit(b->pin,  s_pin[i].p - b->start);
+	}
+
+	for(int i = 0; i < g_pin_block_cnt; i++)
+	{
+		pin_block_t* b = g_pin_block + i;
+		if(++b->age > 1 && (!b->kept_cnt || b->pin_cnt < b->kept_cnt))
+		{
+			release_pages(b);	// kept for a while, and pins decreased
+			b->kept_cnt = b->pin_cnt;
+		}
+		g_pin_resident += b->resident;
+		b->pin_cnt      = 0;
+	}
+
+	pin_t* tmp      = s_pin_prev;
+	size_t tmp_size = s_pin_prev_size;
+	s_pin_prev      = s_pin;
+	s_pin_prev_cnt  = s_pin_cnt;
+	s_pin_prev_size = s_pin_size;
+	s_pin           = tmp;
+	s_pin_size      = tmp_size;
+	s_pin_cnt       = 0;
+}
+#endif // CONSGC
+
+// End of File
+/////////////////////////////////////////////////////////////////////
@@ -0,0 +1,207 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "builtin.h"
+#include "allocator.h"
+#include "gc.h"
+
+#ifdef INCGC
+/////////////////////////////////////////////////////////////////////
+// private: incremental GC state
+
+bool			g_incgc_active		= false;
+static value_t*		s_incgc_scan		= 0;	// Cheney scan pointer of running cycle
+long			g_incgc_budget		= INCGC_PAUSE_BUDGET;
+static size_t		s_incgc_copied		= 0;	// words copied by running cycle
+
+/////////////////////////////////////////////////////////////////////
+// private: incremental GC (Baker)
+//
+// a cycle flips spaces and copies roots, then scans grey objects a bounded
+// time per step. the mutator allocates at top of to-space like copied objects
+// (so they are scanned too), and read_barrier copies from-space objects it meets.
+// g_memory_max excludes room reserved for from-space objects not copied yet.
+
+// objects are copied from top: account them as survivors and keep room for allocation.
+static void incgc_copied(value_t* top)
+{
+	size_t n        = g_memory_top - top;
+	g_memory_max   += n;
+	s_incgc_copied += n;
+	g_stat_copied  += n;
+}
+
+static bool incgc_start(void)
+{
+	size_t used = heap_used();
+	while(g_heap_size < g_heap_max_size && g_heap_size < used * 2)
+	{
+		g_heap_size *= 2;	// room for allocation during the cycle
+	}
+
+	if(!flip())
+	{
+		return false;
+	}
+	g_incgc_active   = true;
+	s_incgc_scan     = g_memory_pool;
+	g_incgc_from     = g_memory_pool_from;
+	g_incgc_from_max = g_memory_pool_from + used;
+	g_memory_max    -= used;
+	s_incgc_copied   = 0;
+
+	value_t* top = g_memory_top;
+	copy_root();
+	incgc_copied(top);
+	return true;
+}
+
+// scan grey objects for usec at most (no limit if negative). returns true when a cycle is done.
+static bool incgc_scan(long usec)
+{
+	struct timespec t0;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	value_t* top  = g_memory_top;
+	bool     done = false;
+	for(long n = 1; !done; n++)
+	{
+		if(s_incgc_scan != g_memory_top)
+		{
+			copy1(&g_memory_top, s_incgc_scan++);
+		}
+		else if(g_los_scan_cur && g_los_scan_pos < los_words(g_los_scan_cur))
+		{
+			copy1(&g_memory_top, los_data(g_los_scan_cur) + g_los_scan_pos++);
+		}
+		else if(g_los_scan)
+		{
+			g_los_scan_cur = g_los_scan;
+			g_los_scan_pos = 0;
+			g_los_scan     = g_los_scan->scan;
+		}
+		else
+		{
+			g_los_scan_cur = 0;
+			done           = true;
+		}
+
+		if(usec >= 0 && (FORCE_GC || n % 256 == 0) && elapsed_usec(&t0) >= usec)
+		{
+			break;
+		}
+	}
+	incgc_copied(top);
+	return done;
+}
+
+#ifdef DEBUG_GC
+// no from-space pointer is left after a cycle: checks read barriers are not missed.
+static void incgc_verify(void)
+{
+	for(value_t* p = g_memory_pool; p < g_memory_top; p++)
+	{
+		if(rtypeof(*p) < OTH_T && is_incgc_from(*p))
+		{
+			abort();
+		}
+	}
+
+	for(size_t i = 0; i < g_los_cnt; i++)
+	{
+		for(size_t j = 0; g_los[i]->mark && j < los_words(g_los[i]); j++)
+		{
+			value_t* p = los_data(g_los[i]) + j;
+			if(rtypeof(*p) < OTH_T && is_incgc_from(*p))
+			{
+				abort();
+			}
+		}
+	}
+}
+#endif // DEBUG_GC
+
+static void incgc_finish(size_t request)
+{
+#ifdef DEBUG_GC
+	incgc_verify();
+#endif // DEBUG_GC
+	los_sweep();
+	discard_from_space(false);
+	g_stat_gc_cnt++;
+	g_stat_survivor  = s_incgc_copied + g_los_words;
+	g_incgc_active   = false;
+	g_incgc_from     = 0;
+	g_incgc_from_max = 0;
+	g_memory_max     = g_memory_pool + g_pool_size;
+	g_memory_gc      = g_memory_pool + g_pool_size / 2;
+
+	// size next to-space by occupancy after this cycle
+	g_heap_size = heap_size_for(g_memory_top - g_memory_pool + request);
+}
+
+// start a cycle or do a step of it. request is words the caller is going to allocate.
+value_t* collect(size_t request)
+{
+#ifdef TRACE_GC
+	fprintf(stderr, "Executing incremental GC step...\n");
+#endif
+	struct timespec t0;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	sample_peak();
+	if(!g_incgc_active && !incgc_start())
+	{
+		return 0;
+	}
+
+	// finish without budget when room for allocation is short
+	bool sync = g_memory_top + INCGC_STEP + request >= g_memory_max;
+	if(incgc_scan(sync ? -1 : g_incgc_budget))
+	{
+		incgc_finish(request);
+		if(g_heap_size != g_pool_size && g_memory_top + request >= g_memory_gc)
+		{
+			// request does not fit: run a whole cycle into resized space right now
+			if(incgc_start())
+			{
+				incgc_scan(-1);
+				incgc_finish(request);
+			}
+		}
+	}
+	else
+	{
+		g_memory_gc = g_memory_top + INCGC_STEP;
+	}
+
+	record_pause(&t0);
+#ifdef TRACE_GC
+	fprintf(stderr, "Executing incremental GC step Done.\n");
+#endif
+	return g_memory_top;
+}
+
+// complete running cycle.
+void incgc_complete(void)
+{
+	if(g_incgc_active)
+	{
+		struct timespec t0;
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		incgc_scan(-1);
+		incgc_finish(0);
+		record_pause(&t0);
+	}
+}
+
+value_t incgc_forward(value_t* slot)
+{
+	value_t* top = g_memory_top;
+	copy1(&g_memory_top, slot);
+	incgc_copied(top);
+	return *slot;
+}
+#endif // INCGC
+
+// End of File
+/////////////////////////////////////////////////////////////////////
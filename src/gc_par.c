@@ -0,0 +1,560 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include "builtin.h"
+#include "allocator.h"
+#include "gc.h"
+
+#ifdef PARGC
+/////////////////////////////////////////////////////////////////////
+// private: parallel copying collector
+//
+// GC threads claim ranges of roots, and copy objects into blocks of to-space
+// taken from a shared top. an object is claimed by replacing its forwarding
+// word (car of cons, type of vector) with PARGC_BUSY, and is forwarded after
+// it is copied. filled parts of blocks and large objects are ranges to be
+// scanned, which idle threads steal. unused ends of blocks are set to nil.
+
+#define PARGC_BUSY		0		// raw RPTR(0): object is being copied
+
+typedef struct
+{
+	value_t*	start;
+	value_t*	end;
+} par_range_t;
+
+typedef struct
+{
+	value_t*	lab_top;	// block being filled
+	value_t*	lab_max;
+	value_t*	scan;		// objects in block from here are not scanned yet
+	par_range_t*	work;		// ranges to scan: owner takes top, thieves take bottom
+	size_t		work_bottom;
+	size_t		work_top;
+	size_t		work_size;
+	pthread_mutex_t	lock;		// of work
+	long		cycle;		// last cycle the thread has joined
+} __attribute__((aligned(64))) par_worker_t;
+
+static par_worker_t	s_par_worker[PARGC_MAX_THREADS];
+static pthread_t	s_par_thread[PARGC_MAX_THREADS];
+static int		s_par_threads		= 1;	// GC threads including collecting one
+static int		s_par_started		= 0;	// workers initialized, including collecting one
+static pthread_mutex_t	s_par_lock		= PTHREAD_MUTEX_INITIALIZER;	// cycles and weak slots
+static pthread_cond_t	s_par_start		= PTHREAD_COND_INITIALIZER;
+static pthread_cond_t	s_par_done		= PTHREAD_COND_INITIALIZER;
+static long		s_par_cycle		= 0;
+static int		s_par_running		= 0;	// threads in cycle except collecting one
+static int		s_par_idle		= 0;	// threads out of work
+static value_t*		s_par_top		= 0;	// shared top of to-space
+static par_range_t*	s_par_roots		= 0;
+static size_t		s_par_root_cnt		= 0;
+static size_t		s_par_root_size		= 0;
+static size_t		s_par_root_next		= 0;	// next root range to claim
+#ifdef HAVE_IMMORTAL
+static size_t		s_par_imm_next		= 0;	// next chunk of immortal remembered set
+#endif // HAVE_IMMORTAL
+
+// take n words from shared top of to-space.
+static value_t* par_take(size_t n)
+{
+	value_t* p = __atomic_fetch_add(&s_par_top, sizeof(value_t) * n, __ATOMIC_RELAXED);
+	if(p + n > g_memory_max)
+	{
+		fprintf(stderr, "GC to-space overflow.\n");
+		abort();
+	}
+	return p;
+}
+
+static void par_push(par_worker_t* w, value_t* start, value_t* end)
+{
+	if(start == end)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&w->lock);
+	if(w->work_top >= w->work_size && w->work_bottom * 2 >= w->work_size && w->work_size)
+	{
+		// thieves have taken half: move rest down
+		memmove(w->work, w->work + w->work_bottom, sizeof(par_range_t) * (w->work_top - w->work_bottom));
+		__atomic_store_n(&w->work_top,    w->work_top - w->work_bottom, __ATOMIC_RELAXED);
+		__atomic_store_n(&w->work_bottom, 0,                            __ATOMIC_RELAXED);
+	}
+	else if(w->work_top >= w->work_size)
+	{
+		size_t       size = w->work_size ? w->work_size * 2 : ROOT_SIZE;
+		par_range_t* p    = (par_range_t*)realloc(w->work, sizeof(par_range_t) * size);
+		if(!p)
+		{
+			fprintf(stderr, "GC work stack overflow.\n");
+			abort();
+		}
+		w->work      = p;
+		w->work_size = size;
+	}
+	w->work[w->work_top].start = start;
+	w->work[w->work_top].end   = end;
+	__atomic_store_n(&w->work_top, w->work_top + 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&w->lock);
+}
+
+// peeked without lock by thieves.
+inline static bool par_has_work(par_worker_t* w)
+{
+	return __atomic_load_n(&w->work_top, __ATOMIC_RELAXED) != __atomic_load_n(&w->work_bottom, __ATOMIC_RELAXED);
+}
+
+static bool par_pop(par_worker_t* w, par_range_t* r, bool steal)
+{
+	bool found = false;
+	pthread_mutex_lock(&w->lock);
+	if(w->work_top != w->work_bottom)
+	{
+		found = true;
+		if(steal)
+		{
+			*r = w->work[w->work_bottom];
+			__atomic_store_n(&w->work_bottom, w->work_bottom + 1, __ATOMIC_RELAXED);
+		}
+		else
+		{
+			*r = w->work[w->work_top - 1];
+			__atomic_store_n(&w->work_top, w->work_top - 1, __ATOMIC_RELAXED);
+		}
+		if(w->work_top == w->work_bottom)
+		{
+			__atomic_store_n(&w->work_top,    0, __ATOMIC_RELAXED);
+			__atomic_store_n(&w->work_bottom, 0, __ATOMIC_RELAXED);
+		}
+	}
+	pthread_mutex_unlock(&w->lock);
+	return found;
+}
+
+// n words of to-space. a large object is not put in block: it is pushed by par_filled.
+static value_t* par_alloc(par_worker_t* w, size_t n)
+{
+	if(n > PARGC_LAB_SIZE / 8)
+	{
+		return par_take(n);
+	}
+
+	if(!w->lab_top || w->lab_top + n > w->lab_max)
+	{
+		// rest of block is scanned by someone, unused end is nil
+		par_push(w, w->scan, w->lab_top);
+		for(value_t* p = w->lab_top; p < w->lab_max; p++)
+		{
+			*p = NIL;
+		}
+		w->lab_top = w->scan = par_take(PARGC_LAB_SIZE);
+		w->lab_max = w->lab_top + PARGC_LAB_SIZE;
+	}
+
+	value_t* p  = w->lab_top;
+	w->lab_top += n;
+	return p;
+}
+
+// object of n words at p is filled.
+inline static void par_filled(par_worker_t* w, value_t* p, size_t n)
+{
+	if(n > PARGC_LAB_SIZE / 8)
+	{
+		par_push(w, p, p + n);
+	}
+}
+
+static void par_los_mark(par_worker_t* w, value_t* data)
+{
+	los_t* b = los_block(data);
+	if(!__atomic_exchange_n(&b->mark, 1, __ATOMIC_RELAXED))
+	{
+		value_t* end = data + los_words(b);
+		for(value_t* p = data; p < end; p += PARGC_LAB_SIZE)
+		{
+			par_push(w, p, p + PARGC_LAB_SIZE < end ? p + PARGC_LAB_SIZE : end);
+		}
+	}
+}
+
+static void par_defer_weak(vector_t* v, value_t* data)
+{
+	if(g_weak_on && intp(v->type))
+	{
+		pthread_mutex_lock(&s_par_lock);
+		defer_weak_data(v, data, is_moved);
+		pthread_mutex_unlock(&s_par_lock);
+	}
+}
+
+// words of vector data copied with its header: 0 if it is in large object space.
+inline static size_t par_data_size(vector_t* v)
+{
+	value_t* data = VPTROF(v->data);
+	return data && is_copied_data(data) ? INTOF(v->alloc) : 0;
+}
+
+// copy data of vector v to p, or mark it in large object space. data field of v is updated.
+// weak slots are cleared before the data is scanned.
+static void par_copy_data(par_worker_t* w, vector_t* v, value_t* p)
+{
+	value_t* data = VPTROF(v->data);
+	if(data && is_copied_data(data))
+	{
+		memcpy(p, data, sizeof(value_t) * INTOF(v->alloc));
+		v->data = RPTR(p);
+		par_defer_weak(v, p);
+	}
+	else if(data)
+	{
+		par_defer_weak(v, data);
+		par_los_mark(w, data);
+	}
+}
+
+// claim object by its forwarding word fwd. returns true with the old word in *old,
+// or false with forwarding address of the copy made by other thread.
+static bool par_claim(value_t* fwd, value_t* old)
+{
+	old->raw = __atomic_load_n(&fwd->raw, __ATOMIC_ACQUIRE);
+	while(!ptrp(*old))
+	{
+		if(__atomic_compare_exchange_n(&fwd->raw, &old->raw, PARGC_BUSY, true, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+		{
+			return true;
+		}
+	}
+	while(old->raw == PARGC_BUSY)
+	{
+		sched_yield();
+		old->raw = __atomic_load_n(&fwd->raw, __ATOMIC_ACQUIRE);
+	}
+	return false;
+}
+
+// copy1 of GC threads. cdr chain of a copied cons is copied next to it unless order is breadth.
+static void par_copy1(par_worker_t* w, value_t* v)
+{
+	while(v)
+	{
+		rtype_t type = rtypeof(*v);
+		value_t cur  = AVALUE(*v);
+		if(type == PTR_T || type >= OTH_T || cur.raw == 0 || !is_from(cur))
+		{
+			return;		// immortal object is not moved
+		}
+
+		value_t  old;
+		value_t  alloc;
+		value_t* next = 0;
+		if(!par_claim(type == VEC_T ? &VECOF(cur)->type : &CONSOF(cur)->car, &old))
+		{
+			alloc = old;
+		}
+		else if(type == VEC_T)
+		{
+			size_t    n   = 4 + par_data_size(VECOF(cur));
+			value_t*  p   = par_alloc(w, n);
+			vector_t* dst = (vector_t*)p;
+			dst->size     = VECOF(cur)->size;
+			dst->alloc    = VECOF(cur)->alloc;
+			dst->type     = old;
+			dst->data     = VECOF(cur)->data;
+			par_copy_data(w, dst, p + 4);
+			par_filled(w, p, n);
+
+			alloc = RPTR(p);
+			__atomic_store_n(&VECOF(cur)->type.raw, alloc.raw, __ATOMIC_RELEASE);
+		}
+		else
+		{
+			value_t* p = par_alloc(w, 2);
+			p[0]       = old;
+			p[1]       = CONSOF(cur)->cdr;
+			next       = g_gc_order != GC_ORDER_BREADTH && rtypeof(p[1]) == CONS_T ? p + 1 : 0;
+
+			alloc = RPTR(p);
+			__atomic_store_n(&CONSOF(cur)->car.raw, alloc.raw, __ATOMIC_RELEASE);
+		}
+
+		alloc.type.main = type;
+		*v              = alloc;
+		v               = next;
+	}
+}
+
+static void par_scan_range(par_worker_t* w, par_range_t* r)
+{
+	for(value_t* p = r->start; p < r->end; p++)
+	{
+		par_copy1(w, p);
+	}
+}
+
+// take a range from other thread. returns false when all threads are out of work.
+static bool par_steal(par_worker_t* w, par_range_t* r)
+{
+	int self = w - s_par_worker;
+	__atomic_add_fetch(&s_par_idle, 1, __ATOMIC_SEQ_CST);
+	while(true)
+	{
+		for(int i = 1; i < s_par_threads; i++)
+		{
+			par_worker_t* v = s_par_worker + (self + i) % s_par_threads;
+			if(par_has_work(v))
+			{
+				// not idle while holding stolen range
+				__atomic_sub_fetch(&s_par_idle, 1, __ATOMIC_SEQ_CST);
+				if(par_pop(v, r, true))
+				{
+					return true;
+				}
+				__atomic_add_fetch(&s_par_idle, 1, __ATOMIC_SEQ_CST);
+			}
+		}
+
+		if(__atomic_load_n(&s_par_idle, __ATOMIC_SEQ_CST) == s_par_threads)
+		{
+			return false;
+		}
+		sched_yield();
+	}
+}
+
+// own block is scanned first, then own ranges, then stolen ones.
+static void par_scan(par_worker_t* w)
+{
+	par_range_t r;
+	while(true)
+	{
+		if(w->scan < w->lab_top)
+		{
+			// give older half to idle threads
+			if(w->lab_top - w->scan >= PARGC_SHARE_SIZE && __atomic_load_n(&s_par_idle, __ATOMIC_RELAXED) > 0)
+			{
+				value_t* mid = w->scan + (w->lab_top - w->scan) / 2;
+				par_push(w, w->scan, mid);
+				w->scan = mid;
+			}
+			for(int i = 0; i < PARGC_LAB_SIZE && w->scan < w->lab_top; i++)
+			{
+				par_copy1(w, w->scan++);	// block may be replaced
+			}
+		}
+		else if(par_pop(w, &r, false) || par_steal(w, &r))
+		{
+			par_scan_range(w, &r);
+		}
+		else
+		{
+			return;
+		}
+	}
+}
+
+#ifdef HAVE_IMMORTAL
+static void par_copy_immortal_root(par_worker_t* w, value_t* slot)
+{
+	if(!is_immortal_root(*slot))
+	{
+		return;
+	}
+	else if(ptrp(*slot))
+	{
+		// data of frozen vector is referred only from its header
+		vector_t* v = immortal_header(slot);
+		size_t    n = par_data_size(v);
+		value_t*  p = par_alloc(w, n);
+		par_copy_data(w, v, p);
+		par_filled(w, p, n);
+	}
+	else
+	{
+		par_copy1(w, slot);
+	}
+}
+#endif // HAVE_IMMORTAL
+
+static void par_work(par_worker_t* w)
+{
+	size_t i;
+	while((i = __atomic_fetch_add(&s_par_root_next, 1, __ATOMIC_RELAXED)) < s_par_root_cnt)
+	{
+		par_scan_range(w, s_par_roots + i);
+	}
+#ifdef HAVE_IMMORTAL
+	while(!g_thaw && (i = __atomic_fetch_add(&s_par_imm_next, PARGC_ROOT_CHUNK, __ATOMIC_RELAXED)) < g_imm_rem_cnt)
+	{
+		for(size_t j = i; j < i + PARGC_ROOT_CHUNK && j < g_imm_rem_cnt; j++)
+		{
+			par_copy_immortal_root(w, g_imm_rem[j]);
+		}
+	}
+#endif // HAVE_IMMORTAL
+
+	par_scan(w);
+	for(value_t* p = w->lab_top; p < w->lab_max; p++)
+	{
+		*p = NIL;
+	}
+	w->lab_top = w->lab_max = w->scan = 0;
+}
+
+static void* par_main(void* arg)
+{
+	par_worker_t* w = (par_worker_t*)arg;
+	pthread_mutex_lock(&s_par_lock);
+	while(true)
+	{
+		while(w->cycle == s_par_cycle)
+		{
+			pthread_cond_wait(&s_par_start, &s_par_lock);
+		}
+		w->cycle = s_par_cycle;
+		if(w - s_par_worker < s_par_threads)
+		{
+			pthread_mutex_unlock(&s_par_lock);
+			par_work(w);
+			pthread_mutex_lock(&s_par_lock);
+			if(--s_par_running == 0)
+			{
+				pthread_cond_signal(&s_par_done);
+			}
+		}
+	}
+	return 0;
+}
+
+// GC threads are started at first parallel collection. returns false if none runs.
+static bool par_start_threads(void)
+{
+	for(; s_par_started < s_par_threads; s_par_started++)
+	{
+		par_worker_t* w = s_par_worker + s_par_started;
+		w->cycle        = s_par_cycle;
+		pthread_mutex_init(&w->lock, 0);
+		if(s_par_started > 0 && pthread_create(s_par_thread + s_par_started, 0, par_main, w) != 0)
+		{
+			pthread_mutex_destroy(&w->lock);
+			s_par_threads = s_par_started;
+			break;
+		}
+	}
+	return s_par_threads > 1;
+}
+
+// slots from start to end are roots, claimed in chunks.
+static bool par_add_root(value_t* start, value_t* end)
+{
+	for(value_t* p = start; p < end; p += PARGC_ROOT_CHUNK)
+	{
+		if(s_par_root_cnt >= s_par_root_size)
+		{
+			size_t       size = s_par_root_size ? s_par_root_size * 2 : ROOT_SIZE;
+			par_range_t* r    = (par_range_t*)realloc(s_par_roots, sizeof(par_range_t) * size);
+			if(!r)
+			{
+				return false;
+			}
+			s_par_roots     = r;
+			s_par_root_size = size;
+		}
+		s_par_roots[s_par_root_cnt].start = p;
+		s_par_roots[s_par_root_cnt].end   = p + PARGC_ROOT_CHUNK < end ? p + PARGC_ROOT_CHUNK : end;
+		s_par_root_cnt++;
+	}
+	return true;
+}
+
+static bool par_roots(void)
+{
+	s_par_root_cnt = 0;
+	bool ok        = par_add_root(&g_package_list, &g_package_list + 1);
+	for(mutator_t* m = g_mutators; m; m = m->next)
+	{
+		for(int i = 0; ok && i < m->root_ptr; i++)
+		{
+			value_t* data = m->root[i].data;
+			ok = par_add_root(data, data + (m->root[i].size ? *m->root[i].size + 1 : 1));
+		}
+	}
+	return ok;
+}
+
+// copy all live objects by GC threads, instead of copy_root and scan_heap.
+// returns false if heap is small, or to-space may not have room for unused ends of blocks.
+bool par_collect(void)
+{
+	size_t used = g_par_bound;
+	size_t room = used + used / 7 + s_par_threads * PARGC_LAB_SIZE;
+	if(s_par_threads < 2 || used < PARGC_MIN_WORDS || (size_t)(g_memory_max - g_memory_top) < room ||
+	   !par_roots() || !par_start_threads())
+	{
+		return false;
+	}
+
+	s_par_top       = g_memory_top;
+	s_par_root_next = 0;
+	s_par_idle      = 0;
+#ifdef HAVE_IMMORTAL
+	s_par_imm_next  = 0;
+#endif // HAVE_IMMORTAL
+
+	pthread_mutex_lock(&s_par_lock);
+	s_par_running = s_par_threads - 1;
+	s_par_cycle++;
+	pthread_cond_broadcast(&s_par_start);
+	pthread_mutex_unlock(&s_par_lock);
+
+	s_par_worker[0].cycle = s_par_cycle;
+	par_work(s_par_worker);
+
+	pthread_mutex_lock(&s_par_lock);
+	while(s_par_running)
+	{
+		pthread_cond_wait(&s_par_done, &s_par_lock);
+	}
+	pthread_mutex_unlock(&s_par_lock);
+
+	g_memory_top = s_par_top;
+#ifdef HAVE_IMMORTAL
+	if(!g_thaw)
+	{
+		prune_immortal_roots();
+	}
+#endif // HAVE_IMMORTAL
+	return true;
+}
+
+// set_gc_threads: 0 means environment variable or number of processors.
+void par_set_threads(int n)
+{
+	if(n <= 0 && getenv("RUDEL_GC_THREADS"))
+	{
+		n = atoi(getenv("RUDEL_GC_THREADS"));
+	}
+	if(n <= 0)
+	{
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	s_par_threads = n < 1 ? 1 : n > PARGC_MAX_THREADS ? PARGC_MAX_THREADS : n;
+}
+
+// forked process has no GC threads, and their locks are new.
+void par_forget_threads(void)
+{
+	pthread_mutex_init(&s_par_lock, 0);
+	pthread_cond_init(&s_par_start, 0);
+	pthread_cond_init(&s_par_done, 0);
+	s_par_threads   = 1;
+	s_par_started   = 0;
+}
+#endif // PARGC
+
+// End of File
+/////////////////////////////////////////////////////////////////////
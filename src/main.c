@@ -1,5 +1,6 @@
 
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
 #include <locale.h>
 #include "builtin.h"
@@ -11,6 +12,7 @@
 #include "vm.h"
 #include "compile_vm.h"
 #include "asm.h"
+#include "profile.h"
 
 #define STR(X) str_to_rstr(X)
 
@@ -118,30 +120,176 @@ value_t parse_arg(int argc, char* argv[], value_t pkg)
 	return cdr(r);
 }
 
+void usage(void)
+{
+	fprintf(stderr, "usage: rudel [options] [file [args...]]\n");
+	fprintf(stderr, "  --heap-size=SIZE        initial heap size\n");
+	fprintf(stderr, "  --max-heap-size=SIZE    maximum heap size\n");
+	fprintf(stderr, "  --gc=MODE               collector: copy or compact (mark-compact, no from-space)\n");
+	fprintf(stderr, "  --gc-order=ORDER        copy order: breadth, cdr (list spines contiguous) or depth\n");
+	fprintf(stderr, "  --gc-threads=N          threads of parallel copying GC (default: processors)\n");
+	fprintf(stderr, "  --gc-pause-budget=USEC  pause budget of incremental GC step\n");
+	fprintf(stderr, "  --huge-pages            back heap with transparent huge pages\n");
+	fprintf(stderr, "  --gc-pauses             print GC pause histogram at exit\n");
+	fprintf(stderr, "  --no-freeze             keep boot objects in collected heap\n");
+	fprintf(stderr, "  --core PATH             boot from core image at PATH instead of the one in rudel or init.rudc\n");
+	fprintf(stderr, "  --pack-core             save-core writes heap packed, smaller to ship\n");
+	fprintf(stderr, "  --alloc-profile=FILE    write allocation sites sampled by VM pc to FILE at exit, - for stderr\n");
+	fprintf(stderr, "  --alloc-sample=N        sample one in N allocations (default %d)\n", PROF_DEFAULT_RATE);
+	fprintf(stderr, "  SIZE is bytes per semispace with optional K, M or G suffix.\n");
+	fprintf(stderr, "  SIZE is of whole heap with --gc=compact.\n");
+	fprintf(stderr, "  defaults are taken from RUDEL_HEAP_SIZE, RUDEL_MAX_HEAP_SIZE, RUDEL_GC,\n");
+	fprintf(stderr, "  RUDEL_GC_ORDER, RUDEL_GC_THREADS and RUDEL_HUGE_PAGES.\n");
+}
+
 int main(int argc, char* argv[])
 {
 	setlocale(LC_ALL, "");
-	init_allocator();
+
+	// options precede file name
+	size_t     heap_size     = 0;
+	size_t     max_heap_size = 0;
+	gc_mode_t  gc_mode       = GC_DEFAULT;
+	gc_order_t gc_order      = GC_ORDER_DEFAULT;
+	int        gc_threads    = 0;
+	bool       gc_pauses     = false;
+	bool       freeze        = true;
+	char*      core          = 0;
+	char*      alloc_profile = 0;
+	long       alloc_sample  = PROF_DEFAULT_RATE;
+	int        arg           = 1;
+	for(; arg < argc && strncmp(argv[arg], "--", 2) == 0; arg++)
+	{
+		if(strncmp(argv[arg], "--heap-size=", 12) == 0 && (heap_size = parse_heap_size(argv[arg] + 12)))
+		{
+			continue;
+		}
+		else if(strncmp(argv[arg], "--max-heap-size=", 16) == 0 && (max_heap_size = parse_heap_size(argv[arg] + 16)))
+		{
+			continue;
+		}
+		else if(strncmp(argv[arg], "--gc=", 5) == 0 && (gc_mode = parse_gc_mode(argv[arg] + 5)))
+		{
+			continue;
+		}
+		else if(strncmp(argv[arg], "--gc-order=", 11) == 0 && (gc_order = parse_gc_order(argv[arg] + 11)))
+		{
+			continue;
+		}
+		else if(strncmp(argv[arg], "--gc-threads=", 13) == 0 && (gc_threads = atoi(argv[arg] + 13)) > 0)
+		{
+			continue;
+		}
+		else if(strncmp(argv[arg], "--gc-pause-budget=", 18) == 0 && atol(argv[arg] + 18) > 0)
+		{
+			set_gc_pause_budget(atol(argv[arg] + 18));
+		}
+		else if(strcmp(argv[arg], "--huge-pages") == 0)
+		{
+			set_huge_pages(true);
+		}
+		else if(strcmp(argv[arg], "--gc-pauses") == 0)
+		{
+			gc_pauses = true;
+		}
+		else if(strcmp(argv[arg], "--no-freeze") == 0)
+		{
+			freeze = false;
+		}
+		else if(strcmp(argv[arg], "--core") == 0 && arg + 1 < argc)
+		{
+			core = argv[++arg];
+		}
+		else if(strcmp(argv[arg], "--pack-core") == 0)
+		{
+			set_pack_core(true);
+		}
+		else if(strncmp(argv[arg], "--alloc-profile=", 16) == 0 && argv[arg][16])
+		{
+			alloc_profile = argv[arg] + 16;
+		}
+		else if(strncmp(argv[arg], "--alloc-sample=", 15) == 0 && atol(argv[arg] + 15) > 0)
+		{
+			alloc_sample = atol(argv[arg] + 15);
+		}
+		else
+		{
+			usage();
+			return 1;
+		}
+	}
+
+	init_allocator(heap_size, max_heap_size, gc_mode);
+	if(gc_order)
+	{
+		set_gc_order(gc_order);
+	}
+	if(gc_threads)
+	{
+		set_gc_threads(gc_threads);
+	}
+	if(alloc_profile)
+	{
+		init_alloc_profile(alloc_sample);
+	}
 
 	g_package_list = NIL;
 	value_t env    = NIL;
+	value_t entry  = NIL;
 	push_root(&env);
+	push_root(&entry);
 
-	env = load_core("init.rudc");
+	// boot objects live long: later GCs need not copy them.
+	// objects of core image are loaded frozen.
+	// core image is of --core, the one linked into rudel by make boot, or
+	// init.rudc. core image refused is reported: init.rudc which is not found is not.
+	// core image saved with an entry clojure runs it with arguments in *ARGV*.
+	const char* fn = core ? core : argv[0];
+	env = core ? load_core(core, freeze, &entry) : load_boot_core(freeze, &entry);
+	if(errp(env) && !core && EQ(RERR_CAUSE(env), RINT(ERR_FILENOTFOUND)))
+	{
+		fn  = "init.rudc";
+		env = load_core(fn, freeze, &entry);
+	}
+	if(errp(env) && (core || !EQ(RERR_CAUSE(env), RINT(ERR_CANTOPEN))))
+	{
+		fprintf(stderr, "%s: ", fn);
+		print(env, NIL, stderr);
+		if(core)
+		{
+			return 1;
+		}
+	}
 	if(errp(env))
 	{
 		lock_gc();
 		value_t pkg = init_package_list();
 		init_global();
-		env = init(pkg);
 		unlock_gc();
+
+		// boot may run GC: init.rud need not fit in initial heap
+		env = init(pkg);
+		if(freeze)
+		{
+			freeze_heap();
+		}
 	}
-	else
+	else if(nilp(entry))
 	{
 		print(env, cdr(get_env_pkg(env)), stdout);
 	}
 
-	if(argc == 1)
+	if(!nilp(entry))
+	{
+		lock_gc();
+		value_t pkg = cdr(get_env_pkg(env));
+		value_t val = parse_arg(argc - arg, argv + arg, pkg);
+		value_t key = intern("*ARGV*", pkg);
+		set_env(key, val, env);
+		unlock_gc();
+		run_entry(entry, env);
+	}
+	else if(arg == argc)
 	{
 		repl(env);
 	}
@@ -149,15 +297,41 @@ int main(int argc, char* argv[])
 	{
 		lock_gc();
 		value_t pkg = cdr(get_env_pkg(env));
-		value_t val = cdr(parse_arg(argc, argv, pkg));
+		value_t val = parse_arg(argc - arg, argv + arg, pkg);
 		value_t key = intern("*ARGV*", pkg);
 		set_env(key, val, env);
 		unlock_gc();
-		rep_file(argv[1], env);
+		rep_file(argv[arg], env);
+	}
+
+	if(gc_pauses)
+	{
+		print_gc_pauses(stderr);
+	}
+
+	if(alloc_profile)
+	{
+		FILE* fp = strcmp(alloc_profile, "-") == 0 ? stderr : fopen(alloc_profile, "w");
+		if(fp)
+		{
+			print_alloc_profile(fp, cdr(get_env_pkg(env)));
+			if(fp != stderr)
+			{
+				fclose(fp);
+			}
+		}
+		else
+		{
+			fprintf(stderr, "can't open %s.\n", alloc_profile);
+		}
 	}
 
 	release_global();
-	pop_root(1);
+	pop_root(2);
+	if(alloc_profile)
+	{
+		release_alloc_profile();
+	}
 	assert(g_lock_cnt == 0);
 	assert(check_lock());
 	return 0;
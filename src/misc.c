@@ -7,6 +7,7 @@
 #include "env.h"
 #include "package.h"
 #include "asm.h"
+#include "profile.h"
 
 /////////////////////////////////////////////////////////////////////
 // public: initialize well-known symbols
@@ -71,7 +72,7 @@ void init_global(void)
 		intern("err",		pkg),		ROP(IS_ERR),		RINT(1),
 		intern("nth",		pkg),		ROP(IS_NTH),		RINT(2),
 		intern("init",		pkg),		ROP(IS_INIT),		RINT(0),
-		intern("save-core",	pkg),		ROP(IS_SAVECORE),	RINT(1),
+		intern("save-core",	pkg),		ROP(IS_SAVECORE),	RINT_OPT(2),
 		intern("make-vector",	pkg),		ROP(IS_MAKE_VECTOR),	RINT(1),
 		intern("vref",		pkg),		ROP(IS_VREF),		RINT(2),
 		intern("rplacv",	pkg),		ROP(IS_RPLACV),		RINT(3),
@@ -95,6 +96,19 @@ void init_global(void)
 		intern("getf",		pkg),		ROP(IS_GETF),		RINT(3),
 		intern("mkpkg",		pkg),		ROP(IS_MAKE_PACKAGE),	RINT(2),
 		intern("find-package",	pkg),		ROP(IS_FIND_PACKAGE),	RINT(1),
+		intern("gc-stats",	pkg),		ROP(IS_GC_STATS),	RINT(0),
+		intern("freeze-heap",	pkg),		ROP(IS_FREEZE_HEAP),	RINT(0),
+		intern("gc",		pkg),		ROP(IS_GC),		RINT(0),
+		intern("make-weak-pointer",	pkg),	ROP(IS_MAKE_WEAK_POINTER),	RINT(1),
+		intern("weak-pointer-value",	pkg),	ROP(IS_WEAK_POINTER_VALUE),	RINT(1),
+		intern("make-weak-table",	pkg),	ROP(IS_MAKE_WEAK_TABLE),	RINT(0),
+		intern("weak-get",	pkg),		ROP(IS_WEAK_GET),	RINT(2),
+		intern("weak-put",	pkg),		ROP(IS_WEAK_PUT),	RINT(3),
+		intern("weak-count",	pkg),		ROP(IS_WEAK_COUNT),	RINT(1),
+		intern("snapshot-core",	pkg),		ROP(IS_SNAPSHOT_CORE),	RINT_OPT(2),
+		intern("snapshot-wait",	pkg),		ROP(IS_SNAPSHOT_WAIT),	RINT(1),
+		intern("delete-file",	pkg),		ROP(IS_DELETE_FILE),	RINT(1),
+		intern("compiledp",	pkg),		ROP(IS_COMPILEDP),	RINT(1),
 	};
 
 	g_istbl_size = sizeof(tbl) / sizeof(tbl[0]) - 1;
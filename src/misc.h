@@ -31,6 +31,7 @@
 
 
 #define MAX(X, Y) ((X) > (Y) ? (X) : (Y))
+#define MIN(X, Y) ((X) < (Y) ? (X) : (Y))
 
 void	init_global	(void);
 void	release_global	(void);
@@ -32,11 +32,10 @@ value_t register_sym(value_t s, value_t pkg)
 		push_root(&s);
 		push_root(&sym_list);
 
-		value_t snew;
-		snew.cons      = alloc_cons();
-		snew.cons->car = s;
-		snew.cons->cdr = sym_list;
-		snew.type.main = CONS_T;
+		value_t snew      = RPTR(alloc_cons());
+		CONSOF(snew)->car = s;
+		CONSOF(snew)->cdr = sym_list;
+		snew.type.main    = CONS_T;
 
 		rplacd(pkg, snew);
 
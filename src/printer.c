@@ -489,7 +489,18 @@ static value_t pr_special(value_t s)
 static value_t pr_vec(value_t s)
 {
 	assert(vectorp(s));
-	return str_to_rstr("#<VECTOR>");
+	if(weak_pointer_p(s))
+	{
+		return str_to_rstr("#<WEAK-POINTER>");
+	}
+	else if(weak_table_p(s))
+	{
+		return str_to_rstr("#<WEAK-TABLE>");
+	}
+	else
+	{
+		return str_to_rstr("#<VECTOR>");
+	}
 }
 
 static value_t pr_vmis(value_t s)
@@ -569,6 +580,30 @@ static value_t pr_vmis(value_t s)
 		case IS_REVERSE:	return str_to_rstr("IS_REVERSE");
 		case IS_MAKE_PACKAGE:	return str_to_rstr("IS_MAKE_PACKAGE");
 		case IS_FIND_PACKAGE:	return str_to_rstr("IS_FIND_PACKAGE");
+		case IS_GC_STATS:	return str_to_rstr("IS_GC_STATS");
+		case IS_FREEZE_HEAP:	return str_to_rstr("IS_FREEZE_HEAP");
+		case IS_GC:		return str_to_rstr("IS_GC");
+		case IS_MAKE_WEAK_POINTER:	return str_to_rstr("IS_MAKE_WEAK_POINTER");
+		case IS_WEAK_POINTER_VALUE:	return str_to_rstr("IS_WEAK_POINTER_VALUE");
+		case IS_MAKE_WEAK_TABLE:	return str_to_rstr("IS_MAKE_WEAK_TABLE");
+		case IS_WEAK_GET:	return str_to_rstr("IS_WEAK_GET");
+		case IS_WEAK_PUT:	return str_to_rstr("IS_WEAK_PUT");
+		case IS_WEAK_COUNT:	return str_to_rstr("IS_WEAK_COUNT");
+		case IS_SNAPSHOT_CORE:	return str_to_rstr("IS_SNAPSHOT_CORE");
+		case IS_SNAPSHOT_WAIT:	return str_to_rstr("IS_SNAPSHOT_WAIT");
+		case IS_ADD_IMM:	return str_to_rstr("IS_ADD_IMM");
+		case IS_SUB_IMM:	return str_to_rstr("IS_SUB_IMM");
+		case IS_EQ_BNIL:	return str_to_rstr("IS_EQ_BNIL");
+		case IS_LT_BNIL:	return str_to_rstr("IS_LT_BNIL");
+		case IS_ELT_BNIL:	return str_to_rstr("IS_ELT_BNIL");
+		case IS_MT_BNIL:	return str_to_rstr("IS_MT_BNIL");
+		case IS_EMT_BNIL:	return str_to_rstr("IS_EMT_BNIL");
+		case IS_DUP_MACROP_BNIL:	return str_to_rstr("IS_DUP_MACROP_BNIL");
+		case IS_BIND_ARG:	return str_to_rstr("IS_BIND_ARG");
+		case IS_ARG_END:	return str_to_rstr("IS_ARG_END");
+		case IS_TAP:		return str_to_rstr("IS_TAP");
+		case IS_DELETE_FILE:	return str_to_rstr("IS_DELETE_FILE");
+		case IS_COMPILEDP:	return str_to_rstr("IS_COMPILEDP");
 		default:		return RERR(ERR_NOTIMPL, str_to_rstr("VMIS"));
 	}
 }
@@ -619,7 +654,7 @@ value_t pr_str(value_t s, value_t pkg, value_t annotate, bool print_readably)
 		return pr_str_cons(s, pkg, annotate, print_readably);
 
 	    case VEC_T:
-		return is_str(s) ? pr_str_str(s, print_readably) : pr_vec(s);
+		return nilp(vtype(s)) && is_str(s) ? pr_str_str(s, print_readably) : pr_vec(s);
 
 	    case SYM_T:
 		return pr_sym(s, pkg);
@@ -0,0 +1,195 @@
+#include <stdlib.h>
+#include <string.h>
+#ifdef THREADS
+#include <pthread.h>
+#endif // THREADS
+#include "builtin.h"
+#include "allocator.h"
+#include "printer.h"
+#include "profile.h"
+
+
+/////////////////////////////////////////////////////////////////////
+// private: allocation sites
+//
+// a site is a pc of VM code, with its source form and whole code taken from
+// debug vector: closures made from one lambda share them. they are kept in
+// roots, so sites are compared after GC moves them, too.
+
+static value_t	s_site_form[PROF_SITE_SIZE * 2];	// source form and code of each site
+static int	s_site_pc[PROF_SITE_SIZE];
+static long	s_site_samples[PROF_SITE_SIZE];
+static size_t	s_site_words[PROF_SITE_SIZE];
+static int	s_site_cnt		= 0;
+static int	s_site_top		= -1;		// last used word of s_site_form
+static long	s_samples		= 0;
+static long	s_dropped		= 0;		// samples not recorded: no room for site
+#ifdef THREADS
+static pthread_mutex_t	s_site_lock	= PTHREAD_MUTEX_INITIALIZER;
+#endif // THREADS
+
+static int find_site(value_t form, value_t code, int pc)
+{
+	for(int i = 0; i < s_site_cnt; i++)
+	{
+		if(s_site_pc[i] == pc && s_site_form[i * 2].raw == form.raw && s_site_form[i * 2 + 1].raw == code.raw)
+		{
+			return i;
+		}
+	}
+
+	if(s_site_cnt >= PROF_SITE_SIZE)
+	{
+		return -1;
+	}
+
+	int i                  = s_site_cnt++;
+	s_site_form[i * 2]     = form;
+	s_site_form[i * 2 + 1] = code;
+	s_site_pc[i]           = pc;
+	s_site_samples[i]      = 0;
+	s_site_words[i]        = 0;
+	s_site_top             = i * 2 + 1;
+	return i;
+}
+
+static int cmp_site(const void* a, const void* b)
+{
+	size_t x = s_site_words[*(const int*)a];
+	size_t y = s_site_words[*(const int*)b];
+	return x < y ? 1 : x > y ? -1 : 0;
+}
+
+// print at most PROF_TEXT_SIZE chars of v.
+static void print_form(FILE* fp, value_t v, value_t pkg)
+{
+	char* s = rstr_to_str(pr_str(v, pkg, NIL, false));
+	if(s)
+	{
+		if(strlen(s) > PROF_TEXT_SIZE)
+		{
+			strcpy(s + PROF_TEXT_SIZE - 3, "...");
+		}
+		fputs(s, fp);
+		free(s);
+	}
+}
+
+/////////////////////////////////////////////////////////////////////
+// public: allocation profiler
+
+// sample one in rate allocations. GC roots are pushed: call before boot.
+void init_alloc_profile(long rate)
+{
+	g_prof_rate      = rate;
+	g_prof_countdown = rate;
+	push_root_raw_vec(s_site_form, &s_site_top);
+}
+
+void release_alloc_profile(void)
+{
+	g_prof_rate = 0;
+	pop_root(1);
+}
+
+// attribute pending samples to instruction at pc, or to code out of VM if debug is nil.
+// it does not allocate.
+void record_alloc_site(value_t debug, int pc)
+{
+	value_t form = NIL;
+	value_t code = NIL;
+	if(vectorp(debug) && vsize(debug) > 0)
+	{
+		// debug vector has source form of each instruction, and whole code at last
+		int n = vsize(debug);
+		form  = pc >= 0 && pc < n ? vref(debug, pc) : NIL;
+		code  = vref(debug, n - 1);
+	}
+	else
+	{
+		pc = -1;
+	}
+
+#ifdef THREADS
+	pthread_mutex_lock(&s_site_lock);
+#endif // THREADS
+	int i = find_site(form, code, pc);
+	s_samples += g_prof_pending;
+	if(i < 0)
+	{
+		s_dropped += g_prof_pending;
+	}
+	else
+	{
+		s_site_samples[i] += g_prof_pending;
+		s_site_words[i]   += g_prof_pending_words;
+	}
+#ifdef THREADS
+	pthread_mutex_unlock(&s_site_lock);
+#endif // THREADS
+	g_prof_pending       = 0;
+	g_prof_pending_words = 0;
+}
+
+// sites sorted by sampled bytes. counts are scaled by sampling rate.
+void print_alloc_profile(FILE* fp, value_t pkg)
+{
+	if(g_prof_pending)
+	{
+		record_alloc_site(NIL, -1);
+	}
+
+	int  n   = s_site_cnt;
+	int* ord = (int*)malloc(sizeof(int) * (n ? n : 1));
+	if(!ord)
+	{
+		return;
+	}
+	for(int i = 0; i < n; i++)
+	{
+		ord[i] = i;
+	}
+	qsort(ord, n, sizeof(int), cmp_site);
+
+	size_t total = 0;
+	for(int i = 0; i < n; i++)
+	{
+		total += s_site_words[i];
+	}
+
+	// printing allocates: it is not profiled
+	long rate   = g_prof_rate;
+	g_prof_rate = 0;
+	push_root(&pkg);
+
+	fprintf(fp, "Allocation profile: 1 in %ld allocations, %ld samples, %ld dropped\n", rate, s_samples, s_dropped);
+	fprintf(fp, "%12s %6s %10s  %4s  %s\n", "bytes", "%", "allocs", "pc", "site / code");
+	for(int j = 0; j < n; j++)
+	{
+		int i = ord[j];
+		fprintf(fp, "%12zu %5.1f%% %10ld  %4d  ",
+			s_site_words[i] * sizeof(value_t) * rate,
+			total ? 100.0 * s_site_words[i] / total : 0.0,
+			s_site_samples[i] * rate,
+			s_site_pc[i]);
+
+		if(s_site_pc[i] >= 0)
+		{
+			print_form(fp, s_site_form[i * 2], pkg);
+			fputs(" / ", fp);
+			print_form(fp, s_site_form[i * 2 + 1], pkg);
+		}
+		else
+		{
+			fputs("(not in VM)", fp);
+		}
+		fputc('\n', fp);
+	}
+
+	pop_root(1);
+	g_prof_rate = rate;
+	free(ord);
+}
+
+// End of File
+/////////////////////////////////////////////////////////////////////
@@ -0,0 +1,35 @@
+#ifndef _profile_h_
+#define _profile_h_
+
+#include <stdio.h>
+#include "misc.h"
+#include "builtin.h"
+#include "allocator.h"
+
+#define PROF_SITE_SIZE		4096		// distinct allocation sites recorded
+#define PROF_DEFAULT_RATE	1024		// one in this many allocations is sampled
+#define PROF_TEXT_SIZE		60		// chars of form printed in report
+
+EXTERN long		g_prof_rate;		// 0 if not profiling
+EXTERN TLS long		g_prof_countdown;	// allocations until next sample
+EXTERN TLS long		g_prof_pending;		// samples not attributed to a site yet
+EXTERN TLS size_t	g_prof_pending_words;
+
+void	init_alloc_profile	(long rate);
+void	release_alloc_profile	(void);
+void	record_alloc_site	(value_t debug, int pc);
+void	print_alloc_profile	(FILE* fp, value_t pkg);
+
+// called on every allocation of size words. exec_vm attributes samples to
+// the instruction after it is done: pc is not spilled for allocator.
+static inline void profile_alloc(size_t words)
+{
+	if(g_prof_rate && --g_prof_countdown <= 0)
+	{
+		g_prof_countdown      = g_prof_rate;
+		g_prof_pending       += 1;
+		g_prof_pending_words += words;
+	}
+}
+
+#endif // _profile_h_
@@ -294,7 +294,9 @@ value_t read_line_prompt(value_t pkg, FILE* fp)
 	p[len]     = '>';
 	p[len + 1] = ' ';
 	p[len + 2] = '\0';
+	enter_blocking();
 	char* line = linenoise(p);
+	leave_blocking();
 	free(pn);
 	free(p);
 	if(line)
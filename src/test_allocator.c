@@ -15,8 +15,8 @@ void test_alloc_000(void)
 	pop_root();
 
 	CU_ASSERT(!EQ(r, r2));
-	CU_ASSERT(g_memory_pool      == (value_t*)r.cons);
-	CU_ASSERT(g_memory_pool_from == (value_t*)r2.cons);
+	CU_ASSERT(g_memory_pool      == VPTROF(r));
+	CU_ASSERT(g_memory_pool_from == VPTROF(r2));
 	CU_ASSERT(EQ(car(r), RINT(1)));
 	CU_ASSERT(EQ(cdr(r), RINT(2)));
 }
@@ -31,8 +31,8 @@ void test_alloc_001(void)
 	pop_root();
 
 	CU_ASSERT(!EQ(r, r2));
-	CU_ASSERT(g_memory_pool      == (value_t*)r.cons);
-	CU_ASSERT(g_memory_pool_from == (value_t*)r2.cons);
+	CU_ASSERT(g_memory_pool      == VPTROF(r));
+	CU_ASSERT(g_memory_pool_from == VPTROF(r2));
 	CU_ASSERT(EQ(car(r), RINT(1)));
 	CU_ASSERT(EQ(cdr(r), RINT(2)));
 }
@@ -47,10 +47,10 @@ void test_alloc_002(void)
 	pop_root();
 
 	CU_ASSERT(!EQ(r, r2));
-	CU_ASSERT(g_memory_pool           == (value_t*)r.cons);
-	CU_ASSERT(g_memory_pool      +  2 == (value_t*)r.cons->cdr.cons);
-	CU_ASSERT(g_memory_pool      +  4 == (value_t*)r.cons->cdr.cons->cdr.cons);
-	CU_ASSERT(g_memory_pool_from +  4 == (value_t*)r2.cons);
+	CU_ASSERT(g_memory_pool           == VPTROF(r));
+	CU_ASSERT(g_memory_pool      +  2 == VPTROF(cdr(r)));
+	CU_ASSERT(g_memory_pool      +  4 == VPTROF(cdr(cdr(r))));
+	CU_ASSERT(g_memory_pool_from +  4 == VPTROF(r2));
 	CU_ASSERT(EQ(first(r),  RINT(1)));
 	CU_ASSERT(EQ(second(r), RINT(2)));
 	CU_ASSERT(EQ(third(r),  RINT(3)));
@@ -67,12 +67,12 @@ void test_alloc_003(void)
 	pop_root();
 
 	CU_ASSERT(!EQ(r, r2));
-	CU_ASSERT(g_memory_pool           == (value_t*)r.cons);
-	CU_ASSERT(g_memory_pool      +  2 == (value_t*)r.cons->car.cons);
-	CU_ASSERT(g_memory_pool      +  4 == (value_t*)r.cons->car.cons->cdr.cons);
-	CU_ASSERT(g_memory_pool      +  6 == (value_t*)r.cons->cdr.cons);
-	CU_ASSERT(g_memory_pool      +  8 == (value_t*)r.cons->cdr.cons->cdr.cons);
-	CU_ASSERT(g_memory_pool_from +  8 == (value_t*)r2.cons);
+	CU_ASSERT(g_memory_pool           == VPTROF(r));
+	CU_ASSERT(g_memory_pool      +  2 == VPTROF(car(r)));
+	CU_ASSERT(g_memory_pool      +  4 == VPTROF(cdr(car(r))));
+	CU_ASSERT(g_memory_pool      +  6 == VPTROF(cdr(r)));
+	CU_ASSERT(g_memory_pool      +  8 == VPTROF(cdr(cdr(r))));
+	CU_ASSERT(g_memory_pool_from +  8 == VPTROF(r2));
 	CU_ASSERT(EQ(car(car(r)),  RINT(1)));
 	CU_ASSERT(EQ(car(cdr(car(r))),  RINT(2)));
 	CU_ASSERT(EQ(second(r), RINT(3)));
@@ -109,10 +109,10 @@ void test_alloc_005(void)
 	CU_ASSERT(clojurep(r2));
 	r.type.main = CONS_T;
 	r2.type.main = CONS_T;
-	CU_ASSERT(g_memory_pool           == (value_t*)r.cons);
-	CU_ASSERT(g_memory_pool      +  2 == (value_t*)r.cons->cdr.cons);
-	CU_ASSERT(g_memory_pool      +  4 == (value_t*)r.cons->cdr.cons->cdr.cons);
-	CU_ASSERT(g_memory_pool_from +  4 == (value_t*)r2.cons);
+	CU_ASSERT(g_memory_pool           == VPTROF(r));
+	CU_ASSERT(g_memory_pool      +  2 == VPTROF(cdr(r)));
+	CU_ASSERT(g_memory_pool      +  4 == VPTROF(cdr(cdr(r))));
+	CU_ASSERT(g_memory_pool_from +  4 == VPTROF(r2));
 	CU_ASSERT(EQ(first(r),  RINT(1)));
 	CU_ASSERT(EQ(second(r), RINT(2)));
 	CU_ASSERT(EQ(third(r),  RINT(3)));
@@ -134,10 +134,10 @@ void test_alloc_006(void)
 	CU_ASSERT(macrop(r2));
 	r.type.main = CONS_T;
 	r2.type.main = CONS_T;
-	CU_ASSERT(g_memory_pool           == (value_t*)r.cons);
-	CU_ASSERT(g_memory_pool      +  2 == (value_t*)r.cons->cdr.cons);
-	CU_ASSERT(g_memory_pool      +  4 == (value_t*)r.cons->cdr.cons->cdr.cons);
-	CU_ASSERT(g_memory_pool_from +  4 == (value_t*)r2.cons);
+	CU_ASSERT(g_memory_pool           == VPTROF(r));
+	CU_ASSERT(g_memory_pool      +  2 == VPTROF(cdr(r)));
+	CU_ASSERT(g_memory_pool      +  4 == VPTROF(cdr(cdr(r))));
+	CU_ASSERT(g_memory_pool_from +  4 == VPTROF(r2));
 	CU_ASSERT(EQ(first(r),  RINT(1)));
 	CU_ASSERT(EQ(second(r), RINT(2)));
 	CU_ASSERT(EQ(third(r),  RINT(3)));
@@ -160,11 +160,11 @@ void test_alloc_007(void)
 	CU_ASSERT(macrop(r2));
 	r.type.main = CONS_T;
 	r2.type.main = CONS_T;
-	CU_ASSERT(g_memory_pool           == (value_t*)r.cons);
-	CU_ASSERT(g_memory_pool      +  2 == (value_t*)r.cons->cdr.cons);
-	CU_ASSERT(g_memory_pool      +  4 == (value_t*)r.cons->cdr.cons->cdr.cons);
-	CU_ASSERT(g_memory_pool           == (value_t*)r.cons->cdr.cons->cdr.cons->cdr.cons);
-	CU_ASSERT(g_memory_pool_from +  4 == (value_t*)r2.cons);
+	CU_ASSERT(g_memory_pool           == VPTROF(r));
+	CU_ASSERT(g_memory_pool      +  2 == VPTROF(cdr(r)));
+	CU_ASSERT(g_memory_pool      +  4 == VPTROF(cdr(cdr(r))));
+	CU_ASSERT(g_memory_pool           == VPTROF(cdr(cdr(cdr(r)))));
+	CU_ASSERT(g_memory_pool_from +  4 == VPTROF(r2));
 	CU_ASSERT(EQ(first(r),  RINT(1)));
 	CU_ASSERT(EQ(second(r), RINT(2)));
 	CU_ASSERT(EQ(third(r),  RINT(3)));
@@ -182,10 +182,10 @@ void test_alloc_008(void)
 	pop_root();
 
 	CU_ASSERT(!EQ(r, r2));
-	CU_ASSERT(g_memory_pool           == (value_t*)r.cons);
-	CU_ASSERT(g_memory_pool      +  2 == (value_t*)r.cons->cdr.cons);
-	CU_ASSERT(g_memory_pool      +  4 == (value_t*)r.cons->cdr.cons->cdr.cons);
-	CU_ASSERT(g_memory_pool_from + 10 == (value_t*)r2.cons);
+	CU_ASSERT(g_memory_pool           == VPTROF(r));
+	CU_ASSERT(g_memory_pool      +  2 == VPTROF(cdr(r)));
+	CU_ASSERT(g_memory_pool      +  4 == VPTROF(cdr(cdr(r))));
+	CU_ASSERT(g_memory_pool_from + 10 == VPTROF(r2));
 	CU_ASSERT(EQ(first(r),  RINT(1)));
 	CU_ASSERT(EQ(second(r), RINT(2)));
 	CU_ASSERT(EQ(third(r),  RINT(3)));
@@ -210,11 +210,11 @@ void test_alloc_009(void)
 
 	r.type.main  = CONS_T;
 	r2.type.main = CONS_T;
-	CU_ASSERT(g_memory_pool           == (value_t*)r.vector);
-	CU_ASSERT(g_memory_pool      +  4 == (value_t*)r.vector->data);
-	CU_ASSERT(g_memory_pool_from      == (value_t*)r2.vector);
-	CU_ASSERT(r.vector->size  == 3);
-	CU_ASSERT(r.vector->alloc == 4);
+	CU_ASSERT(g_memory_pool           == VPTROF(r));
+	CU_ASSERT(g_memory_pool      +  4 == vdata(r));
+	CU_ASSERT(g_memory_pool_from      == VPTROF(r2));
+	CU_ASSERT(vsize(r)      == 3);
+	CU_ASSERT(vallocsize(r) == 4);
 
 	r.type.main  = VEC_T;
 	r2.type.main = VEC_T;
@@ -243,16 +243,16 @@ void test_alloc_010(void)
 
 	r.type.main  = CONS_T;
 	r2.type.main = CONS_T;
-	CU_ASSERT(g_memory_pool           == (value_t*)r.vector);
-	CU_ASSERT(g_memory_pool      +  4 == (value_t*)r.vector->data);
-	CU_ASSERT(g_memory_pool      +  8 == (value_t*)r.vector->data[0].cons);
-	CU_ASSERT(g_memory_pool      + 10 == (value_t*)r.vector->data[0].cons->cdr.cons);
-	CU_ASSERT(g_memory_pool      + 12 == (value_t*)r.vector->data[1].cons);
-	CU_ASSERT(g_memory_pool      + 14 == (value_t*)r.vector->data[1].cons->cdr.cons);
-	CU_ASSERT(g_memory_pool      +  8 == (value_t*)r.vector->data[3].cons);
-	CU_ASSERT(g_memory_pool_from      == (value_t*)r2.vector);
-	CU_ASSERT(r.vector->size  == 4);
-	CU_ASSERT(r.vector->alloc == 4);
+	CU_ASSERT(g_memory_pool           == VPTROF(r));
+	CU_ASSERT(g_memory_pool      +  4 == vdata(r));
+	CU_ASSERT(g_memory_pool      +  8 == VPTROF(vref(r, 0)));
+	CU_ASSERT(g_memory_pool      + 10 == VPTROF(cdr(vref(r, 0))));
+	CU_ASSERT(g_memory_pool      + 12 == VPTROF(vref(r, 1)));
+	CU_ASSERT(g_memory_pool      + 14 == VPTROF(cdr(vref(r, 1))));
+	CU_ASSERT(g_memory_pool      +  8 == VPTROF(vref(r, 3)));
+	CU_ASSERT(g_memory_pool_from      == VPTROF(r2));
+	CU_ASSERT(vsize(r)      == 4);
+	CU_ASSERT(vallocsize(r) == 4);
 
 	r.type.main  = VEC_T;
 	r2.type.main = VEC_T;
@@ -332,7 +332,7 @@ void test_alloc_012(void)
 
 int main(int argc, char* argv[])
 {
-	init_allocator();
+	init_allocator(0, 0, GC_DEFAULT);
 	init_global();
 
 	CU_pSuite alloc_suite;
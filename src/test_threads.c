@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "builtin.h"
+#include "allocator.h"
+#include "misc.h"
+
+// mutator threads of THREADS build share a small heap: they build lists and
+// vectors, collect each other's roots with stop-the-world GC, and check that
+// their objects survive. run by make mttest.
+
+#ifdef DEBUG_GC
+#define ROUNDS		4	// every allocation collects
+#define LIST_SIZE	100
+#define VECTOR_SIZE	60
+#else  // DEBUG_GC
+#define ROUNDS		200
+#define LIST_SIZE	500
+#define VECTOR_SIZE	300
+#endif // DEBUG_GC
+
+static int	s_failed	= 0;
+
+static void check(bool ok, int id, const char* what)
+{
+	if(!ok)
+	{
+		fprintf(stderr, "thread %d: %s is broken.\n", id, what);
+		__atomic_add_fetch(&s_failed, 1, __ATOMIC_RELAXED);
+	}
+}
+
+static bool check_list(value_t l, int base, int n)
+{
+	for(int i = n - 1; i >= 0; i--, l = cdr(l))
+	{
+		if(!consp(l) || !EQ(car(l), RINT(base + i)))
+		{
+			return false;
+		}
+	}
+	return nilp(l);
+}
+
+static bool check_vector(value_t v, int base, int n)
+{
+	if(!vectorp(v) || vsize(v) != n)
+	{
+		return false;
+	}
+	for(int i = 0; i < n; i++)
+	{
+		value_t x = vref(v, i);
+		if(!consp(x) || !EQ(car(x), RINT(base + i)) || !EQ(cdr(x), RINT(i)))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+static void* mutator(void* arg)
+{
+	int id   = (int)(intptr_t)arg;
+	int base = id * 1000000;
+	attach_thread();
+
+	value_t keep = NIL;		// list made by first round, kept over every GC
+	value_t l    = NIL;
+	value_t v    = NIL;
+	push_root(&keep);
+	push_root(&l);
+	push_root(&v);
+
+	for(int r = 0; r < ROUNDS; r++)
+	{
+		l = NIL;
+		for(int i = 0; i < LIST_SIZE; i++)
+		{
+			l = cons(RINT(base + i), l);
+		}
+
+		v = make_vector(0);
+		for(int i = 0; i < VECTOR_SIZE; i++)
+		{
+			value_t x = cons(RINT(base + i), RINT(i));
+			vpush(x, v);
+		}
+
+		if(r == 0)
+		{
+			keep = l;
+		}
+		if(r % 50 == id % 50)
+		{
+			force_gc();		// stops the other threads
+		}
+		if(r % 20 == 0)
+		{
+			enter_blocking();	// GC does not wait for this thread
+			usleep(100);
+			leave_blocking();
+		}
+
+		check(check_list(l, base, LIST_SIZE),       id, "list");
+		check(check_vector(v, base, VECTOR_SIZE),   id, "vector");
+		check(check_list(keep, base, LIST_SIZE),    id, "kept list");
+	}
+
+	pop_root(3);
+	detach_thread();
+	return 0;
+}
+
+static void run(int n)
+{
+	pthread_t th[n];
+	gc_stats_t st0, st1;
+	get_gc_stats(&st0);
+
+	enter_blocking();		// main thread only waits
+	for(int i = 0; i < n; i++)
+	{
+		if(pthread_create(th + i, 0, mutator, (void*)(intptr_t)i) != 0)
+		{
+			abort();
+		}
+	}
+	for(int i = 0; i < n; i++)
+	{
+		pthread_join(th[i], 0);
+	}
+	leave_blocking();
+
+	get_gc_stats(&st1);
+	printf("%2d threads: %ld collections, %zu cons bytes\n", n,
+		st1.collections - st0.collections, st1.cons_bytes - st0.cons_bytes);
+	check(st1.collections - st0.collections >= n * ROUNDS / 50, -1, "collection count");
+	check(st1.cons_bytes - st0.cons_bytes >= (size_t)n * ROUNDS * (LIST_SIZE + VECTOR_SIZE) * 2 * sizeof(value_t), -1, "cons statistics");
+}
+
+int main(int argc, char* argv[])
+{
+	init_allocator(64 * 1024, 0, GC_DEFAULT);
+
+	for(int n = 1; n <= 16; n *= 2)
+	{
+		run(n);
+	}
+
+	printf("%d: failed checks\n", s_failed);
+	return s_failed ? 1 : 0;
+}
+
+// End of File
+/////////////////////////////////////////////////////////////////////
@@ -1,5 +1,6 @@
 
 #include <assert.h>
+#include <unistd.h>
 #include "builtin.h"
 #include "vm.h"
 #include "allocator.h"
@@ -9,6 +10,7 @@
 #include "printer.h"
 #include "compile_vm.h"
 #include "asm.h"
+#include "profile.h"
 
 /////////////////////////////////////////////////////////////////////
 // macros
@@ -148,6 +150,19 @@
 	} \
 }
 
+// compare and branch: pop 2 and branch if (X) is false.
+#define OP_2P0PT_BNIL(T, X) \
+{ \
+	r0 = LOCAL_VPOP_RAW; \
+	r1 = LOCAL_VPOP_RAW; \
+	if(!(T)) \
+	{ \
+		r2 = RERR_TYPE_PC; \
+		THROW(pr_str(r2, UNSAFE_CDR(pkg), NIL, false)); \
+	} \
+	pc += (X) ? 0 : op.op.operand - 1; \
+}
+
 #define OP_3P1P(X) \
 { \
 	r0 = LOCAL_VPOP_RAW; \
@@ -177,9 +192,9 @@
 #define SIXTH(X)  (UNSAFE_CAR(UNSAFE_CDR(UNSAFE_CDR(UNSAFE_CDR(UNSAFE_CDR(UNSAFE_CDR(X)))))))
 
 #define CONS(X, CAR, CDR) \
-	(X).cons = alloc_cons(); \
-	(X).cons->car = (CAR); \
-	(X).cons->cdr = (CDR); \
+	(X) = RPTR(alloc_cons()); \
+	CONSOF(X)->car = (CAR); \
+	CONSOF(X)->cdr = (CDR); \
 	(X).type.main = CONS_T;
 
 #ifdef TRACE_VM
@@ -196,6 +211,48 @@
 #define TRACE2N(X, Y, Z)
 #endif // TRACE_VM
 
+// direct threaded dispatch: each instruction jumps to the next one through
+// table of label addresses (computed goto of GCC). switch is the portable
+// fallback, and it is used with NO_THREADED_DISPATCH.
+#if defined(__GNUC__) && !defined(NO_THREADED_DISPATCH)
+#define THREADED_DISPATCH
+#endif
+
+#ifdef CHECK_GC_SANITY
+#define CHECK_SANITY	check_sanity()
+#else  // CHECK_GC_SANITY
+#define CHECK_SANITY
+#endif // CHECK_GC_SANITY
+
+// end of instruction: clear temporal registers for safe, and take pending
+// safepoint and allocation sample.
+#define STEP_END \
+{ \
+	r0 = r1 = r2 = r3 = NIL; \
+	safepoint(); \
+	if(g_prof_pending) \
+	{ \
+		record_alloc_site(debug, pc);	/* allocated by this instruction */ \
+	} \
+	CHECK_SANITY; \
+}
+
+#ifdef THREADED_DISPATCH
+#define CASE(X)		case X: L_##X
+#define CASE_DEFAULT	default: L_DEFAULT
+#define NEXT \
+{ \
+	STEP_END; \
+	op = local_vref(code, ++pc); \
+	assert(rtypeof(op) == VMIS_T); \
+	goto *dispatch[op.op.mnem]; \
+}
+#else  // THREADED_DISPATCH
+#define CASE(X)		case X
+#define CASE_DEFAULT	default
+#define NEXT		break
+#endif // THREADED_DISPATCH
+
 #define RERR_TYPE_PC	RERR(ERR_TYPE,      cons(local_vref(debug, pc), NIL))
 #define RERR_ARG_PC	RERR(ERR_ARG,       cons(local_vref(debug, pc), NIL))
 #define RERR_PC(X)	RERR((X),           cons(local_vref(debug, pc), NIL))
@@ -206,15 +263,14 @@
 
 DECL_INLINE static value_t local_make_vector(unsigned n)
 {
-	value_t v = { 0 };
-	v.vector  = alloc_vector();
+	value_t v = RPTR(alloc_vector());
 
-	if(v.vector)
+	if(v.raw)
 	{
-		v.vector->size  = RINT(0);
-		v.vector->alloc = RINT(0);
-		v.vector->type  = NIL;
-		v.vector->data  = RPTR(0);
+		VECOF(v)->size  = RINT(0);
+		VECOF(v)->alloc = RINT(0);
+		VECOF(v)->type  = NIL;
+		VECOF(v)->data  = RPTR(0);
 		v.type.main     = VEC_T;
 		v = alloc_vector_data(v, n);
 		return v;
@@ -228,7 +284,7 @@ DECL_INLINE static value_t local_make_vector(unsigned n)
 DECL_INLINE static value_t local_vref(value_t v, unsigned pos)
 {
 	assert(vectorp(v) || symbolp(v));
-	return VPTROF(AVALUE(v).vector->data)[pos];
+	return read_barrier(VPTROF(VECOF(AVALUE(v))->data) + pos);
 }
 
 DECL_INLINE static value_t local_vref_safe(value_t v, unsigned pos)
@@ -236,9 +292,9 @@ DECL_INLINE static value_t local_vref_safe(value_t v, unsigned pos)
 	assert(vectorp(v) || symbolp(v));
 	v = AVALUE(v);
 
-	if(pos < INTOF(v.vector->size))
+	if(pos < INTOF(VECOF(v)->size))
 	{
-		return VPTROF(v.vector->data)[pos];
+		return read_barrier(VPTROF(VECOF(v)->data) + pos);
 	}
 	else
 	{
@@ -251,8 +307,8 @@ DECL_INLINE static value_t local_vpush(value_t x, value_t v)
 	assert(vectorp(v));
 
 	value_t va = AVALUE(v);
-	int s = INTOF(va.vector->size);
-	int a = INTOF(va.vector->alloc);
+	int s = INTOF(VECOF(va)->size);
+	int a = INTOF(VECOF(va)->alloc);
 	if(s + 1 >= a)
 	{
 		push_root(&x);
@@ -266,8 +322,8 @@ DECL_INLINE static value_t local_vpush(value_t x, value_t v)
 		pop_root(1);
 	}
 
-	VPTROF(va.vector->data)[s] = x;
-	va.vector->size = RINT(s + 1);
+	write_barrier(VPTROF(VECOF(va)->data) + s, x);
+	VECOF(va)->size = RINT(s + 1);
 
 	return v;
 }
@@ -276,29 +332,29 @@ DECL_INLINE static value_t local_vpop(value_t v)
 {
 	assert(vectorp(v) || symbolp(v));
 	v = AVALUE(v);
-	int s = INTOF(v.vector->size) - 1;
-	v.vector->size = RINT(s);
-	return VPTROF(v.vector->data)[s];
+	int s = INTOF(VECOF(v)->size) - 1;
+	VECOF(v)->size = RINT(s);
+	return read_barrier(VPTROF(VECOF(v)->data) + s);
 }
 
 DECL_INLINE static value_t local_vpeek(value_t v)
 {
 	assert(vectorp(v) || symbolp(v));
 	v = AVALUE(v);
-	return VPTROF(v.vector->data)[INTOF(v.vector->size) - 1];
+	return read_barrier(VPTROF(VECOF(v)->data) + INTOF(VECOF(v)->size) - 1);
 }
 
 DECL_INLINE static value_t local_rplacv_top(value_t x, value_t v)
 {
 	assert(vectorp(v) || symbolp(v));
 	v = AVALUE(v);
-	return VPTROF(v.vector->data)[INTOF(v.vector->size) - 1] = x;
+	return write_barrier(VPTROF(VECOF(v)->data) + INTOF(VECOF(v)->size) - 1, x);
 }
 
 DECL_INLINE static value_t local_rplacv(value_t v, int i, value_t x)
 {
 	assert(vectorp(v) || symbolp(v));
-	return VPTROF(AVALUE(v).vector->data)[i] = x;
+	return write_barrier(VPTROF(VECOF(AVALUE(v))->data) + i, x);
 }
 
 DECL_INLINE static value_t local_get_env_value_ref(value_t ref, value_t env)
@@ -332,6 +388,47 @@ DECL_INLINE static value_t local_set_env_ref(value_t ref, value_t val, value_t e
 }
 
 
+/////////////////////////////////////////////////////////////////////
+// private: core image
+
+// save core image to fn. opt is nil, t to precompile env, or entry clojure
+// of tree shaken image.
+static value_t save_core_opt(value_t fn, value_t opt, value_t env)
+{
+	if(clojurep(opt))
+	{
+		return save_shaken_core(fn, opt, env);
+	}
+	if(!nilp(opt))
+	{
+		push_root(&fn);
+		push_root(&env);
+		value_t r = precompile(env);	// may GC
+		pop_root(2);
+		if(errp(r))
+		{
+			return r;
+		}
+	}
+	return save_core(fn, env, NIL);
+}
+
+// save core image in background by forked process. returns its process id.
+static value_t snapshot_core(value_t fn, value_t opt, value_t env)
+{
+	value_t r = fork_core();
+	if(intp(r) && INTOF(r) == 0)
+	{
+		r = save_core_opt(fn, opt, env);
+		if(errp(r) && !intp(RERR_CAUSE(r)))
+		{
+			print(r, NIL, stderr);
+		}
+		exit_core(r);
+	}
+	return r;
+}
+
 /////////////////////////////////////////////////////////////////////
 // public: VM
 value_t exec_vm(value_t c, value_t e)
@@ -393,6 +490,116 @@ value_t exec_vm(value_t c, value_t e)
 
 	pkg = get_env_pkg(env);
 
+	if(g_prof_pending)
+	{
+		record_alloc_site(NIL, -1);	// sampled out of VM
+	}
+
+#ifdef THREADED_DISPATCH
+	static void* const dispatch[256] = {
+		[0 ... 255]		= &&L_DEFAULT,
+		[IS_HALT]			= &&L_IS_HALT,
+		[IS_BR]				= &&L_IS_BR,
+		[IS_BRB]			= &&L_IS_BRB,
+		[IS_BNIL]			= &&L_IS_BNIL,
+		[IS_MKVEC_ENV]			= &&L_IS_MKVEC_ENV,
+		[IS_VPUSH_ENV]			= &&L_IS_VPUSH_ENV,
+		[IS_VPOP_ENV]			= &&L_IS_VPOP_ENV,
+		[IS_NIL_CONS_VPUSH]		= &&L_IS_NIL_CONS_VPUSH,
+		[IS_CONS_VPUSH]			= &&L_IS_CONS_VPUSH,
+		[IS_CALLCC]			= &&L_IS_CALLCC,
+		[IS_AP]				= &&L_IS_AP,
+		[IS_GOTO]			= &&L_IS_GOTO,
+		[IS_RET]			= &&L_IS_RET,
+		[IS_DUP]			= &&L_IS_DUP,
+		[IS_PUSH]			= &&L_IS_PUSH,
+		[IS_PUSHR]			= &&L_IS_PUSHR,
+		[IS_POP]			= &&L_IS_POP,
+		[IS_SETENV]			= &&L_IS_SETENV,
+		[IS_NCONC]			= &&L_IS_NCONC,
+		[IS_SWAP]			= &&L_IS_SWAP,
+		[IS_VPUSH_REST]			= &&L_IS_VPUSH_REST,
+		[IS_CONS_REST]			= &&L_IS_CONS_REST,
+		[IS_ROTL]			= &&L_IS_ROTL,
+		[IS_GETF]			= &&L_IS_GETF,
+		[IS_THROW]			= &&L_IS_THROW,
+		[IS_ATOM]			= &&L_IS_ATOM,
+		[IS_CONSP]			= &&L_IS_CONSP,
+		[IS_CLOJUREP]			= &&L_IS_CLOJUREP,
+		[IS_MACROP]			= &&L_IS_MACROP,
+		[IS_SPECIALP]			= &&L_IS_SPECIALP,
+		[IS_STRP]			= &&L_IS_STRP,
+		[IS_ERRP]			= &&L_IS_ERRP,
+		[IS_CONS]			= &&L_IS_CONS,
+		[IS_CAR]			= &&L_IS_CAR,
+		[IS_CDR]			= &&L_IS_CDR,
+		[IS_EQ]				= &&L_IS_EQ,
+		[IS_EQUAL]			= &&L_IS_EQUAL,
+		[IS_RPLACA]			= &&L_IS_RPLACA,
+		[IS_RPLACD]			= &&L_IS_RPLACD,
+		[IS_GENSYM]			= &&L_IS_GENSYM,
+		[IS_LT]				= &&L_IS_LT,
+		[IS_ELT]			= &&L_IS_ELT,
+		[IS_MT]				= &&L_IS_MT,
+		[IS_EMT]			= &&L_IS_EMT,
+		[IS_ADD]			= &&L_IS_ADD,
+		[IS_SUB]			= &&L_IS_SUB,
+		[IS_MUL]			= &&L_IS_MUL,
+		[IS_DIV]			= &&L_IS_DIV,
+		[IS_READ_STRING]		= &&L_IS_READ_STRING,
+		[IS_SLURP]			= &&L_IS_SLURP,
+		[IS_EVAL]			= &&L_IS_EVAL,
+		[IS_ERR]			= &&L_IS_ERR,
+		[IS_NTH]			= &&L_IS_NTH,
+		[IS_INIT]			= &&L_IS_INIT,
+		[IS_SAVECORE]			= &&L_IS_SAVECORE,
+		[IS_MAKE_VECTOR]		= &&L_IS_MAKE_VECTOR,
+		[IS_VREF]			= &&L_IS_VREF,
+		[IS_RPLACV]			= &&L_IS_RPLACV,
+		[IS_VSIZE]			= &&L_IS_VSIZE,
+		[IS_VEQ]			= &&L_IS_VEQ,
+		[IS_VPUSH]			= &&L_IS_VPUSH,
+		[IS_VPOP]			= &&L_IS_VPOP,
+		[IS_COPY_VECTOR]		= &&L_IS_COPY_VECTOR,
+		[IS_VCONC]			= &&L_IS_VCONC,
+		[IS_VNCONC]			= &&L_IS_VNCONC,
+		[IS_COMPILE_VM]			= &&L_IS_COMPILE_VM,
+		[IS_EXEC_VM]			= &&L_IS_EXEC_VM,
+		[IS_PR_STR]			= &&L_IS_PR_STR,
+		[IS_PRINTLINE]			= &&L_IS_PRINTLINE,
+		[IS_PRINT]			= &&L_IS_PRINT,
+		[IS_READ]			= &&L_IS_READ,
+		[IS_COUNT]			= &&L_IS_COUNT,
+		[IS_REVERSE]			= &&L_IS_REVERSE,
+		[IS_MAKE_PACKAGE]		= &&L_IS_MAKE_PACKAGE,
+		[IS_FIND_PACKAGE]		= &&L_IS_FIND_PACKAGE,
+		[IS_GC_STATS]			= &&L_IS_GC_STATS,
+		[IS_FREEZE_HEAP]		= &&L_IS_FREEZE_HEAP,
+		[IS_GC]				= &&L_IS_GC,
+		[IS_MAKE_WEAK_POINTER]		= &&L_IS_MAKE_WEAK_POINTER,
+		[IS_WEAK_POINTER_VALUE]		= &&L_IS_WEAK_POINTER_VALUE,
+		[IS_MAKE_WEAK_TABLE]		= &&L_IS_MAKE_WEAK_TABLE,
+		[IS_WEAK_GET]			= &&L_IS_WEAK_GET,
+		[IS_WEAK_PUT]			= &&L_IS_WEAK_PUT,
+		[IS_WEAK_COUNT]			= &&L_IS_WEAK_COUNT,
+		[IS_SNAPSHOT_CORE]		= &&L_IS_SNAPSHOT_CORE,
+		[IS_SNAPSHOT_WAIT]		= &&L_IS_SNAPSHOT_WAIT,
+		[IS_ADD_IMM]			= &&L_IS_ADD_IMM,
+		[IS_SUB_IMM]			= &&L_IS_SUB_IMM,
+		[IS_EQ_BNIL]			= &&L_IS_EQ_BNIL,
+		[IS_LT_BNIL]			= &&L_IS_LT_BNIL,
+		[IS_ELT_BNIL]			= &&L_IS_ELT_BNIL,
+		[IS_MT_BNIL]			= &&L_IS_MT_BNIL,
+		[IS_EMT_BNIL]			= &&L_IS_EMT_BNIL,
+		[IS_DUP_MACROP_BNIL]		= &&L_IS_DUP_MACROP_BNIL,
+		[IS_BIND_ARG]			= &&L_IS_BIND_ARG,
+		[IS_ARG_END]			= &&L_IS_ARG_END,
+		[IS_TAP]			= &&L_IS_TAP,
+		[IS_DELETE_FILE]		= &&L_IS_DELETE_FILE,
+		[IS_COMPILEDP]			= &&L_IS_COMPILEDP,
+	};
+#endif // THREADED_DISPATCH
+
 	for(int pc = 0; true; pc++)
 	{
 		value_t op = local_vref(code, pc);
@@ -406,7 +613,7 @@ again:
 		switch(op.op.mnem)
 		{
 			// core functions
-			case IS_HALT: TRACE("HALT");
+			CASE(IS_HALT): TRACE("HALT");
 #ifdef PRINT_STACK_USAGE
 #ifdef NO_INLINE
 				fprintf(stderr, "VM stack usage: stack %d, return %d\n", vallocsize(stack), vallocsize(ret));
@@ -418,48 +625,48 @@ again:
 				pop_root(10);
 				return LOCAL_VPOP_RAW;
 
-			case IS_BR: TRACE1("BR %x", pc + op.op.operand);
+			CASE(IS_BR): TRACE1("BR %x", pc + op.op.operand);
 				pc += op.op.operand - 1;
-				break;
+				NEXT;
 
-			case IS_BRB: TRACE1("BRB %x", pc - op.op.operand);
+			CASE(IS_BRB): TRACE1("BRB %x", pc - op.op.operand);
 				pc -= op.op.operand + 1;
-				break;
+				NEXT;
 
-			case IS_BNIL: TRACE1("BNIL %x", pc + op.op.operand);
+			CASE(IS_BNIL): TRACE1("BNIL %x", pc + op.op.operand);
 				OP_1P0PNE(pc += nilp(r0) ? op.op.operand - 1: 0);
-				break;
+				NEXT;
 
-			case IS_MKVEC_ENV: TRACE1("MKVEC_ENV %d", op.op.operand);
+			CASE(IS_MKVEC_ENV): TRACE1("MKVEC_ENV %d", op.op.operand);
 				OP_0P1P(local_make_vector(op.op.operand));
-				break;
+				NEXT;
 
-			case IS_VPUSH_ENV: TRACE("VPUSH_ENV");
+			CASE(IS_VPUSH_ENV): TRACE("VPUSH_ENV");
 				r0 = LOCAL_VPEEK_RAW;
 				CONS(r1, r0, env);
 				env = r1;
-				break;
+				NEXT;
 
-			case IS_VPOP_ENV: TRACE("VPOP_ENV");
+			CASE(IS_VPOP_ENV): TRACE("VPOP_ENV");
 				env = UNSAFE_CDR(env);
-				break;
+				NEXT;
 
-			case IS_NIL_CONS_VPUSH: TRACE("NIL_CONS_VPUSH");
+			CASE(IS_NIL_CONS_VPUSH): TRACE("NIL_CONS_VPUSH");
 				r0 = LOCAL_VPOP_RAW;
 				r1 = LOCAL_VPEEK_RAW;
 				CONS(r2, NIL, r0);
 				local_vpush(r2, r1);
-				break;
+				NEXT;
 
-			case IS_CONS_VPUSH: TRACE("CONS_VPUSH");
+			CASE(IS_CONS_VPUSH): TRACE("CONS_VPUSH");
 				r0 = LOCAL_VPOP_RAW;
 				r1 = LOCAL_VPOP_RAW;
 				r2 = LOCAL_VPEEK_RAW;
 				CONS(r3, r0, r1);
 				local_vpush(r3, r2);
-				break;
+				NEXT;
 
-			case IS_CALLCC: TRACE("CALLCC");
+			CASE(IS_CALLCC): TRACE("CALLCC");
 				// save continuation
 #ifdef NO_INLINE
 				r0 = copy_vector(stack);
@@ -500,7 +707,7 @@ again:
 
 				// fall-through to AP
 
-			case IS_AP: TRACE("AP");
+			CASE(IS_AP): TRACE("AP");
 apply:
 				r1 = LOCAL_VPOP_RAW;
 				if(clojurep(r1) || macrop(r1))	// compiled function
@@ -531,9 +738,30 @@ apply:
 				{
 					THROW(pr_str(RERR_PC(ERR_INVALID_AP), UNSAFE_CDR(pkg), NIL, false));
 				}
-				break;
+				NEXT;
+
+			CASE(IS_TAP): TRACE("TAP");
+				// tail call: clojure returns to caller of current clojure, so contexts are not saved
+				r1 = LOCAL_VPEEK_RAW;
+				if(!clojurep(r1))
+				{
+					goto apply;
+				}
+				r1 = LOCAL_VPOP_RAW;
+				if(nilp(THIRD(r1)))
+				{
+					r2 = compile_vm(r1, env);
+					if(errp(r2)) THROW(pr_str(r2, UNSAFE_CDR(pkg), NIL, false));
+				}
+
+				// set new execute contexts
+				code  = UNSAFE_CAR(THIRD(r1));	// clojure code
+				debug = UNSAFE_CDR(THIRD(r1));	// clojure debug symbols
+				env   = FOURTH(r1);		// clojure environment
+				pc    = -1;
+				NEXT;
 
-			case IS_GOTO: TRACE("GOTO");
+			CASE(IS_GOTO): TRACE("GOTO");
 				// fetch first argument as result
 				r0 = LOCAL_VPOP_RAW;
 
@@ -567,19 +795,19 @@ apply:
 				LOCAL_VPUSH_RAW(r0);
 				// fall through to RET
 
-			case IS_RET: TRACE("RET");
+			CASE(IS_RET): TRACE("RET");
 				env    = LOCAL_VPOP_RET_RAW;
 				pc     = INTOF(LOCAL_VPOP_RET_RAW);
 				debug  = LOCAL_VPOP_RET_RAW;
 				code   = LOCAL_VPOP_RET_RAW;
-				break;
+				NEXT;
 
-			case IS_DUP: TRACE("DUP");
+			CASE(IS_DUP): TRACE("DUP");
 				r0 = LOCAL_VPEEK_RAW;
 				LOCAL_VPUSH_RAW(r0);
-				break;
+				NEXT;
 
-			case IS_PUSH: TRACEN("PUSH: ");
+			CASE(IS_PUSH): TRACEN("PUSH: ");
 				r0 = local_vref(code, ++pc);	// next code is entity
 				if(refp(r0))
 				{
@@ -619,7 +847,7 @@ apply:
 				else if(clojurep(r0) || macrop(r0))
 				{
 					r0 = copy_list(r0);
-					AVALUE(UNSAFE_CDR(UNSAFE_CDR(UNSAFE_CDR(r0)))).cons->car = env;	// set current environment
+					write_barrier(&CELLOF(UNSAFE_CDR(UNSAFE_CDR(UNSAFE_CDR(r0))))->car, env);	// set current environment
 				}
 #ifdef TRACE_VM
 				print(r0, UNSAFE_CDR(pkg), stderr);
@@ -630,21 +858,21 @@ apply:
 					THROW(pr_str(r0, UNSAFE_CDR(pkg), NIL, false));
 				}
 				LOCAL_VPUSH_RAW(r0);
-				break;
+				NEXT;
 
-			case IS_PUSHR: TRACEN("PUSHR: ");
+			CASE(IS_PUSHR): TRACEN("PUSHR: ");
 				r0 = local_vref(code, ++pc);	// next code is entity
 #ifdef TRACE_VM
 				print(r0, UNSAFE_CDR(pkg), stderr);
 #endif // TRACE_VM
 				LOCAL_VPUSH_RAW(r0);
-				break;
+				NEXT;
 
-			case IS_POP: TRACE("POP");
+			CASE(IS_POP): TRACE("POP");
 				OP_1P0PNE();
-				break;
+				NEXT;
 
-			case IS_SETENV: TRACE("SETENV");
+			CASE(IS_SETENV): TRACE("SETENV");
 				r0 = LOCAL_VPOP_RAW;
 				r1 = LOCAL_VPEEK_RAW;
 				if(symbolp(r0))
@@ -664,39 +892,60 @@ apply:
 					local_set_env_ref(r0, r1, env);
 				}
 				LOCAL_RPLACV_TOP_RAW(r1);
-				break;
+				NEXT;
 
-			case IS_NCONC: TRACE("NCONC");
+			CASE(IS_NCONC): TRACE("NCONC");
 				OP_2P1P(nconc(r0, r1));
-				break;
+				NEXT;
 
-			case IS_SWAP: TRACE("SWAP");
+			CASE(IS_SWAP): TRACE("SWAP");
 				r0 = LOCAL_VPOP_RAW;
 				r1 = LOCAL_VPOP_RAW;
 				LOCAL_VPUSH_RAW(r0);
 				LOCAL_VPUSH_RAW(r1);
-				break;
+				NEXT;
 
-			case IS_VPUSH_REST: TRACE("VPUSH_REST");
+			CASE(IS_VPUSH_REST): TRACE("VPUSH_REST");
 				r0 = LOCAL_VPOP_RAW;	// KEY
 				r1 = LOCAL_VPOP_RAW;	// VEC
 				r3 = LOCAL_VPOP_RAW;	// ARGNUM
 				assert(intp(r3));
 				argnum = INTOF(r3);
+#ifdef CDRCODE
+				r2 = make_list(argnum + 1);
+				if(errp(r2)) THROW(pr_str(r2, UNSAFE_CDR(pkg), NIL, false));
+				CELLOF(r2)->car = r0;
+				for(r3 = r2; argnum-- > 0; )
+				{
+					r3 = UNSAFE_CDR(r3);
+					CELLOF(r3)->car = LOCAL_VPOP_RAW;
+				}
+#else  // CDRCODE
 				CONS(r2, r0, NIL);
 				r3 = r2;
 				while(argnum-- > 0)
 				{
 					CONS_AND_CDR(LOCAL_VPOP_RAW, r3);
 				}
+#endif // CDRCODE
 				local_vpush(r2, r1);
-				break;
+				NEXT;
 
-			case IS_CONS_REST: TRACE("CONS_REST");
+			CASE(IS_CONS_REST): TRACE("CONS_REST");
 				r0 = LOCAL_VPOP_RAW;	// VEC
 				r3 = LOCAL_VPOP_RAW;	// ARGNUM
 				assert(intp(r3));
 				argnum = INTOF(r3);
+#ifdef CDRCODE
+				r2 = make_list(argnum);
+				if(errp(r2)) THROW(pr_str(r2, UNSAFE_CDR(pkg), NIL, false));
+				for(r3 = r2; argnum-- > 0; r3 = UNSAFE_CDR(r3))
+				{
+					CELLOF(r3)->car = LOCAL_VPOP_RAW;
+				}
+				LOCAL_VPUSH_RAW(r0);
+				LOCAL_VPUSH_RAW(r2);
+#else  // CDRCODE
 				CONS(r2, NIL, NIL);
 				r3 = r2;
 				while(argnum-- > 0)
@@ -705,122 +954,192 @@ apply:
 				}
 				LOCAL_VPUSH_RAW(r0);
 				LOCAL_VPUSH_RAW(UNSAFE_CDR(r2));
-				break;
+#endif // CDRCODE
+				NEXT;
 
-			case IS_ROTL: TRACE("ROTL");
+			CASE(IS_ROTL): TRACE("ROTL");
 				r0 = LOCAL_VPOP_RAW;
 				r1 = LOCAL_VPOP_RAW;
 				r2 = LOCAL_VPOP_RAW;
 				LOCAL_VPUSH_RAW(r0);
 				LOCAL_VPUSH_RAW(r2);
 				LOCAL_VPUSH_RAW(r1);
-				break;
+				NEXT;
 
-			case IS_GETF: TRACE("GETF");
+			CASE(IS_GETF): TRACE("GETF");
 				OP_3P1P(getf(r0, r1, r2));
-				break;
+				NEXT;
 
-			case IS_THROW: TRACE("THROW");
+			CASE(IS_THROW): TRACE("THROW");
 				r0 = LOCAL_VPOP_RAW;
 				goto throw;
 
-			case IS_ATOM: TRACE("ATOM");
+			CASE(IS_ATOM): TRACE("ATOM");
 				OP_1P1P(atom(r0) ? g_t : NIL);
-				break;
+				NEXT;
 
-			case IS_CONSP: TRACE("CONSP");
+			CASE(IS_CONSP): TRACE("CONSP");
 				OP_1P1P(consp(r0) ? g_t : NIL);
-				break;
+				NEXT;
 
-			case IS_CLOJUREP: TRACE("CLOJUREP");
+			CASE(IS_CLOJUREP): TRACE("CLOJUREP");
 				OP_1P1P(clojurep(r0) ? g_t : NIL);
-				break;
+				NEXT;
 
-			case IS_MACROP: TRACE("MACROP");
+			CASE(IS_MACROP): TRACE("MACROP");
 				OP_1P1P(macrop(r0) ? g_t : NIL);
-				break;
+				NEXT;
+
+			CASE(IS_COMPILEDP): TRACE("COMPILEDP");
+				// clojure or macro has its code: it is not compiled on first application
+				OP_1P1P((clojurep(r0) || macrop(r0)) && !nilp(THIRD(r0)) ? g_t : NIL);
+				NEXT;
 
-			case IS_SPECIALP: TRACE("SPECIALP");
+			CASE(IS_SPECIALP): TRACE("SPECIALP");
 				OP_1P1P(specialp(r0) ? g_t : NIL);
-				break;
+				NEXT;
 
-			case IS_STRP: TRACE("STRP");
+			CASE(IS_STRP): TRACE("STRP");
 				OP_1P1P(is_str(r0) ? g_t : NIL);
-				break;
+				NEXT;
 
-			case IS_ERRP: TRACE("ERRP");
+			CASE(IS_ERRP): TRACE("ERRP");
 				OP_1P1P(errp(r0) ? g_t : NIL);
-				break;
+				NEXT;
 
-			case IS_CONS: TRACE("CONS");
+			CASE(IS_CONS): TRACE("CONS");
 				OP_2P1P(cons(r0, r1));
-				break;
+				NEXT;
 
-			case IS_CAR: TRACE("CAR");
+			CASE(IS_CAR): TRACE("CAR");
 				OP_1P1PT(rtypeof(r0) >= CONS_T && rtypeof(r0) <= ERR_T, car(r0));
-				break;
+				NEXT;
 
-			case IS_CDR: TRACE("CDR");
+			CASE(IS_CDR): TRACE("CDR");
 				OP_1P1PT(rtypeof(r0) >= CONS_T && rtypeof(r0) <= ERR_T, cdr(r0));
-				break;
+				NEXT;
 
-			case IS_EQ: TRACE("EQ");
+			CASE(IS_EQ): TRACE("EQ");
 				OP_2P1P(EQ(r0, r1)    ? g_t : NIL);
-				break;
+				NEXT;
 
-			case IS_EQUAL: TRACE("EQUAL");
+			CASE(IS_EQUAL): TRACE("EQUAL");
 				OP_2P1P(equal(r0, r1) ? g_t : NIL);
-				break;
+				NEXT;
 
-			case IS_RPLACA: TRACE("RPLACA");
+			CASE(IS_RPLACA): TRACE("RPLACA");
 				OP_2P1P(consp(r0) || macrop(r0) || clojurep(r0) || errp(r0) ? rplaca(r0, r1) : RERR_TYPE_PC);
-				break;
+				NEXT;
 
-			case IS_RPLACD: TRACE("RPLACD");
+			CASE(IS_RPLACD): TRACE("RPLACD");
 				OP_2P1P(consp(r0) || macrop(r0) || clojurep(r0) || errp(r0) ? rplacd(r0, r1) : RERR_TYPE_PC);
-				break;
+				NEXT;
 
-			case IS_GENSYM: TRACE("GENSYM");
+			CASE(IS_GENSYM): TRACE("GENSYM");
 				OP_0P1P(gensym(last(env)));
-				break;
+				NEXT;
 
-			case IS_ADD: TRACE("ADD");
+			CASE(IS_ADD): TRACE("ADD");
 				OP_2P1PT(intp(r0) && intp(r1), RINT(INTOF(r0) + INTOF(r1)));
-				break;
+				NEXT;
 
-			case IS_SUB: TRACE("SUB");
+			CASE(IS_SUB): TRACE("SUB");
 				OP_2P1PT(intp(r0) && intp(r1), RINT(INTOF(r0) - INTOF(r1)));
-				break;
+				NEXT;
 
-			case IS_MUL: TRACE("MUL");
+			CASE(IS_MUL): TRACE("MUL");
 				OP_2P1PT(intp(r0) && intp(r1), RINT(INTOF(r0) * INTOF(r1)));
-				break;
+				NEXT;
 
-			case IS_DIV: TRACE("DIV");
+			CASE(IS_DIV): TRACE("DIV");
 				OP_2P1PT(intp(r0) && intp(r1), RINT(INTOF(r0) / INTOF(r1)));
-				break;
+				NEXT;
 
-			case IS_LT: TRACE("LT");
+			CASE(IS_LT): TRACE("LT");
 				OP_2P1PT(intp(r0) && intp(r1), r0.raw <  r1.raw ? g_t : NIL);
-				break;
+				NEXT;
 
-			case IS_ELT: TRACE("ELT");
+			CASE(IS_ELT): TRACE("ELT");
 				OP_2P1PT(intp(r0) && intp(r1), r0.raw <= r1.raw ? g_t : NIL);
-				break;
+				NEXT;
 
-			case IS_MT: TRACE("MT");
+			CASE(IS_MT): TRACE("MT");
 				OP_2P1PT(intp(r0) && intp(r1), r0.raw >  r1.raw ? g_t : NIL);
-				break;
+				NEXT;
 
-			case IS_EMT: TRACE("EMT");
+			CASE(IS_EMT): TRACE("EMT");
 				OP_2P1PT(intp(r0) && intp(r1), r0.raw >= r1.raw ? g_t : NIL);
-				break;
+				NEXT;
+
+			// superinstructions
+			CASE(IS_ADD_IMM): TRACE1("ADD_IMM %d", op.op.operand);
+				OP_1P1PT(intp(r0), RINT(INTOF(r0) + (int64_t)op.op.operand));
+				NEXT;
+
+			CASE(IS_SUB_IMM): TRACE1("SUB_IMM %d", op.op.operand);
+				OP_1P1PT(intp(r0), RINT(INTOF(r0) - (int64_t)op.op.operand));
+				NEXT;
+
+			CASE(IS_EQ_BNIL): TRACE1("EQ_BNIL %x", pc + op.op.operand);
+				OP_2P0PT_BNIL(true, EQ(r0, r1));
+				NEXT;
+
+			CASE(IS_LT_BNIL): TRACE1("LT_BNIL %x", pc + op.op.operand);
+				OP_2P0PT_BNIL(intp(r0) && intp(r1), r0.raw <  r1.raw);
+				NEXT;
+
+			CASE(IS_ELT_BNIL): TRACE1("ELT_BNIL %x", pc + op.op.operand);
+				OP_2P0PT_BNIL(intp(r0) && intp(r1), r0.raw <= r1.raw);
+				NEXT;
+
+			CASE(IS_MT_BNIL): TRACE1("MT_BNIL %x", pc + op.op.operand);
+				OP_2P0PT_BNIL(intp(r0) && intp(r1), r0.raw >  r1.raw);
+				NEXT;
+
+			CASE(IS_EMT_BNIL): TRACE1("EMT_BNIL %x", pc + op.op.operand);
+				OP_2P0PT_BNIL(intp(r0) && intp(r1), r0.raw >= r1.raw);
+				NEXT;
+
+			CASE(IS_DUP_MACROP_BNIL): TRACE1("DUP_MACROP_BNIL %x", pc + op.op.operand);
+				r0 = LOCAL_VPEEK_RAW;
+				pc += macrop(r0) ? 0 : op.op.operand - 1;
+				NEXT;
+
+			CASE(IS_BIND_ARG): TRACEN("BIND_ARG: ");
+				// (arg argnum env-vector) -> (argnum-1 env-vector), with (symbol . arg) pushed to env-vector
+				r1 = local_vref(code, ++pc);	// next code is entity: symbol of parameter
+#ifdef TRACE_VM
+				print(r1, UNSAFE_CDR(pkg), stderr);
+#endif // TRACE_VM
+				r0 = LOCAL_VPOP_RAW;
+				r2 = LOCAL_VPOP_RAW;
+				if(EQ(r2, RINT(0)))
+				{
+					THROW(pr_str(RERR_OVW_PC(rerr(RINT(ERR_ARG), local_vref(debug, pc))), UNSAFE_CDR(pkg), NIL, false));	// too few argument: at rest of parameters, as ERR and PR_STR do
+				}
+				argnum = INTOF(r2);
+				r3 = LOCAL_VPOP_RAW;
+				CONS(r2, r1, r3);
+				local_vpush(r2, r0);
+				LOCAL_VPUSH_RAW(RINT(argnum - 1));
+				LOCAL_VPUSH_RAW(r0);
+				NEXT;
+
+			CASE(IS_ARG_END): TRACE("ARG_END");
+				// (argnum env-vector) -> ()
+				r0 = LOCAL_VPOP_RAW;
+				r1 = LOCAL_VPOP_RAW;
+				if(!EQ(r1, RINT(0)))
+				{
+					THROW(pr_str(RERR_OVW_PC(rerr(RINT(ERR_ARG), local_vref(debug, pc))), UNSAFE_CDR(pkg), NIL, false));	// too many argument
+				}
+				NEXT;
 
-			case IS_READ_STRING: TRACE("READ_STRING");
+			CASE(IS_READ_STRING): TRACE("READ_STRING");
 				OP_1P1P(vectorp(r0) ? read_str(r0, UNSAFE_CDR(pkg)) : RERR_TYPE_PC);
-				break;
+				NEXT;
 
-			case IS_EVAL: TRACE("EVAL");
+			CASE(IS_EVAL): TRACE("EVAL");
 				r0 = LOCAL_VPOP_RAW;
 				r1 = compile_vm(r0, env);
 				if(errp(r1)) THROW(pr_str(r1, UNSAFE_CDR(pkg), NIL, false));
@@ -835,69 +1154,77 @@ apply:
 				code  = UNSAFE_CAR(r1);	// clojure code
 				debug = UNSAFE_CDR(r1);	// clojure debug symbols
 				pc    = -1;
-				break;
+				NEXT;
 
-			case IS_ERR: TRACE("ERR");
+			CASE(IS_ERR): TRACE("ERR");
 				OP_1P1P(rerr(r0, local_vref(debug, pc)));
-				break;
+				NEXT;
 
-			case IS_NTH: TRACE("NTH");
+			CASE(IS_NTH): TRACE("NTH");
 				OP_2P1P(intp(r1) ? nth(INTOF(r1), r0) : RERR_TYPE_PC);
-				break;
+				NEXT;
 
-			case IS_INIT: TRACE("INIT");
+			CASE(IS_INIT): TRACE("INIT");
 				OP_0P1P(init(UNSAFE_CDR(pkg)));
-				break;
+				NEXT;
+
+			CASE(IS_SAVECORE): TRACE("SAVECORE");
+				OP_2P1P(is_str(r0) ? save_core_opt(r0, r1, last(env)) : RERR_TYPE_PC);
+				NEXT;
 
-			case IS_SAVECORE: TRACE("SAVECORE");
-				OP_1P1P(is_str(r0) ? save_core(r0, last(env)) : RERR_TYPE_PC);
-				break;
+			CASE(IS_SNAPSHOT_CORE): TRACE("SNAPSHOT_CORE");
+				OP_2P1P(is_str(r0) ? snapshot_core(r0, r1, last(env)) : RERR_TYPE_PC);
+				NEXT;
 
-			case IS_MAKE_VECTOR: TRACE("MAKE_VECTOR");
+			CASE(IS_SNAPSHOT_WAIT): TRACE("SNAPSHOT_WAIT");
+				OP_1P1P(wait_core(!nilp(r0)));
+				NEXT;
+
+			CASE(IS_MAKE_VECTOR): TRACE("MAKE_VECTOR");
 				OP_1P1P(intp(r0) ? make_vector(INTOF(r0)) : RERR_TYPE_PC);
-				break;
+				NEXT;
 
-			case IS_VREF: TRACE("VREF");
+			CASE(IS_VREF): TRACE("VREF");
 				OP_2P1P(vectorp(r0) ? vref(r0, INTOF(r1)) : RERR_TYPE_PC);
-				break;
+				NEXT;
 
-			case IS_RPLACV: TRACE("RPLACV");
+			CASE(IS_RPLACV): TRACE("RPLACV");
 				OP_3P1P(vectorp(r0) && intp(r1) ? rplacv(r0, INTOF(r1), r2) : RERR_TYPE_PC);
-				break;
+				NEXT;
 
-			case IS_VSIZE: TRACE("VSIZE");
+			CASE(IS_VSIZE): TRACE("VSIZE");
 				OP_1P1PT(vectorp(r0), RINT(vsize(r0)));
-				break;
+				NEXT;
 
-			case IS_VEQ: TRACE("VEQ");
+			CASE(IS_VEQ): TRACE("VEQ");
 				OP_2P1PT(vectorp(r0) && vectorp(r1), veq(r0, r1) ? g_t : NIL);
-				break;
+				NEXT;
 
-			case IS_VPUSH: TRACE("VPUSH");
+			CASE(IS_VPUSH): TRACE("VPUSH");
 				OP_2P1P(vectorp(r1) ? vpush(r0, r1) : RERR_TYPE_PC);
-				break;
+				NEXT;
 
-			case IS_VPOP: TRACE("VPOP");
+			CASE(IS_VPOP): TRACE("VPOP");
 				OP_1P1P(vectorp(r0) ? vpop(r0) : RERR_TYPE_PC);
-				break;
+				NEXT;
 
-			case IS_COPY_VECTOR: TRACE("COPY_VECTOR");
+			CASE(IS_COPY_VECTOR): TRACE("COPY_VECTOR");
 				OP_1P1P(vectorp(r0) ? copy_vector(r0) : RERR_TYPE_PC);
-				break;
+				NEXT;
 
-			case IS_VCONC: TRACE("VCONC");
+			CASE(IS_VCONC): TRACE("VCONC");
 				OP_2P1P(vectorp(r0) && vectorp(r1) ? vconc(r0, r1) : RERR_TYPE_PC);
-				break;
+				NEXT;
 
-			case IS_VNCONC: TRACE("VNCONC");
+			CASE(IS_VNCONC): TRACE("VNCONC");
 				OP_2P1PT(vectorp(r0) && vectorp(r1), vnconc(r0, r1));
-				break;
+				NEXT;
 
-			case IS_COMPILE_VM: TRACE("COMPILE_VM");
+			CASE(IS_COMPILE_VM): TRACE("COMPILE_VM");
 				OP_1P1P(compile_vm(r0, env));
-				break;
+				NEXT;
 
-			case IS_EXEC_VM: TRACE("EXEC_VM");
+			CASE(IS_EXEC_VM): TRACE("EXEC_VM");
 				r0 = LOCAL_VPOP_RAW;
 				if(consp(r0) && vectorp(car(r0)))
 				{
@@ -916,21 +1243,21 @@ apply:
 				{
 					THROW(pr_str(RERR_TYPE_PC, UNSAFE_CDR(pkg), NIL, false));
 				}
-				break;
+				NEXT;
 
-			case IS_PR_STR: TRACE("PR_STR");
+			CASE(IS_PR_STR): TRACE("PR_STR");
 				OP_2P1P(pr_str(r0, UNSAFE_CDR(pkg), NIL, !nilp(r1)));
-				break;
+				NEXT;
 
-			case IS_PRINTLINE: TRACE("PRINTLINE");
+			CASE(IS_PRINTLINE): TRACE("PRINTLINE");
 				OP_1P1P(vectorp(r0) || nilp(r0) ? (printline(r0, stdout), NIL) : RERR_TYPE_PC);
-				break;
+				NEXT;
 
-			case IS_PRINT: TRACE("PRINT");
+			CASE(IS_PRINT): TRACE("PRINT");
 				OP_1P1P((print(r0, UNSAFE_CDR(pkg), stdout), NIL));
-				break;
+				NEXT;
 
-			case IS_SLURP: TRACE("SLURP");
+			CASE(IS_SLURP): TRACE("SLURP");
 			{
 				r0 = LOCAL_VPEEK_RAW;
 				if(!vectorp(r0))
@@ -941,29 +1268,78 @@ apply:
 				LOCAL_RPLACV_TOP_RAW(slurp(fn));
 				free(fn);
 			}
-			break;
+				NEXT;
+
+			CASE(IS_DELETE_FILE): TRACE("DELETE_FILE");
+			{
+				r0 = LOCAL_VPEEK_RAW;
+				if(!vectorp(r0))
+				{
+					THROW(pr_str(RERR_TYPE_PC, UNSAFE_CDR(pkg), NIL, false));
+				}
+				char* fn  = rstr_to_str(r0);
+				LOCAL_RPLACV_TOP_RAW(unlink(fn) == 0 ? g_t : RERR(ERR_FILENOTFOUND, NIL));
+				free(fn);
+			}
+				NEXT;
 
-			case IS_READ: TRACE("READ");
+			CASE(IS_READ): TRACE("READ");
 				LOCAL_VPUSH_RAW(READ(UNSAFE_CDR(pkg), stdin));
-				break;
+				NEXT;
 
-			case IS_COUNT: TRACE("COUNT");
+			CASE(IS_COUNT): TRACE("COUNT");
 				OP_1P1P(RINT(count(r0)));
-				break;
+				NEXT;
 
-			case IS_REVERSE: TRACE("REVERSE");
+			CASE(IS_REVERSE): TRACE("REVERSE");
 				OP_1P1P(consp(r0) ? reverse(r0) : RERR_TYPE_PC);
-				break;
+				NEXT;
 
-			case IS_MAKE_PACKAGE: TRACE("MAKE_PACKAGE");
+			CASE(IS_MAKE_PACKAGE): TRACE("MAKE_PACKAGE");
 				OP_2P1P((symbolp(r0) || nilp(r0)) && (symbolp(r1) || nilp(r1)) ? make_package(r0, r1) : RERR_TYPE_PC);
-				break;
+				NEXT;
 
-			case IS_FIND_PACKAGE: TRACE("FIND_PACKAGE");
+			CASE(IS_FIND_PACKAGE): TRACE("FIND_PACKAGE");
 				OP_1P1P(symbolp(r0) || nilp(r0) ? find_package(r0) : RERR_TYPE_PC);
-				break;
+				NEXT;
+
+			CASE(IS_GC_STATS): TRACE("GC_STATS");
+				OP_0P1P(gc_stats());
+				NEXT;
+
+			CASE(IS_FREEZE_HEAP): TRACE("FREEZE_HEAP");
+				OP_0P1P(freeze_heap());
+				NEXT;
+
+			CASE(IS_GC): TRACE("GC");
+				OP_0P1P((force_gc(), g_t));
+				NEXT;
+
+			CASE(IS_MAKE_WEAK_POINTER): TRACE("MAKE_WEAK_POINTER");
+				OP_1P1P(make_weak_pointer(r0));
+				NEXT;
+
+			CASE(IS_WEAK_POINTER_VALUE): TRACE("WEAK_POINTER_VALUE");
+				OP_1P1PT(weak_pointer_p(r0), weak_pointer_value(r0));
+				NEXT;
 
-			default:
+			CASE(IS_MAKE_WEAK_TABLE): TRACE("MAKE_WEAK_TABLE");
+				OP_0P1P(make_weak_table());
+				NEXT;
+
+			CASE(IS_WEAK_GET): TRACE("WEAK_GET");
+				OP_2P1PT(weak_table_p(r0), weak_get(r0, r1));
+				NEXT;
+
+			CASE(IS_WEAK_PUT): TRACE("WEAK_PUT");
+				OP_3P1P(weak_table_p(r0) ? weak_put(r0, r1, r2) : RERR_TYPE_PC);
+				NEXT;
+
+			CASE(IS_WEAK_COUNT): TRACE("WEAK_COUNT");
+				OP_1P1PT(weak_table_p(r0), RINT(weak_count(r0)));
+				NEXT;
+
+			CASE_DEFAULT:
 				THROW(pr_str(RERR_PC(ERR_INVALID_IS), UNSAFE_CDR(pkg), NIL, false));
 
 throw:
@@ -984,12 +1360,7 @@ throw:
 				goto apply;
 		}
 
-		// clear temporal registers for safe
-		r0 = r1 = r2 = r3 = NIL;
-		//check_gc();
-#ifdef CHECK_GC_SANITY
-		check_sanity();
-#endif // CHECK_GC_SANITY
+		STEP_END;
 	}
 
 	return NIL;	// not reached